@@ -5,20 +5,30 @@
 #include "client_special_id.h"
 #include "allocated_address.h"
 #include "config.h"
+#include "clock.h"
 #include "addresses_pool.h"
 #include "state_serializer.h"
 #include "state_deserializer.h"
+#include "legacy_state_deserializer.h"
 #include "client.h"
+#include "lease_listener.h"
+#include "memory_accounting.h"
 #include <stdint.h>
 #include <unordered_map>
+#include <unordered_set>
 #include <map>
+#include <string>
+
+/* Leases of one network keyed by client, the map is also the client index */
+template <class T> using LeasesMap = TrackedMap<T, AllocatedAddress, MEMORY_LEASES>;
 
 class AddressesAllocator {
 	public:
-		AddressesAllocator(Config& config);
+		AddressesAllocator(Config& config, Clock& clock);
 		~AddressesAllocator();
 
-		AllocatedAddress& allocateAddressFor(const Client& client);
+		/* NULL when client network has no pool or the pool is exhausted */
+		AllocatedAddress* allocateAddressFor(const Client& client);
 		bool hasClientAllocatedAddress(const Client&);
 		void freeClientAddress(const Client& client);
 		void freeClientAddressButLeaveUnavailable(const Client& client);
@@ -27,32 +37,75 @@ class AddressesAllocator {
 		AllocatedAddress& refreshLeaseTime(const Client& client);
 		void saveState();
 
+		/* Applies pools of reloaded configuration, caller guarantees no concurrent allocator use */
+		void reconfigure();
+		/* Pools are only added by reconfigure, usage of each pool may be read from any thread */
+		const std::unordered_map<uint32_t, AddressesPool*>& getPools();
+
+		void setLeaseListener(LeaseListener*);
+		void replayLeases(LeaseListener&);
+		/* Leases of one network only, caller keeps the worker owning it paused */
+		void replayLeases(LeaseListener&, uint32_t networkAddress);
+
+		/* Used when applying replicated state, pools are updated to match restored leases */
+		void restoreLease(uint32_t networkAddress, const HardwareAddress&, const AllocatedAddress&);
+		void restoreLease(uint32_t networkAddress, const ClientSpecialId&, const AllocatedAddress&);
+		void removeLease(uint32_t networkAddress, const HardwareAddress&, bool reusable);
+		void removeLease(uint32_t networkAddress, const ClientSpecialId&, bool reusable);
+		void clearLeases();
+
 	private:
 		Config& config;
+		Clock& clock;
 		std::unordered_map<uint32_t, AddressesPool*> addressesPools;
-		std::map<uint32_t, std::map<HardwareAddress, AllocatedAddress> > allocatedByHardware;
-		std::map<uint32_t, std::map<ClientSpecialId, AllocatedAddress> > allocatedBySpecialId;
+		std::map<uint32_t, LeasesMap<HardwareAddress> > allocatedByHardware;
+		std::map<uint32_t, LeasesMap<ClientSpecialId> > allocatedBySpecialId;
+		std::unordered_map<uint32_t, bool> modifiedNetworks;
+		/* Earliest time a lease of the network may expire, reclaim scans of exhausted pools wait for it */
+		std::unordered_map<uint32_t, time_t> reclaimableAt;
+		LeaseListener* leaseListener;
 
 		AllocatedAddress& allocate(const uint32_t networkAddress, const HardwareAddress& hardwareAddress, const uint32_t address);
 		AllocatedAddress& allocate(const uint32_t networkAddress, const ClientSpecialId& specialId, const uint32_t address);
 		void fillAddress(uint32_t networkAddress, uint32_t ip, AllocatedAddress&);
+		void fillAddress(const std::shared_ptr<const PoolDescriptor>&, uint32_t ip, AllocatedAddress&);
+		void createPools();
 
 		uint32_t determineClientNetwork(uint32_t giaddr);
 		uint32_t matchNetworkToAddress(uint32_t address);
 
-		uint32_t free(uint32_t networkAddress, const HardwareAddress&);
-		uint32_t free(uint32_t networkAddress, const ClientSpecialId&);
+		uint32_t free(uint32_t networkAddress, const HardwareAddress&, bool reusable);
+		uint32_t free(uint32_t networkAddress, const ClientSpecialId&, bool reusable);
+
+		void notifyUpdated(const Client&, const AllocatedAddress&);
+		template <class T> void notifyUpdated(uint32_t networkAddress, const T& clientId, const AllocatedAddress&);
+		template <class T> void notifyRemoved(uint32_t networkAddress, const T& clientId, uint32_t ipAddress, bool reusable);
+		template <class T> void replayLeases(LeaseListener&, std::map<uint32_t, LeasesMap<T> >&);
+		template <class T> void replayLeases(LeaseListener&, uint32_t networkAddress, std::map<uint32_t, LeasesMap<T> >&);
+		template <class T> void restoreLease(uint32_t networkAddress, const T& clientId, const AllocatedAddress&, std::map<uint32_t, LeasesMap<T> >&);
+		template <class T> void removeLease(uint32_t networkAddress, const T& clientId, bool reusable, std::map<uint32_t, LeasesMap<T> >&);
+
+		uint32_t findNextAddr(AddressesPool*, const Client& client);
+		uint32_t reuseOutdatedAddress(AddressesPool*, uint32_t clientHash);
+		static uint32_t hashClient(const Client& client);
+		template <class T> void reuseOutdatedAddress(AddressesPool*, LeasesMap<T>&, time_t now, time_t& nextExpiration);
+		void noteExpiration(uint32_t networkAddress, const AllocatedAddress&);
 
-		uint32_t findNextAddr(uint32_t network);
-		uint32_t reuseOutdatedAddress(uint32_t network);
-		template <class T> void reuseOutdatedAddress(AddressesPool*, std::map<T, AllocatedAddress>&);
+		void prepareNetwork(uint32_t networkAddress);
+		AddressesPool* getPool(uint32_t networkAddress);
+		template <class T> LeasesMap<T>& getAddressesInNetwork(std::map<uint32_t, LeasesMap<T> >&, uint32_t networkAddress);
+		void markModified(uint32_t networkAddress);
+		std::string getPartitionFilePath(uint32_t networkAddress);
 
-		template <class T> void saveAllocatedAddresses(StateSerializer&, std::map<uint32_t, std::map<T, AllocatedAddress> >&);
-		void saveAddressesPools(StateSerializer&);
+		void savePartition(uint32_t networkAddress);
+		template <class T> void saveAllocatedAddresses(StateSerializer&, uint32_t networkAddress, std::map<uint32_t, LeasesMap<T> >&);
 		void tryToLoadCachedState();
 
-		template <class T> void loadAllocatedAddresses(StateDeserializer&, std::map<uint32_t, std::map<T, AllocatedAddress> >&);
-		void loadAddressesPools(StateDeserializer&);
+		void loadPartition(uint32_t networkAddress);
+		template <class R, class T> void loadAllocatedAddresses(StateDeserializer&, AddressesPool*, LeasesMap<T>&, time_t now);
+		void loadAddressesPool(StateDeserializer&, AddressesPool*);
+		void importLegacyCache();
+		template <class T> size_t importLegacyLeases(const std::vector<LegacyLease<T> >&, const std::unordered_set<uint32_t>& networks, std::map<uint32_t, LeasesMap<T> >&, time_t now);
 };
 
 #endif
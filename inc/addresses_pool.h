@@ -3,34 +3,92 @@
 
 #include <stdint.h>
 #include <unordered_set>
+#include <memory>
+#include <atomic>
 #include "pool_descriptor.h"
+#include "memory_accounting.h"
 
 class StateSerializer;
 class StateDeserializer;
 
+/*
+ * Addresses of the range are either unassigned (never handed out), abandoned (returned and reusable),
+ * quarantined (declined by a client, kept unavailable) or leased. Hashed pools do not tell unassigned
+ * and abandoned addresses apart, both are reported as unassigned.
+ */
+struct PoolUsage {
+	uint32_t size;
+	uint32_t unassigned;
+	uint32_t abandoned;
+	uint32_t quarantined;
+	uint32_t leased;
+	uint64_t allocations;
+	uint64_t reclaims;
+};
+
 class AddressesPool {
 	friend class StateSerializer;
 	friend class StateDeserializer;
 	public:
 		AddressesPool(const PoolDescriptor&);
 
-		uint32_t getNext();
+		/* Grows or shrinks pool in place, addresses leased outside of new range stay leased until freed */
+		void reconfigure(const PoolDescriptor&);
+		const std::shared_ptr<const PoolDescriptor>& getDescriptor();
+
+		/*
+		 * Client hash selects the first probed address of hashed pools, sequential pools ignore it.
+		 * Returns 0 when every address of the range is in use.
+		 */
+		uint32_t getNext(uint32_t clientHash);
 		void abandon(uint32_t address);
+		/* Abandons address of an expired lease */
+		void reclaim(uint32_t address);
+		/* Address stays unavailable until pool is reset */
+		void quarantine(uint32_t address);
+		void reserve(uint32_t address);
+		/* Hashed pools are rebuilt from leases alone, saved position is ignored */
+		void restore(uint32_t nextToAssign);
+		void reset();
+		/* Addresses handed out and not abandoned, but without a lease, were declined */
+		void recountQuarantined(size_t leasesCount);
+
+		/* Counters are kept up to date by the owning thread, may be read from any thread */
+		PoolUsage getUsage();
 
 		uint32_t getNetworkAddress();
 		bool mayContain(uint32_t address);
 
-		const PoolDescriptor descriptor;
-
 	private:
+		std::shared_ptr<const PoolDescriptor> descriptor;
+
 		uint32_t networkAddress;
 		uint32_t nextToAssign;
 
-		std::unordered_set<uint32_t> abandonedAddresses;
+		TrackedUnorderedSet<uint32_t, MEMORY_POOLS> abandonedAddresses;
+
+		/* Hashed pools only: bit per address of the range, set while handed out */
+		TrackedVector<uint64_t, MEMORY_POOLS> usedAddresses;
+		uint32_t usedCount;
+
+		std::atomic<uint32_t> assignedCount;
+		std::atomic<uint32_t> abandonedCount;
+		std::atomic<uint32_t> quarantinedCount;
+		std::atomic<uint64_t> allocationsCount;
+		std::atomic<uint64_t> reclaimsCount;
 
 		uint32_t findAbandonedAddress();
 		uint32_t generateFreshAddress();
+		uint32_t probeFreeAddress(uint32_t clientHash);
+		uint32_t findUnusedOffset(uint32_t from, uint32_t to);
+		bool isHashed();
+		bool isUsed(uint32_t address);
+		void setUsed(uint32_t address, bool used);
+		void convert(const PoolDescriptor& previous, TrackedVector<uint64_t, MEMORY_POOLS>& previousUsed);
+		bool isInRange(uint32_t address);
 		uint32_t calculateNetworkAddress(uint32_t address, uint32_t mask);
+		uint32_t getSize();
+		void publish();
 };
 
 #endif
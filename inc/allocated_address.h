@@ -3,14 +3,13 @@
 
 #include <stdint.h>
 #include <time.h>
-#include <list>
+#include <memory>
 #include "pool_descriptor.h"
 
 struct AllocatedAddress {
 	uint32_t ipAddress;
-	uint32_t mask;
-	std::list<uint32_t> dnsServers;
-	std::list<uint32_t> routers;
+	/* Reply options are shared with the pool, reconfiguration replaces them without touching leases */
+	std::shared_ptr<const PoolDescriptor> descriptor;
 	uint32_t leaseTime;
 	time_t allocationTime;
 };
@@ -0,0 +1,139 @@
+#ifndef BULK_LEASEQUERY_H
+#define BULK_LEASEQUERY_H
+
+#include "lease_listener.h"
+#include "event_loop.h"
+#include "addresses_allocator.h"
+#include "pipeline.h"
+#include "config.h"
+#include "clock.h"
+#include "dhcp_message.h"
+#include "memory_accounting.h"
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* dhcp-state option values of RFC 6926 */
+#define LEASE_STATE_ACTIVE 2
+#define LEASE_STATE_EXPIRED 3
+
+/* status-code option values of RFC 6926 */
+#define LEASEQUERY_STATUS_SUCCESS 0
+#define LEASEQUERY_STATUS_MALFORMED_QUERY 3
+
+#define LEASEQUERY_MESSAGE_HEADER_SIZE 240
+
+typedef TrackedVector<uint8_t, MEMORY_IO_BUFFERS> LeasequeryBytes;
+
+/*
+ * Bulk Leasequery (RFC 6926) over TCP. Queries are answered network by network, from a snapshot of
+ * matching leases of one network taken with only the worker handling it paused, so every network
+ * is seen in a consistent state and a connection holds records of a single network at a time.
+ * Snapshot keeps only compact records, replies are encoded from it while the socket accepts data
+ * and at most bufferSize encoded bytes wait for a connection, a slow requestor only slows itself down.
+ *
+ * Supported queries: by chaddr, by client identifier (option 61) and for all leases.
+ * Query for all leases with ciaddr set returns only the subnet containing ciaddr,
+ * which also selects leases of a relay when relay address is given.
+ * query-start-time and query-end-time (options 154, 155) limit leases by last transaction time.
+ */
+class BulkLeasequery: public LeaseListener {
+	public:
+		BulkLeasequery(EventLoop&, AddressesAllocator&, Pipeline*, Config&, Clock&, uint32_t serverIp);
+		~BulkLeasequery();
+
+		/* Only used to collect the snapshot, lease changes are not followed */
+		void onLeaseUpdated(uint32_t networkAddress, const HardwareAddress&, const AllocatedAddress&);
+		void onLeaseUpdated(uint32_t networkAddress, const ClientSpecialId&, const AllocatedAddress&);
+		void onLeaseRemoved(uint32_t networkAddress, const HardwareAddress&, uint32_t ipAddress, bool reusable) {}
+		void onLeaseRemoved(uint32_t networkAddress, const ClientSpecialId&, uint32_t ipAddress, bool reusable) {}
+
+		std::string describe();
+
+	private:
+		struct Query {
+			uint32_t xid;
+			uint8_t htype;
+			uint8_t hlen;
+			uint8_t chaddr[MAX_HADDR_SIZE];
+			bool byHardwareAddress;
+			bool bySpecialId;
+			ClientSpecialId specialId;
+			uint32_t subnetAddress;
+			time_t startTime;
+			time_t endTime;
+		};
+
+		/* Snapshot record, followed by keyLength bytes of client key */
+		struct LeaseRecord {
+			uint32_t ipAddress;
+			uint32_t leaseTime;
+			int64_t allocationTime;
+			uint8_t identificationMethod;
+			uint8_t keyType;
+			uint8_t keyLength;
+		} __attribute__((packed));
+
+		struct Connection {
+			Connection(): inputClosed(false), outputOffset(0), snapshotOffset(0), nextNetwork(0), querying(false), query(), xid(0), baseTime(0) {}
+
+			std::string input;
+			bool inputClosed;
+			LeasequeryBytes output;
+			size_t outputOffset;
+			LeasequeryBytes snapshot;
+			size_t snapshotOffset;
+			/* Networks of running query, snapshot holds leases of the one before nextNetwork */
+			std::vector<uint32_t> networks;
+			size_t nextNetwork;
+			bool querying;
+			/* Kept for the whole query, its networks are collected as output drains */
+			Query query;
+			uint32_t xid;
+			time_t baseTime;
+		};
+
+		EventLoop& eventLoop;
+		AddressesAllocator& allocator;
+		Pipeline* pipeline;
+		Clock& clock;
+		uint32_t serverIp;
+		unsigned maxConnections;
+		size_t bufferSize;
+
+		int listeningFd;
+		std::unordered_map<int, Connection> connections;
+
+		Connection* collecting;
+
+		uint64_t queries;
+		uint64_t leasesSent;
+		uint64_t rejectedConnections;
+
+		void listen(Config&);
+		void acceptConnection();
+		void closeConnection(int fd);
+		void handleConnection(int fd, uint32_t events);
+		void readQueries(int fd, Connection&);
+		bool startNextQuery(Connection&);
+		bool parseQuery(const uint8_t* message, size_t length, Query&);
+		std::vector<uint32_t> findQueriedNetworks(const Query&);
+		void collectNetwork(Connection&, uint32_t networkAddress);
+		void fillOutput(Connection&);
+		void writeOutput(int fd, Connection&);
+		void updateEvents(int fd, Connection&);
+
+		template <class T> bool matches(uint32_t networkAddress, const T& clientId, const AllocatedAddress&);
+		bool matchesClient(const Query&, const HardwareAddress&);
+		bool matchesClient(const Query&, const ClientSpecialId&);
+		void collect(const AllocatedAddress&, uint8_t identificationMethod, uint8_t keyType, const uint8_t* key, uint8_t keyLength);
+
+		void appendLease(Connection&, const LeaseRecord&, const uint8_t* key);
+		void appendDone(Connection&, uint8_t status);
+		void appendMessage(Connection&, DHCPMessage&, size_t optionsLength);
+		void prepareReply(DHCPMessage&, uint32_t xid);
+};
+
+#endif
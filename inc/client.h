@@ -11,6 +11,8 @@ struct Client {
 	ClientSpecialId specialId;
 	IdentificationMethod identificationMethod;
 	uint32_t networkAddress;
+	/* Interface the request came through, its replies leave through the same one */
+	uint8_t interfaceIndex;
 };
 
 #endif
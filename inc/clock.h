@@ -0,0 +1,57 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+
+/*
+ * Time source of allocator, transactions and request handling. Time is read from the kernel
+ * once per batch of requests by refresh(), handlers and per lease loops only read the cached value.
+ */
+class Clock {
+	public:
+		virtual ~Clock() {}
+
+		virtual void refresh() = 0;
+		/* Wall clock seconds, stored with leases and replicated */
+		virtual time_t seconds() = 0;
+		/* Milliseconds for intervals which never leave the process */
+		virtual uint64_t monotonicMs() = 0;
+};
+
+/*
+ * Wall clock is sampled once at start and then advanced by the monotonic clock,
+ * so wall clock steps while the server runs do not expire or extend leases.
+ * May be refreshed and read by any thread, cached time never goes back.
+ */
+class CoarseClock: public Clock {
+	public:
+		CoarseClock();
+
+		void refresh();
+		time_t seconds();
+		uint64_t monotonicMs();
+
+	private:
+		time_t startSeconds;
+		uint64_t startMs;
+		std::atomic<uint64_t> cachedMs;
+};
+
+/* Moved only by hand, lets days of lease lifecycle run in a fraction of a second */
+class VirtualClock: public Clock {
+	public:
+		VirtualClock(time_t startSeconds);
+
+		void refresh() {}
+		time_t seconds();
+		uint64_t monotonicMs();
+
+		void advance(uint64_t milliseconds);
+
+	private:
+		std::atomic<uint64_t> currentMs;
+};
+
+#endif
@@ -1,35 +1,120 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
-#include <list>
+#include <vector>
+#include <bitset>
 #include <string>
 #include <boost/property_tree/ptree.hpp>
 #include "pool_descriptor.h"
+#include "interface_descriptor.h"
+
+#define HASH_BUCKETS_COUNT 256
 
 class Config {
 	public:
 		Config(const char* filePath);
+		/* Accepts JSON or configuration precompiled by compile() */
 		void load(const char* filePath);
+		/* Writes loaded configuration in binary form, which loads without parsing pools */
+		void compile(const char* compiledPath);
+
+		const char* getFilePath();
 
+		/* Interface, network address and mask of the first served interface */
 		const char* getInterface();
 		uint32_t getNetworkAddress();
 		uint32_t getNetworkMask();
+		const std::vector<InterfaceDescriptor>& getInterfaces();
 		uint32_t getTransactionStorageTime();
 		const char* getCacheFile();
-		const std::list<PoolDescriptor>& getPoolsDescriptors();
+		unsigned getPersistenceThreads();
+		uint32_t getSnapshotInterval();
+		const char* getControlSocket();
+		unsigned getPipelineWorkers();
+		unsigned getPipelineQueueSize();
+		const char* getReplicationRole();
+		const char* getReplicationAddress();
+		uint16_t getReplicationPort();
+		uint32_t getReplicationResyncInterval();
+		size_t getReplicationMaxBacklog();
+		const std::bitset<HASH_BUCKETS_COUNT>& getOwnedBuckets();
+		uint16_t getTakeoverSeconds();
+		uint32_t getClientRateLimit();
+		uint32_t getClientRateBurst();
+		uint32_t getRelayRateLimit();
+		uint32_t getRelayRateBurst();
+		size_t getRateLimitTableSize();
+		size_t getSchedulerQueueSize();
+		unsigned getSchedulerQuantum();
+		uint32_t getMaxDiscoverDelay();
+		uint16_t getMaxDiscoverSecs();
+		size_t getReplyCacheSize();
+		uint32_t getReplyCacheTimeToLive();
+		const char* getMetricsAddress();
+		uint16_t getMetricsPort();
+		const char* getLeasequeryAddress();
+		uint16_t getLeasequeryPort();
+		unsigned getLeasequeryMaxConnections();
+		size_t getLeasequeryBufferSize();
+		bool isBusyPollEnabled();
+		unsigned getBusyPollMicroseconds();
+		int getCaptureCore();
+		const std::vector<int>& getWorkerCores();
+		const std::vector<PoolDescriptor>& getPoolsDescriptors();
 	
 	private:
-		std::string interface;
-		uint32_t networkAddress;
-		uint32_t networkMask;
+		std::string filePath;
+		std::vector<InterfaceDescriptor> interfaces;
 		uint32_t transactionStorageTime;
 		std::string cacheFile;
+		unsigned persistenceThreads;
+		uint32_t snapshotInterval;
+		std::string controlSocket;
+		unsigned pipelineWorkers;
+		unsigned pipelineQueueSize;
+		std::string replicationRole;
+		std::string replicationAddress;
+		uint16_t replicationPort;
+		uint32_t replicationResyncInterval;
+		size_t replicationMaxBacklog;
+		std::bitset<HASH_BUCKETS_COUNT> ownedBuckets;
+		uint16_t takeoverSeconds;
+		uint32_t clientRateLimit;
+		uint32_t clientRateBurst;
+		uint32_t relayRateLimit;
+		uint32_t relayRateBurst;
+		size_t rateLimitTableSize;
+		size_t schedulerQueueSize;
+		unsigned schedulerQuantum;
+		uint32_t maxDiscoverDelay;
+		uint16_t maxDiscoverSecs;
+		size_t replyCacheSize;
+		uint32_t replyCacheTimeToLive;
+		std::string metricsAddress;
+		uint16_t metricsPort;
+		std::string leasequeryAddress;
+		uint16_t leasequeryPort;
+		unsigned leasequeryMaxConnections;
+		size_t leasequeryBufferSize;
+		bool busyPollEnabled;
+		unsigned busyPollMicroseconds;
+		int captureCore;
+		std::vector<int> workerCores;
 		
-		std::list<PoolDescriptor> addressesPools;
+		std::vector<PoolDescriptor> addressesPools;
+		/* Configuration without pools, kept for compile() */
+		std::string settings;
+
+		static std::string readFile(const char* filePath);
+		void loadJson(const std::string& document);
+		void loadCompiled(const std::string& document);
+		void loadSettings();
 
 		uint32_t addrFromString(std::string& addressString);
 		uint32_t extractAddress(boost::property_tree::ptree &node, const char* key);
-		void extractAddressesList(boost::property_tree::ptree &addresses, std::list<uint32_t>& target);
+		InterfaceDescriptor extractInterface(boost::property_tree::ptree &node);
+		VlanNetwork extractVlan(boost::property_tree::ptree &node);
+		void extractBuckets(boost::property_tree::ptree &buckets, std::bitset<HASH_BUCKETS_COUNT>& target);
 };
 
 #endif
@@ -0,0 +1,49 @@
+#ifndef CONFIG_FILE_FORMAT_H
+#define CONFIG_FILE_FORMAT_H
+
+#include <stdint.h>
+
+/*
+ * Precompiled configuration, written by "dhcp_server --compile-config". Settings are kept
+ * as JSON text without pools, pools are fixed size records referring to shared option sets.
+ * Every integer is stored little endian.
+ *
+ * [CompiledConfigHeader][settings JSON][OptionSetRecord...][addresses...][PoolDescriptorRecord...]
+ */
+
+#define CONFIG_FILE_MAGIC "DHCPCFG"
+#define CONFIG_FILE_MAGIC_SIZE 8
+#define CONFIG_FILE_VERSION 2
+
+struct CompiledConfigHeader {
+	char magic[CONFIG_FILE_MAGIC_SIZE];
+	uint32_t version;
+	uint32_t settingsLength;
+	uint32_t optionSetsCount;
+	uint32_t addressesCount;
+	uint32_t poolsCount;
+	uint32_t payloadCrc;
+	uint32_t reserved;
+	uint32_t headerCrc;
+} __attribute__((packed));
+
+/* Ranges of the addresses section */
+struct OptionSetRecord {
+	uint32_t firstDnsServer;
+	uint32_t dnsServersCount;
+	uint32_t firstRouter;
+	uint32_t routersCount;
+} __attribute__((packed));
+
+struct PoolDescriptorRecord {
+	uint32_t startAddress;
+	uint32_t endAddress;
+	uint32_t networkMask;
+	uint32_t leaseTime;
+	uint32_t leaseJitter;
+	uint32_t optionSet;
+	/* AllocationStrategy */
+	uint32_t allocation;
+} __attribute__((packed));
+
+#endif
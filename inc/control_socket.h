@@ -0,0 +1,47 @@
+#ifndef CONTROL_SOCKET_H
+#define CONTROL_SOCKET_H
+
+#include "event_loop.h"
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+#define CONTROL_MAX_COMMAND_SIZE 1024
+
+/*
+ * Local unix stream socket accepting one line commands, e.g. "save\n".
+ * Response is written back and the connection is closed. All I/O is non-blocking
+ * and driven by the event loop, so a stalled client never delays packets processing.
+ */
+class ControlSocket {
+	public:
+		typedef std::function<std::string(const std::string& arguments)> Command;
+
+		ControlSocket(EventLoop&, const char* path);
+		~ControlSocket();
+
+		void registerCommand(const std::string& name, Command command);
+
+	private:
+		struct Connection {
+			std::string input;
+			std::string output;
+		};
+
+		EventLoop& eventLoop;
+		std::string path;
+		int listeningFd;
+
+		std::map<std::string, Command> commands;
+		std::unordered_map<int, Connection> connections;
+
+		void acceptConnection();
+		void handleConnection(int fd, uint32_t events);
+		void readCommand(int fd, Connection&);
+		void writeResponse(int fd, Connection&);
+		std::string execute(const std::string& line);
+		void closeConnection(int fd);
+};
+
+#endif
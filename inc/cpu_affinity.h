@@ -0,0 +1,18 @@
+#ifndef CPU_AFFINITY_H
+#define CPU_AFFINITY_H
+
+#include <pthread.h>
+
+/*
+ * Binds threads to single cores, so spinning threads do not migrate and share caches with others.
+ * Threads inherit affinity of their creator, helpers started by a pinned thread are unpinned explicitly.
+ */
+class CpuAffinity {
+	public:
+		/* Negative core leaves thread where the scheduler puts it, called by the main thread only */
+		static void pin(pthread_t thread, int core);
+		/* Lets thread run on all cores the process started with, best effort */
+		static void unpin(pthread_t thread);
+};
+
+#endif
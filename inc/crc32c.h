@@ -0,0 +1,18 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+class Crc32c {
+	public:
+		static uint32_t compute(const void* data, size_t length, uint32_t crc = 0);
+
+	private:
+		static uint32_t table[8][256];
+		static bool tableReady;
+
+		static bool buildTable();
+};
+
+#endif
@@ -7,17 +7,22 @@
 #include "client.h"
 #include "addresses_allocator.h"
 #include "server.h"
+#include "sender.h"
 
 class DiscoverHandler {
 	public:
-		DiscoverHandler(TransactionsStorage&, Client&, AddressesAllocator&, Server&);
+		DiscoverHandler(TransactionsStorage&, Client&, AddressesAllocator&, Server&, Sender&);
 		void handle(struct DHCPMessage&, Options&, uint32_t dstAddr);
+		/* No address could be offered, the request was left unanswered */
+		bool isPoolExhausted();
 
 	private:
 		TransactionsStorage& transactionsStorage;
 		Client& client;
 		AddressesAllocator& allocator;
 		Server& server;
+		Sender& sender;
+		bool poolExhausted;
 
 		void sendOffer(DHCPMessage& request, AllocatedAddress& allocatedAddress);
 };
@@ -0,0 +1,38 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdint.h>
+#include <functional>
+#include <unordered_map>
+
+#define EVENT_LOOP_MAX_EVENTS 64
+
+/*
+ * Single threaded epoll reactor, every watched descriptor gets a callback
+ * invoked with the epoll events reported for it.
+ */
+class EventLoop {
+	public:
+		typedef std::function<void(uint32_t events)> Handler;
+
+		EventLoop();
+		~EventLoop();
+
+		void watch(int fd, uint32_t events, Handler handler);
+		void modify(int fd, uint32_t events);
+		void unwatch(int fd);
+
+		void run();
+		/* Never sleeps: calls poller in a loop and checks watched descriptors after every rounds calls */
+		void spin(std::function<void()> poller, unsigned rounds);
+		void stop();
+
+	private:
+		int epollFd;
+		bool running;
+		std::unordered_map<int, Handler> handlers;
+
+		void dispatch(int timeoutMs);
+};
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef INCOMING_MESSAGE_H
+#define INCOMING_MESSAGE_H
+
+#include <stdint.h>
+#include "dhcp_message.h"
+#include "client.h"
+#include "vlan_tags.h"
+
+/* Captured message after parsing, options are already in host byte order */
+struct IncomingMessage {
+	DHCPMessage message;
+	unsigned optionsLength;
+	uint32_t dstAddr;
+	uint8_t messageType;
+	Client client;
+	/* Capture timestamp in microseconds of wall clock time */
+	int64_t capturedAt;
+	VlanTags vlanTags;
+};
+
+struct OutgoingMessage {
+	DHCPMessage message;
+	unsigned messageType;
+	int64_t capturedAt;
+	uint8_t interfaceIndex;
+	VlanTags vlanTags;
+};
+
+#endif
@@ -7,10 +7,11 @@
 #include "client.h"
 #include "addresses_allocator.h"
 #include "server.h"
+#include "sender.h"
 
 class InformHandler {
 	public:
-		InformHandler(TransactionsStorage&, Client&, AddressesAllocator&, Server&);
+		InformHandler(TransactionsStorage&, Client&, AddressesAllocator&, Server&, Sender&);
 		void handle(struct DHCPMessage&, Options&, uint32_t dstAddr);
 
 	private:
@@ -18,6 +19,7 @@ class InformHandler {
 		Client& client;
 		AddressesAllocator& allocator;
 		Server& server;
+		Sender& sender;
 };
 
 #endif
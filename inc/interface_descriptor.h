@@ -0,0 +1,26 @@
+#ifndef INTERFACE_DESCRIPTOR_H
+#define INTERFACE_DESCRIPTOR_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Interface index travels with every request in one byte */
+#define MAX_INTERFACES 255
+
+/* Clients on a VLAN of a trunk belong to its network, innerVlan is 0 for single tagged frames */
+struct VlanNetwork {
+	uint16_t vlan;
+	uint16_t innerVlan;
+	uint32_t networkAddress;
+};
+
+/* Link served by the server, clients without a relay on it belong to its network, or to network of their VLAN */
+struct InterfaceDescriptor {
+	std::string name;
+	uint32_t networkAddress;
+	uint32_t networkMask;
+	std::vector<VlanNetwork> vlans;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef LEASE_FILE_FORMAT_H
+#define LEASE_FILE_FORMAT_H
+
+#include <stdint.h>
+#include "dhcp_message.h"
+#include "client_special_id.h"
+
+/*
+ * On-disk lease database layout. Every integer is stored little endian with fixed width,
+ * records of one section have equal size so a section may be read with single copy or used in place.
+ *
+ * [LeaseFileHeader][LeaseSectionHeader][records...][LeaseSectionHeader][records...]...
+ */
+
+#define LEASE_FILE_MAGIC "DHCPLDB"
+#define LEASE_FILE_MAGIC_SIZE 8
+#define LEASE_FILE_VERSION 1
+
+#define HARDWARE_LEASES_SECTION 1
+#define SPECIAL_ID_LEASES_SECTION 2
+#define POOLS_SECTION 3
+#define ABANDONED_ADDRESSES_SECTION 4
+
+struct LeaseFileHeader {
+	char magic[LEASE_FILE_MAGIC_SIZE];
+	uint32_t version;
+	uint32_t sectionsCount;
+	uint32_t reserved;
+	uint32_t headerCrc;
+} __attribute__((packed));
+
+struct LeaseSectionHeader {
+	uint32_t type;
+	uint32_t recordSize;
+	uint64_t recordsCount;
+	uint32_t recordsCrc;
+	uint32_t headerCrc;
+} __attribute__((packed));
+
+struct LeaseRecord {
+	uint32_t networkAddress;
+	uint32_t ipAddress;
+	uint32_t leaseTime;
+	uint32_t reserved;
+	int64_t allocationTime;
+} __attribute__((packed));
+
+struct HardwareLeaseRecord {
+	LeaseRecord lease;
+	uint8_t addressType;
+	uint8_t hardwareAddress[MAX_HADDR_SIZE];
+	uint8_t padding[7];
+} __attribute__((packed));
+
+struct SpecialIdLeaseRecord {
+	LeaseRecord lease;
+	uint8_t type;
+	uint8_t value[CLIENT_SPECIAL_ID_MAX_LEN];
+} __attribute__((packed));
+
+struct PoolRecord {
+	uint32_t networkAddress;
+	uint32_t nextToAssign;
+} __attribute__((packed));
+
+struct AbandonedAddressRecord {
+	uint32_t networkAddress;
+	uint32_t address;
+} __attribute__((packed));
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef LEASE_LISTENER_H
+#define LEASE_LISTENER_H
+
+#include <stdint.h>
+#include "hardware_address.h"
+#include "client_special_id.h"
+#include "allocated_address.h"
+
+/*
+ * Notified by AddressesAllocator about every lease change. In pipeline mode
+ * notifications come from handler workers, so implementations have to be thread safe.
+ */
+class LeaseListener {
+	public:
+		virtual ~LeaseListener() {}
+
+		virtual void onLeaseUpdated(uint32_t networkAddress, const HardwareAddress&, const AllocatedAddress&) = 0;
+		virtual void onLeaseUpdated(uint32_t networkAddress, const ClientSpecialId&, const AllocatedAddress&) = 0;
+
+		/* Address is not reusable when client declined it */
+		virtual void onLeaseRemoved(uint32_t networkAddress, const HardwareAddress&, uint32_t ipAddress, bool reusable) = 0;
+		virtual void onLeaseRemoved(uint32_t networkAddress, const ClientSpecialId&, uint32_t ipAddress, bool reusable) = 0;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef LEASE_TIMES_H
+#define LEASE_TIMES_H
+
+#include "pool_descriptor.h"
+#include <stdint.h>
+
+/* Default T1 and T2 of RFC 2131, as fractions of lease time */
+#define RENEWAL_TIME_NUMERATOR 1
+#define RENEWAL_TIME_DENOMINATOR 2
+#define REBINDING_TIME_NUMERATOR 7
+#define REBINDING_TIME_DENOMINATOR 8
+
+#define MAX_LEASE_JITTER 50
+
+/*
+ * Lease time and T1 are spread evenly over leaseJitter percent of the pool value, centered on it,
+ * so average lease time does not change. Spreading is seeded by the leased address, a client keeps
+ * its address across renewals and gets the same times every time.
+ */
+class LeaseTimes {
+	public:
+		static uint32_t leaseTime(const PoolDescriptor&, uint32_t ipAddress);
+		static uint32_t renewalTime(const PoolDescriptor&, uint32_t ipAddress, uint32_t leaseTime);
+		static uint32_t rebindingTime(uint32_t leaseTime);
+
+	private:
+		static uint32_t spread(uint32_t value, uint32_t jitterPercent, uint32_t seed);
+		static uint32_t mix(uint32_t seed);
+};
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef LEGACY_STATE_DESERIALIZER_H
+#define LEGACY_STATE_DESERIALIZER_H
+
+#include "../inc/hardware_address.h"
+#include "../inc/client_special_id.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+
+/* Lease stored in cache of older versions, its options are taken from the current pool instead */
+template <class T> struct LegacyLease {
+	uint32_t networkAddress;
+	T clientId;
+	uint32_t ipAddress;
+	uint32_t leaseTime;
+	time_t allocationTime;
+};
+
+struct LegacyPool {
+	uint32_t networkAddress;
+	uint32_t nextToAssign;
+	std::vector<uint32_t> abandonedAddresses;
+};
+
+/*
+ * Reads the unversioned cache written before lease files had a header: native byte order, fields written
+ * one by one. The format has no magic, a file which ends early or goes on past the pools is not one of them.
+ */
+class LegacyStateDeserializer {
+	public:
+		LegacyStateDeserializer(const char* filePath);
+
+		bool isValid();
+		const std::vector<LegacyLease<HardwareAddress> >& getHardwareLeases();
+		const std::vector<LegacyLease<ClientSpecialId> >& getSpecialIdLeases();
+		const std::vector<LegacyPool>& getPools();
+
+	private:
+		FILE* file;
+		bool valid;
+		std::vector<LegacyLease<HardwareAddress> > hardwareLeases;
+		std::vector<LegacyLease<ClientSpecialId> > specialIdLeases;
+		std::vector<LegacyPool> pools;
+
+		template <class T> bool readLeases(std::vector<LegacyLease<T> >&);
+		bool readPools();
+		bool readClientId(HardwareAddress&);
+		bool readClientId(ClientSpecialId&);
+		bool skipList();
+		template <class V> bool read(V& value);
+};
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef LIBNET_SENDER_H
+#define LIBNET_SENDER_H
+
+#include <libnet.h>
+#include "sender.h"
+
+/* Builds reply frames and writes them to the wire through libnet handle of an interface */
+class LibnetSender: public Sender {
+	public:
+		LibnetSender(libnet_t* lnetHandle);
+		void send(DHCPMessage&, unsigned messageType);
+		void sendTagged(DHCPMessage&, unsigned messageType, const VlanTags&);
+
+	private:
+		libnet_t* lnetHandle;
+		/* Read once, tagged frames are built without libnet looking it up per packet */
+		uint8_t sourceHardwareAddress[ETHER_ADDR_LEN];
+		void fillBroadcastAddress(uint8_t* buffer);
+		void buildEthernet(uint8_t* targetHardwareAddress, const VlanTags&);
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef LOAD_BALANCER_H
+#define LOAD_BALANCER_H
+
+#include "config.h"
+#include "dhcp_message.h"
+#include "options.h"
+#include <stdint.h>
+#include <bitset>
+#include <string>
+#include <vector>
+
+/*
+ * Hash bucket assignment from RFC 3074. Every client hashes to one of 256 buckets,
+ * the server answers only clients in its own buckets, unless the client has been
+ * trying for takeoverSeconds, which means the owning peer is down. Messages addressed
+ * to this server, by unicast or server identifier, bypass the buckets.
+ * Immutable like NetworkResolver, reload swaps in a new instance.
+ */
+class LoadBalancer {
+	public:
+		/* Addresses of all served interfaces, any of them identifies this server */
+		LoadBalancer(Config&, const std::vector<uint32_t>& serverIps);
+
+		bool accepts(const DHCPMessage&, Options&, uint32_t dstAddr);
+		std::string describe();
+
+		static uint8_t hash(const uint8_t* key, unsigned length);
+
+	private:
+		bool isServerIp(uint32_t address);
+
+		std::bitset<HASH_BUCKETS_COUNT> ownedBuckets;
+		uint16_t takeoverSeconds;
+		std::vector<uint32_t> serverIps;
+		bool ownsAll;
+
+		uint64_t accepted;
+		uint64_t dropped;
+		uint64_t takenOver;
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef MEMORY_ACCOUNTING_H
+#define MEMORY_ACCOUNTING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <map>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+enum MemorySubsystem { MEMORY_LEASES, MEMORY_POOLS, MEMORY_TRANSACTIONS, MEMORY_REPLY_CACHE, MEMORY_IO_BUFFERS, MEMORY_SUBSYSTEMS_COUNT };
+
+/*
+ * Live bytes allocated by containers of every subsystem. Each thread counts into its own shard
+ * with relaxed load and store, shards of exited threads are folded into a shared one.
+ * Every shard also keeps the highest value it reached since the last merge, raised when allocating.
+ * Merging on every housekeeping tick and when rendered adds up shard peaks, which bounds the peak
+ * of the sum from above, so high-water marks keep spikes shorter than the merge interval.
+ */
+class MemoryAccounting {
+	public:
+		static void allocated(MemorySubsystem, size_t bytes);
+		static void released(MemorySubsystem, size_t bytes);
+
+		static int64_t getBytes(MemorySubsystem);
+		static void sample();
+		static std::string render(uint64_t leasesCount);
+};
+
+/* Standard allocator counting everything it hands out, rebinding keeps the subsystem */
+template <class T, MemorySubsystem S> class TrackingAllocator {
+	public:
+		typedef T value_type;
+
+		template <class U> struct rebind {
+			typedef TrackingAllocator<U, S> other;
+		};
+
+		TrackingAllocator() {}
+		template <class U> TrackingAllocator(const TrackingAllocator<U, S>&) {}
+
+		T* allocate(size_t count) {
+			T* memory = static_cast<T*>(::operator new(count * sizeof(T)));
+			MemoryAccounting::allocated(S, count * sizeof(T));
+			return memory;
+		}
+
+		void deallocate(T* memory, size_t count) {
+			MemoryAccounting::released(S, count * sizeof(T));
+			::operator delete(memory);
+		}
+};
+
+template <class T, class U, MemorySubsystem S> bool operator == (const TrackingAllocator<T, S>&, const TrackingAllocator<U, S>&) {
+	return true;
+}
+
+template <class T, class U, MemorySubsystem S> bool operator != (const TrackingAllocator<T, S>&, const TrackingAllocator<U, S>&) {
+	return false;
+}
+
+template <class K, class V, MemorySubsystem S> using TrackedMap = std::map<K, V, std::less<K>, TrackingAllocator<std::pair<const K, V>, S> >;
+template <class K, class V, MemorySubsystem S> using TrackedUnorderedMap = std::unordered_map<K, V, std::hash<K>, std::equal_to<K>, TrackingAllocator<std::pair<const K, V>, S> >;
+template <class K, MemorySubsystem S> using TrackedUnorderedSet = std::unordered_set<K, std::hash<K>, std::equal_to<K>, TrackingAllocator<K, S> >;
+template <class T, MemorySubsystem S> using TrackedDeque = std::deque<T, TrackingAllocator<T, S> >;
+template <class T, MemorySubsystem S> using TrackedVector = std::vector<T, TrackingAllocator<T, S> >;
+
+#endif
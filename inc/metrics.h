@@ -0,0 +1,84 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <sstream>
+#include <vector>
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+#define METRICS_MESSAGE_TYPES 9
+#define METRICS_CLIENT_STATES 5
+
+/* Latency buckets: exact below 8us, then 8 linear sub-buckets per power of two up to 2^26us */
+#define LATENCY_EXACT_BUCKETS 8
+#define LATENCY_SUB_BUCKETS_BITS 3
+#define LATENCY_MAX_EXPONENT 26
+#define LATENCY_BUCKETS (LATENCY_EXACT_BUCKETS + (LATENCY_MAX_EXPONENT - LATENCY_SUB_BUCKETS_BITS + 1) * (1 << LATENCY_SUB_BUCKETS_BITS))
+
+enum DropReason { DROP_MALFORMED, DROP_RATE_LIMITED, DROP_NOT_OWNED, DROP_STANDBY, DROP_QUEUE_FULL, DROP_UNKNOWN_NETWORK, DROP_POOL_EXHAUSTED, DROP_REASONS_COUNT };
+
+/*
+ * Counters written by exactly one thread. Updates are plain relaxed load and store,
+ * without locked instructions, readers only ever see a slightly stale value.
+ * Padding keeps shards of different threads on separate cache lines.
+ */
+class MetricsShard {
+	public:
+		MetricsShard();
+
+		void countReceived(unsigned messageType);
+		void countReplied(unsigned messageType);
+		void countDropped(DropReason);
+		void countRequestState(unsigned clientState);
+		void recordLatency(int64_t microseconds);
+		/* Time from kernel timestamp of a packet to its capture by the server */
+		void recordCaptureDelay(int64_t microseconds);
+
+	private:
+		friend class Metrics;
+
+		char leadingPadding[CACHE_LINE_SIZE];
+		std::atomic<uint64_t> received[METRICS_MESSAGE_TYPES];
+		std::atomic<uint64_t> replied[METRICS_MESSAGE_TYPES];
+		std::atomic<uint64_t> dropped[DROP_REASONS_COUNT];
+		std::atomic<uint64_t> requestStates[METRICS_CLIENT_STATES];
+		std::atomic<uint64_t> latency[LATENCY_BUCKETS];
+		std::atomic<uint64_t> latencySum;
+		std::atomic<uint64_t> captureDelay[LATENCY_BUCKETS];
+		std::atomic<uint64_t> captureDelaySum;
+		char trailingPadding[CACHE_LINE_SIZE];
+
+		static void increment(std::atomic<uint64_t>& counter, uint64_t value = 1);
+		static void record(std::atomic<uint64_t>* buckets, std::atomic<uint64_t>& sum, int64_t microseconds);
+		static unsigned messageTypeIndex(unsigned messageType);
+};
+
+/*
+ * Owns shards of all threads and renders their sum in Prometheus text format.
+ * Shards are created before threads start and live as long as Metrics.
+ */
+class Metrics {
+	public:
+		~Metrics();
+
+		MetricsShard* createShard();
+		std::string render();
+
+		static int64_t wallClockUs();
+		static unsigned latencyBucket(int64_t microseconds);
+		static uint64_t latencyBucketUpperBound(unsigned bucket);
+
+	private:
+		std::vector<MetricsShard*> shards;
+
+		template <size_t N> void sum(std::atomic<uint64_t> (MetricsShard::*counters)[N], uint64_t* totals);
+		uint64_t sum(std::atomic<uint64_t> MetricsShard::*counter);
+		static void renderLatency(std::ostringstream& output, const char* name, const uint64_t* buckets, uint64_t sum);
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef METRICS_ENDPOINT_H
+#define METRICS_ENDPOINT_H
+
+#include "event_loop.h"
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#define METRICS_MAX_REQUEST_SIZE 4096
+
+/*
+ * Minimal HTTP/1.0 listener for Prometheus scrapes. Every request gets the rendered
+ * metrics and the connection is closed. Non-blocking and driven by the event loop like ControlSocket.
+ */
+class MetricsEndpoint {
+	public:
+		typedef std::function<std::string()> Renderer;
+
+		MetricsEndpoint(EventLoop&, const char* address, uint16_t port, Renderer);
+		~MetricsEndpoint();
+
+	private:
+		struct Connection {
+			std::string input;
+			std::string output;
+		};
+
+		EventLoop& eventLoop;
+		Renderer renderer;
+		int listeningFd;
+		std::unordered_map<int, Connection> connections;
+
+		void acceptConnection();
+		void handleConnection(int fd, uint32_t events);
+		void readRequest(int fd, Connection&);
+		void writeResponse(int fd, Connection&);
+		void closeConnection(int fd);
+};
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef MONOTONIC_CLOCK_H
+#define MONOTONIC_CLOCK_H
+
+#include <stdint.h>
+
+/* Coarse monotonic time for per packet bookkeeping, resolution is a few milliseconds */
+class MonotonicClock {
+	public:
+		static uint64_t nowMs();
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef NETWORK_INTERFACE_H
+#define NETWORK_INTERFACE_H
+
+#include <pcap/pcap.h>
+#include <libnet.h>
+#include <stdint.h>
+#include <string>
+#include "interface_descriptor.h"
+#include "libnet_sender.h"
+
+/*
+ * One served link: capture handle, transmit backend and address used as server identifier
+ * towards clients reached through it. Capture is read by the receive thread only,
+ * replies are written by whichever thread sends them, one at a time.
+ */
+class NetworkInterface {
+	public:
+		NetworkInterface(const InterfaceDescriptor&, uint8_t index);
+		~NetworkInterface();
+
+		/* Passes packets waiting in the capture buffer to handler without blocking, returns their count */
+		int capture(pcap_handler, u_char* user);
+		int getCaptureFd();
+		/* Kernel busy polling of the device queue, when driver supports it */
+		void enableBusyPoll(int microseconds);
+
+		const char* getName();
+		uint8_t getIndex();
+		uint32_t getServerIp();
+		Sender& getSender();
+
+	private:
+		std::string name;
+		uint8_t index;
+		uint32_t serverIp;
+
+		char pcapErrbuf[PCAP_ERRBUF_SIZE];
+		pcap_t* pcapHandle;
+
+		char lnetErrbuf[LIBNET_ERRBUF_SIZE];
+		libnet_t* lnetHandle;
+		LibnetSender* sender;
+
+		void setPacketsFilter(uint32_t networkMask, bool trunk);
+		static uint32_t determineDeviceIp(const char* interfaceName);
+};
+
+#endif
@@ -2,16 +2,56 @@
 #define NETWORK_RESOLVER_H
 
 #include "config.h"
+#include "vlan_tags.h"
+#include <stdint.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+/* Direct mapped, a colliding relay only evicts another one */
+#define UNKNOWN_RELAYS_CACHE_SIZE 1024
+
+/*
+ * Immutable lookup table built from one configuration snapshot.
+ * Reload builds a new resolver and swaps it in, so lookups never see a half applied configuration.
+ * Relays without a pool are remembered, so a flood from one costs a single probe per packet.
+ * Only the cache is written by lookups, which are made by the receive thread alone.
+ * Clients on a trunk are mapped by VLAN: single tags index a table, QinQ pairs go through a hash map.
+ */
 class NetworkResolver {
 	public:
 		NetworkResolver(Config&);
-		uint32_t determineNetworkAddress(uint32_t giaddr);
+		/*
+		 * Clients without a relay belong to network of their VLAN or of the receiving interface when untagged.
+		 * False when relay address matches no pool or VLAN is not configured.
+		 */
+		bool determineNetworkAddress(uint32_t giaddr, uint8_t interfaceIndex, const VlanTags&, uint32_t& networkAddress);
 
 	private:
-		Config& config;
+		struct InterfaceNetworks {
+			uint32_t untagged;
+			/* VLAN_ID_COUNT entries when interface has single tagged VLANs, 0 for unknown ones */
+			std::vector<uint32_t> singleTagged;
+			/* Keyed by outer and inner VLAN ID, see doubleTagKey() */
+			std::unordered_map<uint32_t, uint32_t> doubleTagged;
+		};
+
+		/* Networks of pools configured with one mask */
+		struct MaskNetworks {
+			uint32_t networkMask;
+			std::unordered_set<uint32_t> networkAddresses;
+		};
+
+		/* Indexed like configured interfaces */
+		std::vector<InterfaceNetworks> interfaceNetworks;
+		/* Longest mask first */
+		std::vector<MaskNetworks> maskNetworks;
+		uint32_t unknownRelays[UNKNOWN_RELAYS_CACHE_SIZE];
 
-		uint32_t findNetworkAddressInDescriptors(uint32_t giaddr);
+		bool findNetworkAddressInDescriptors(uint32_t giaddr, uint32_t& networkAddress);
+		bool findVlanNetwork(const InterfaceNetworks&, const VlanTags&, uint32_t& networkAddress);
+		static unsigned unknownRelaySlot(uint32_t giaddr);
+		static uint32_t doubleTagKey(uint16_t outerVlan, uint16_t innerVlan);
 };
 
 #endif
@@ -11,6 +11,12 @@
 #define DHCPNAK 6
 #define DHCPRELEASE 7
 #define DHCPINFORM 8
+#define DHCPLEASEQUERY 10
+#define DHCPLEASEUNASSIGNED 11
+#define DHCPLEASEUNKNOWN 12
+#define DHCPLEASEACTIVE 13
+#define DHCPBULKLEASEQUERY 14
+#define DHCPLEASEQUERYDONE 15
 
 #define SUBNET_MASK 1
 #define ROUTERS 3
@@ -19,6 +25,14 @@
 #define IP_ADDRESS_LEASE_TIME 51
 #define DHCP_MESSAGE_TYPE 53
 #define SERVER_IDENTIFIER 54
+#define RENEWAL_TIME 58
+#define REBINDING_TIME 59
+#define CLIENT_LAST_TRANSACTION_TIME 91
+#define STATUS_CODE 151
+#define BASE_TIME 152
+#define QUERY_START_TIME 154
+#define QUERY_END_TIME 155
+#define DHCP_STATE 156
 #define CLIENT_IDENTIFIER 61
 #define END_OPTION 255
 
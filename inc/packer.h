@@ -2,7 +2,8 @@
 #define PACKER_H
 
 #include <stdint.h>
-#include <list>
+#include <stddef.h>
+#include <vector>
 
 class Packer {
 	public:
@@ -10,10 +11,15 @@ class Packer {
 
 		Packer& pack(uint8_t optionType, uint32_t value);
 		Packer& pack(uint8_t optionType, uint8_t value);
-		Packer& pack(uint8_t optionType, const std::list<uint32_t>& value);
+		Packer& pack(uint8_t optionType, const std::vector<uint32_t>& value);
+		Packer& pack(uint8_t optionType, const uint8_t* value, uint8_t length);
 		Packer& pack(uint8_t optionType);
 
+		/* Bytes packed so far */
+		size_t getLength();
+
 	private:
+		uint8_t* start;
 		uint8_t* buffer;
 };
 
@@ -0,0 +1,118 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "config.h"
+#include "spsc_ring.h"
+#include "incoming_message.h"
+#include "queued_sender.h"
+#include "transactions_storage.h"
+#include "request_scheduler.h"
+#include "reply_cache.h"
+#include "metrics.h"
+#include "request_processor.h"
+#include "clock.h"
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define PIPELINE_SPINS_BEFORE_SLEEP 1024
+#define PIPELINE_IDLE_SLEEP_US 50
+#define PIPELINE_WORKER_BATCH_SIZE 32
+
+/*
+ * Splits packets processing into stages connected with single producer single consumer rings:
+ * receive thread (event loop) -> N handler workers -> one transmit thread.
+ * Requests are sharded by client network, so every pool and its leases are touched by exactly one worker.
+ * One network is therefore handled by one worker at most, workers beyond the number of networks idle
+ * and a dominating network limits throughput to a single worker. Spread is warned about on start and reload
+ * and visible in per worker metrics.
+ * Worker moves everything waiting in its ring to own scheduler and handles requests in scheduler order.
+ * Transmit thread sends every reply through the interface its request came from.
+ */
+class Pipeline {
+	public:
+		/* Transmitters are indexed like served interfaces */
+		Pipeline(Config&, RequestProcessor&, Clock&, const std::vector<Sender*>& transmitters, Metrics&);
+		~Pipeline();
+
+		void start();
+		void stop();
+
+		/* Called by receive stage only, returns false and drops message when worker queue is full */
+		bool submit(const IncomingMessage&);
+
+		/* Blocks handler workers between batches, so allocator state can be read consistently */
+		void pause();
+		void resume();
+		/* Blocks only the worker handling given network */
+		void pause(uint32_t networkAddress);
+		void resume(uint32_t networkAddress);
+
+		std::string describe();
+		/* Per worker queue depths, counters and networks in Prometheus text format */
+		std::string render();
+		/* Called again after reload, when networks may have changed */
+		void warnAboutNetworksSpread();
+
+	private:
+		struct Worker {
+			Worker(Config& config, Clock& clock, size_t queueSize, MetricsShard* metrics);
+
+			SpscRing<IncomingMessage> incoming;
+			SpscRing<OutgoingMessage> outgoing;
+			RequestScheduler scheduler;
+			ReplyCache replyCache;
+			std::mutex schedulerMutex;
+			TransactionsStorage transactionsStorage;
+			QueuedSender sender;
+			MetricsShard* metrics;
+			std::mutex processing;
+			std::thread thread;
+			std::atomic<uint64_t> dropped;
+			std::atomic<uint64_t> processed;
+		};
+
+		/* Read for pools of current configuration, which reload replaces in place */
+		Config& config;
+		RequestProcessor& processor;
+		/* Refreshed by workers before every batch */
+		Clock& clock;
+		std::vector<Sender*> transmitters;
+		std::vector<Worker*> workers;
+		std::thread transmitThread;
+		std::atomic<bool> running;
+		std::atomic<uint64_t> transmitted;
+		std::atomic<unsigned> activeWorkers;
+		MetricsShard* transmitMetrics;
+		/* Busy polling threads only yield when idle, they never sleep */
+		bool busyPoll;
+		/* Workers take cores in order, the next one goes to the transmit thread */
+		std::vector<int> cores;
+
+		void work(Worker*);
+		void schedule(Worker*);
+		void transmit();
+		void idle(unsigned& idleSpins);
+		int coreOf(size_t thread);
+		size_t selectWorker(uint32_t networkAddress);
+		/* Configured networks handled by every worker */
+		std::vector<unsigned> countNetworks();
+};
+
+/* Holds pipeline workers, or the worker of one network, paused for its lifetime, pipeline may be NULL */
+class PipelinePause {
+	public:
+		PipelinePause(Pipeline*);
+		PipelinePause(Pipeline*, uint32_t networkAddress);
+		~PipelinePause();
+
+	private:
+		Pipeline* pipeline;
+		bool wholePipeline;
+		uint32_t networkAddress;
+};
+
+#endif
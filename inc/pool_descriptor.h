@@ -2,15 +2,31 @@
 #define POOL_DESCRIPTOR_H
 
 #include <stdint.h>
-#include <list>
+#include <vector>
+#include <memory>
+
+/* Options sent to clients of a pool, pools with equal options share one instance */
+struct PoolOptions {
+	std::vector<uint32_t> dnsServers;
+	std::vector<uint32_t> routers;
+};
+
+/*
+ * Sequential pools hand out never used addresses first and then returned ones in arbitrary order.
+ * Hashed pools start probing at an offset derived from the client key, so a client gets the same
+ * address again after its lease is lost, as long as the address is free.
+ */
+enum AllocationStrategy { ALLOCATE_SEQUENTIAL, ALLOCATE_HASHED };
 
 struct PoolDescriptor {
 	uint32_t startAddress;
 	uint32_t endAddress;
 	uint32_t networkMask;
 	uint32_t leaseTime;
-	std::list<uint32_t> dnsServers;
-	std::list<uint32_t> routers;
+	/* Percent of lease time and T1 over which they are spread between clients */
+	uint32_t leaseJitter;
+	AllocationStrategy allocation;
+	std::shared_ptr<const PoolOptions> options;
 };
 
 #endif
@@ -0,0 +1,42 @@
+#ifndef POOLS_MONITOR_H
+#define POOLS_MONITOR_H
+
+#include "addresses_allocator.h"
+#include <stdint.h>
+#include <unordered_map>
+#include <string>
+
+/* Time constant of the moving averages of allocation, reclaim and consumption rates */
+#define POOL_RATES_WINDOW 60.0
+
+/*
+ * Samples usage of every pool on housekeeping ticks and tracks allocation, reclaim
+ * and net consumption rates. Time to exhaustion is the free addresses count divided
+ * by the consumption rate. Runs in the main thread only, pool counters are read without scanning.
+ */
+class PoolsMonitor {
+	public:
+		PoolsMonitor(AddressesAllocator&);
+
+		void tick(uint32_t elapsedSeconds);
+		std::string render();
+		std::string describe();
+		uint64_t countLeases();
+
+	private:
+		struct PoolTrend {
+			PoolUsage lastUsage;
+			double allocationRate;
+			double reclaimRate;
+			double consumptionRate;
+		};
+
+		AddressesAllocator& allocator;
+		std::unordered_map<uint32_t, PoolTrend> trends;
+
+		static uint32_t countFree(const PoolUsage&);
+		static double secondsToExhaustion(const PoolUsage&, const PoolTrend&);
+		static std::string formatNetwork(uint32_t networkAddress);
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef POOLS_PARSER_H
+#define POOLS_PARSER_H
+
+#include "pool_descriptor.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+/*
+ * Single pass reader of the addressesPools array of a JSON configuration. Descriptors are
+ * built directly into a vector without an intermediate tree, pools with equal routers
+ * and DNS servers share one PoolOptions. Other settings are left to the generic parser.
+ */
+class PoolsParser {
+	public:
+		PoolsParser(const char* document, size_t length);
+
+		/*
+		 * Parses the value of top level "addressesPools", returns false when there is none.
+		 * Begin and end enclose the array, so the rest of the document may be parsed separately.
+		 */
+		bool parse(std::vector<PoolDescriptor>& target, size_t& begin, size_t& end);
+
+	private:
+		const char* document;
+		size_t length;
+		size_t position;
+		std::unordered_map<std::string, std::shared_ptr<const PoolOptions> > optionSets;
+
+		void parsePools(std::vector<PoolDescriptor>&);
+		void parsePool(PoolDescriptor&);
+		std::shared_ptr<const PoolOptions> deduplicate(const PoolOptions&);
+
+		void skipWhitespace();
+		bool consume(char);
+		void expect(char);
+		std::string readString();
+		void skipString();
+		void skipValue();
+		uint32_t readNumber();
+		uint32_t readAddress();
+		void readAddresses(std::vector<uint32_t>&);
+		void fail(const std::string& reason);
+};
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef QUEUED_SENDER_H
+#define QUEUED_SENDER_H
+
+#include "sender.h"
+#include "spsc_ring.h"
+#include "incoming_message.h"
+
+/* Hands replies over to the transmit stage instead of writing them to the wire */
+class QueuedSender: public Sender {
+	public:
+		QueuedSender(SpscRing<OutgoingMessage>& queue);
+		void send(DHCPMessage&, unsigned messageType);
+		void sendTagged(DHCPMessage&, unsigned messageType, const VlanTags&);
+
+		/*
+		 * Request being handled: its capture time is passed along with replies for latency accounting,
+		 * its interface and VLAN tags tell the transmit stage where to send them
+		 */
+		void setRequest(const IncomingMessage&);
+
+	private:
+		SpscRing<OutgoingMessage>& queue;
+		int64_t capturedAt;
+		uint8_t interfaceIndex;
+		VlanTags vlanTags;
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/*
+ * Token buckets in a fixed size table indexed by key hash. Keys colliding in the table share
+ * one bucket, so memory never grows with the number of distinct senders, even when
+ * addresses are randomized. Zero rate disables limiting. Used by a single thread.
+ */
+class RateLimiter {
+	public:
+		RateLimiter(uint32_t rate, uint32_t burst, size_t tableSize);
+
+		/* Takes one token from key's bucket, nowMs is a monotonic time in milliseconds */
+		bool allow(const uint8_t* key, size_t keyLength, uint64_t nowMs);
+
+		uint64_t getDropped();
+		uint64_t getAllowed();
+
+	private:
+		struct TokenBucket {
+			/* In thousandths of a token, so slow rates still refill between packets */
+			uint32_t milliTokens;
+			uint32_t lastRefillMs;
+		};
+
+		uint32_t rate;
+		uint32_t burst;
+		size_t mask;
+		std::vector<TokenBucket> buckets;
+
+		uint64_t allowed;
+		uint64_t dropped;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef REPLICATION_BUFFER_H
+#define REPLICATION_BUFFER_H
+
+#include "replication_protocol.h"
+#include "hardware_address.h"
+#include "client_special_id.h"
+#include "allocated_address.h"
+#include "memory_accounting.h"
+#include <stdint.h>
+#include <vector>
+
+typedef TrackedVector<uint8_t, MEMORY_IO_BUFFERS> ReplicationBytes;
+
+/* Encodes lease events into replication frames, a frame is closed once it reaches REPLICATION_MAX_FRAME_SIZE */
+class ReplicationBuffer {
+	public:
+		ReplicationBuffer();
+
+		void appendControlFrame(uint32_t type);
+		void appendLease(uint8_t event, uint32_t networkAddress, const HardwareAddress&, const AllocatedAddress&);
+		void appendLease(uint8_t event, uint32_t networkAddress, const ClientSpecialId&, const AllocatedAddress&);
+
+		bool empty();
+		size_t size();
+		uint64_t getEventsCount();
+
+		/* Moves encoded frames to the end of target and leaves buffer empty */
+		void moveTo(ReplicationBytes& target);
+
+		static int64_t now();
+
+	private:
+		ReplicationBytes bytes;
+		size_t openFrameOffset;
+		bool frameOpen;
+		uint64_t eventsCount;
+
+		void appendRecord(uint8_t event, uint32_t networkAddress, const AllocatedAddress&, uint8_t identificationMethod, uint8_t idType, const uint8_t* id, size_t maxIdLength);
+		void openFrame(uint32_t type);
+		void closeFrame();
+		void append(const void* data, size_t size);
+};
+
+#endif
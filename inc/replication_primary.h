@@ -0,0 +1,73 @@
+#ifndef REPLICATION_PRIMARY_H
+#define REPLICATION_PRIMARY_H
+
+#include "lease_listener.h"
+#include "replication_buffer.h"
+#include "event_loop.h"
+#include "addresses_allocator.h"
+#include "pipeline.h"
+#include "config.h"
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Streams lease events to one connected standby. Events are collected from any thread
+ * and written in batches by the event loop. Standby gets full state when it connects
+ * and every resynchronization interval, a standby falling behind by more than
+ * the allowed backlog is disconnected and resynchronized after reconnecting.
+ */
+class ReplicationPrimary: public LeaseListener {
+	public:
+		ReplicationPrimary(EventLoop&, AddressesAllocator&, Pipeline*, Config&);
+		~ReplicationPrimary();
+
+		void onLeaseUpdated(uint32_t networkAddress, const HardwareAddress&, const AllocatedAddress&);
+		void onLeaseUpdated(uint32_t networkAddress, const ClientSpecialId&, const AllocatedAddress&);
+		void onLeaseRemoved(uint32_t networkAddress, const HardwareAddress&, uint32_t ipAddress, bool reusable);
+		void onLeaseRemoved(uint32_t networkAddress, const ClientSpecialId&, uint32_t ipAddress, bool reusable);
+
+		void tick(uint32_t elapsedSeconds);
+		std::string describe();
+
+	private:
+		EventLoop& eventLoop;
+		AddressesAllocator& allocator;
+		Pipeline* pipeline;
+		uint32_t resyncInterval;
+		size_t maxBacklog;
+
+		int listeningFd;
+		int standbyFd;
+		int wakeupFd;
+
+		std::mutex pendingMutex;
+		ReplicationBuffer pending;
+		ReplicationBuffer* replaying;
+		std::atomic<bool> streaming;
+
+		ReplicationBytes output;
+		size_t outputOffset;
+		size_t snapshotBytes;
+		uint32_t secondsSinceResync;
+
+		uint64_t eventsSent;
+		uint64_t bytesSent;
+		uint64_t resynchronizations;
+		uint64_t disconnects;
+
+		void listen(Config&);
+		void acceptStandby();
+		void closeStandby();
+		void onStandbyEvents(uint32_t events);
+
+		void resynchronize();
+		void flushPending();
+		void writeOutput();
+
+		template <class T> void queueEvent(uint8_t event, uint32_t networkAddress, const T& clientId, const AllocatedAddress&);
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef REPLICATION_PROTOCOL_H
+#define REPLICATION_PROTOCOL_H
+
+#include <stdint.h>
+#include "lease_file_format.h"
+
+/*
+ * Lease replication stream, all integers little endian:
+ * [ReplicationFrameHeader][ReplicatedLeaseHeader][client id bytes][ReplicatedLeaseHeader]...
+ * Full resynchronization is a RESYNC_START frame, lease frames with every lease and a RESYNC_END frame.
+ */
+
+#define REPLICATION_MAGIC 0x50524844
+#define REPLICATION_MAX_FRAME_SIZE (256 * 1024)
+
+#define REPLICATION_LEASES_FRAME 1
+#define REPLICATION_RESYNC_START_FRAME 2
+#define REPLICATION_RESYNC_END_FRAME 3
+
+#define LEASE_UPDATED_EVENT 1
+#define LEASE_REMOVED_EVENT 2
+#define LEASE_DECLINED_EVENT 3
+
+struct ReplicationFrameHeader {
+	uint32_t magic;
+	uint32_t type;
+	uint32_t length;
+	uint32_t recordsCount;
+	/* Wall clock time of the oldest event in frame, in microseconds */
+	int64_t createdAt;
+} __attribute__((packed));
+
+struct ReplicatedLeaseHeader {
+	LeaseRecord lease;
+	uint8_t event;
+	uint8_t identificationMethod;
+	uint8_t idType;
+	uint8_t idLength;
+} __attribute__((packed));
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef REPLICATION_STANDBY_H
+#define REPLICATION_STANDBY_H
+
+#include "replication_protocol.h"
+#include "replication_buffer.h"
+#include "event_loop.h"
+#include "addresses_allocator.h"
+#include "config.h"
+#include <stdint.h>
+#include <netinet/in.h>
+#include <string>
+#include <vector>
+
+/*
+ * Keeps connection to the primary server and applies streamed lease events
+ * to the local allocator, reconnecting on every tick while disconnected.
+ */
+class ReplicationStandby {
+	public:
+		ReplicationStandby(EventLoop&, AddressesAllocator&, Config&);
+		~ReplicationStandby();
+
+		void tick();
+		std::string describe();
+
+	private:
+		EventLoop& eventLoop;
+		AddressesAllocator& allocator;
+		struct sockaddr_in primaryAddress;
+
+		int primaryFd;
+		bool connected;
+		bool synchronized;
+		ReplicationBytes input;
+
+		uint64_t eventsReceived;
+		uint64_t bytesReceived;
+		uint64_t resynchronizations;
+		uint64_t disconnects;
+		int64_t lastLag;
+		int64_t maxLag;
+
+		void connectPrimary();
+		void closePrimary();
+		void onPrimaryEvents(uint32_t events);
+
+		size_t processFrames();
+		void applyFrame(const ReplicationFrameHeader&, const uint8_t* payload);
+		void applyLease(const ReplicatedLeaseHeader&, const uint8_t* id);
+};
+
+#endif
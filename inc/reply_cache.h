@@ -0,0 +1,66 @@
+#ifndef REPLY_CACHE_H
+#define REPLY_CACHE_H
+
+#include "config.h"
+#include "sender.h"
+#include "incoming_message.h"
+#include "metrics.h"
+#include "memory_accounting.h"
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+/*
+ * Recently sent OFFERs and ACKs/NAKs keyed by request xid, type and chaddr. Retransmitted DISCOVER
+ * or REQUEST is answered with the cached reply, without running a handler. Table has fixed size,
+ * newer reply overwrites older one in the same slot. Used by a single thread.
+ */
+class ReplyCache {
+	public:
+		ReplyCache(Config&);
+
+		/* Sends cached reply for given request, returns false when there is none */
+		bool replay(const IncomingMessage& request, Sender&, uint64_t nowMs);
+		void store(const IncomingMessage& request, const DHCPMessage& reply, unsigned replyType, uint64_t nowMs);
+
+		uint64_t getReplayed();
+
+	private:
+		struct CachedReply {
+			bool valid;
+			uint64_t storedAt;
+			uint32_t xid;
+			uint8_t requestType;
+			uint8_t htype;
+			uint8_t chaddr[MAX_HADDR_SIZE];
+			OutgoingMessage reply;
+		};
+
+		TrackedVector<CachedReply, MEMORY_REPLY_CACHE> replies;
+		size_t mask;
+		uint32_t timeToLive;
+		std::atomic<uint64_t> replayed;
+
+		CachedReply* find(const IncomingMessage& request);
+		bool isCacheable(const IncomingMessage& request);
+};
+
+/* Passes replies to the target sender, remembers them in the cache and counts them */
+class CachingSender: public Sender {
+	public:
+		CachingSender(Sender& target, ReplyCache&, MetricsShard&, const IncomingMessage& request, uint64_t nowMs);
+		void send(DHCPMessage&, unsigned messageType);
+		void sendTagged(DHCPMessage&, unsigned messageType, const VlanTags&);
+
+		unsigned getSentCount();
+
+	private:
+		Sender& target;
+		ReplyCache& cache;
+		MetricsShard& metrics;
+		const IncomingMessage& request;
+		uint64_t now;
+		unsigned sentCount;
+};
+
+#endif
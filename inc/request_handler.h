@@ -2,6 +2,7 @@
 #define REQUEST_HANDLER_H
 
 #include "server.h"
+#include "sender.h"
 #include "client.h"
 #include "transactions_storage.h"
 #include "addresses_allocator.h"
@@ -11,14 +12,20 @@
 enum ClientState { SELECTING, INIT_REBOOT, RENEWING, REBINDING, UNKNOWN };
 class RequestHandler {
 	public:
-		RequestHandler(TransactionsStorage&, Client&, AddressesAllocator&, Server&);
+		RequestHandler(TransactionsStorage&, Client&, AddressesAllocator&, Server&, Sender&);
 		void handle(struct DHCPMessage&, Options&, uint32_t dstAddr);
 
+		/* State determined by the last handle call */
+		ClientState getClientState();
+
 	private:
 		TransactionsStorage& transactionsStorage;
 		Client& client;
 		AddressesAllocator& allocator;
 		Server& server;
+		Sender& sender;
+		ClientState clientState;
+		uint32_t respondedAddress;
 
 		ClientState determineClientState(struct DHCPMessage&, Options&, uint32_t dstAddr);
 
@@ -0,0 +1,22 @@
+#ifndef REQUEST_PROCESSOR_H
+#define REQUEST_PROCESSOR_H
+
+#include "incoming_message.h"
+#include "transactions_storage.h"
+#include "reply_cache.h"
+#include "metrics.h"
+#include "sender.h"
+
+/*
+ * Handles requests taken off pipeline workers' queues. Implemented by the server,
+ * called from every worker thread with that worker's own storage, cache, metrics and sender.
+ */
+class RequestProcessor {
+	public:
+		virtual ~RequestProcessor() {}
+
+		/* Runs handler matching message type or replays cached reply, replies go through given sender */
+		virtual void process(IncomingMessage&, TransactionsStorage&, ReplyCache&, MetricsShard&, Sender&) = 0;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef REQUEST_SCHEDULER_H
+#define REQUEST_SCHEDULER_H
+
+#include "config.h"
+#include "incoming_message.h"
+#include "memory_accounting.h"
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+#define SCHEDULER_CLASSES_COUNT 2
+#define SCHEDULER_HIGH_PRIORITY 0
+#define SCHEDULER_LOW_PRIORITY 1
+
+/*
+ * Orders waiting requests before handlers run. Requests from clients that already talk to a server
+ * (REQUEST, RELEASE, DECLINE, INFORM) always go before DISCOVERs. Inside a class relays (giaddr)
+ * are served with deficit round robin, so one busy relay does not starve the others.
+ * DISCOVERs which waited too long are shed instead of being answered late.
+ * Used by a single thread, front() and pop() consume messages in place.
+ */
+class RequestScheduler {
+	public:
+		RequestScheduler(Config&);
+
+		/* Returns false when message class queue is full and message was dropped */
+		bool enqueue(const IncomingMessage&, uint64_t nowMs);
+
+		/* Returns NULL when there is nothing to process */
+		IncomingMessage* front(uint64_t nowMs);
+		void pop();
+
+		bool empty();
+		std::string describe();
+
+	private:
+		struct QueuedMessage {
+			IncomingMessage incoming;
+			uint64_t enqueuedAt;
+		};
+
+		struct RelayQueue {
+			RelayQueue(): deficit(0) {}
+
+			TrackedDeque<QueuedMessage, MEMORY_IO_BUFFERS> messages;
+			unsigned deficit;
+		};
+
+		struct PriorityClass {
+			PriorityClass(): queued(0), quantumGranted(false), dropped(0) {}
+
+			std::unordered_map<uint32_t, RelayQueue> relays;
+			std::deque<uint32_t> activeRelays;
+			size_t queued;
+			bool quantumGranted;
+			uint64_t dropped;
+		};
+
+		PriorityClass classes[SCHEDULER_CLASSES_COUNT];
+		RelayQueue* selectedQueue;
+		PriorityClass* selectedClass;
+
+		size_t queueSize;
+		unsigned quantum;
+		uint32_t maxDiscoverDelay;
+		uint16_t maxDiscoverSecs;
+		uint64_t shed;
+
+		RelayQueue* selectRelay(PriorityClass&, bool shedStale, uint64_t nowMs);
+		bool isStale(const QueuedMessage&, uint64_t nowMs);
+};
+
+#endif
@@ -1,21 +1,32 @@
 #ifndef SENDER_H
 #define SENDER_H
 
-#include <libnet.h>
 #include "dhcp_message.h"
 #include "allocated_address.h"
 #include "options.h"
+#include "vlan_tags.h"
 
 #define IP_BROADCAST_ADDR 0xffffffff
 
+/* Destination of replies: the wire, transmit queue or another sender they are passed on to */
 class Sender {
 	public:
-		Sender(libnet_t* lnetHandle);
+		virtual ~Sender() {}
+		/* Untagged frame, or frame with tags of the request when sender is bound to one */
+		virtual void send(DHCPMessage&, unsigned messageType) = 0;
+		virtual void sendTagged(DHCPMessage&, unsigned messageType, const VlanTags&) = 0;
+};
+
+/* Sends replies to one request with the VLAN tags it came with */
+class TaggedSender: public Sender {
+	public:
+		TaggedSender(Sender& target, const VlanTags&);
 		void send(DHCPMessage&, unsigned messageType);
+		void sendTagged(DHCPMessage&, unsigned messageType, const VlanTags&);
 
 	private:
-		libnet_t* lnetHandle;
-		void fillBroadcastAddress(uint8_t* buffer);
+		Sender& target;
+		const VlanTags& vlanTags;
 };
 
 #endif
@@ -2,43 +2,131 @@
 #define SERVER_H
 
 #include <pcap/pcap.h>
-#include <libnet.h>
 #include <unordered_map>
+#include <vector>
 #include "options.h"
 #include "addresses_allocator.h"
 #include "config.h"
 #include "transactions_storage.h"
 #include "network_resolver.h"
+#include "load_balancer.h"
+#include "rate_limiter.h"
+#include "request_scheduler.h"
+#include "reply_cache.h"
+#include "metrics.h"
+#include "metrics_endpoint.h"
+#include "pools_monitor.h"
 #include "sender.h"
+#include "network_interface.h"
+#include "event_loop.h"
+#include "clock.h"
+#include "control_socket.h"
+#include "incoming_message.h"
+#include "pipeline.h"
+#include "request_processor.h"
+#include "replication_primary.h"
+#include "replication_standby.h"
+#include "bulk_leasequery.h"
+#include <thread>
 
-class Server {
+#define SCHEDULED_BATCH_SIZE 64
+#define HOUSEKEEPING_INTERVAL 1
+/* Capture ring polls between checks of other descriptors in busy poll mode */
+#define BUSY_POLL_ROUNDS 64
+
+class Server: public RequestProcessor {
 	public:
-		Server(Config&, AddressesAllocator&, TransactionsStorage&);
+		Server(Config&, AddressesAllocator&, TransactionsStorage&, Clock&);
 		~Server();
 
+		/* Runs event loop until SIGINT, SIGTERM or "stop" control command */
 		void listen();
+		void stop();
 		void save();
 
-		uint32_t serverIp;
-		libnet_t* lnetHandle;
-		Sender* sender;
+		/* Parses configuration file in background thread, result is applied by the event loop */
+		void reload();
+
+		/* Runs handler matching message type or replays cached reply, replies go through given sender */
+		void process(IncomingMessage&, TransactionsStorage&, ReplyCache&, MetricsShard&, Sender&);
+
+		/* Address of the interface client's request came through, sent as server identifier */
+		uint32_t getServerIp(const Client&);
+		/* True for address of any served interface */
+		bool isServerIp(uint32_t address);
+
+		/* Refreshed once per receive batch, shared by handlers of all workers */
+		Clock& clock;
 
 	private:
 		Config &config;
 		AddressesAllocator &addressesAllocator;
 		TransactionsStorage &transactionsStorage;
 		NetworkResolver* networkResolver;
+		LoadBalancer* loadBalancer;
+		RateLimiter* clientsLimiter;
+		RateLimiter* relaysLimiter;
 
 		static void dispatch(u_char *server, const struct pcap_pkthdr *header, const u_char *bytes);
+		bool parse(const struct pcap_pkthdr *header, const u_char *bytes, IncomingMessage&);
+		static unsigned locateIpHeader(const u_char* frame, unsigned length, VlanTags&);
+
+		/* Indexed by Client::interfaceIndex, set once at start */
+		std::vector<NetworkInterface*> interfaces;
+		/* Interface whose capture buffer is being dispatched, packets carry no other trace of it */
+		NetworkInterface* receivingInterface;
+		bool busyPolling;
+
+		void createInterfaces();
+		std::vector<uint32_t> getServerIps();
+		void warnAboutInterfacesChange(Config&);
+
+		EventLoop eventLoop;
+		ControlSocket* controlSocket;
+		int timerFd;
+		int signalFd;
+		uint32_t secondsSinceSnapshot;
+		Pipeline* pipeline;
+		RequestScheduler* scheduler;
+		ReplyCache replyCache;
+
+		Metrics metrics;
+		MetricsShard* receiveMetrics;
+		MetricsEndpoint* metricsEndpoint;
+		PoolsMonitor poolsMonitor;
+		int scheduledFd;
+		ReplicationPrimary* replicationPrimary;
+		ReplicationStandby* replicationStandby;
+		BulkLeasequery* bulkLeasequery;
 
-		uint32_t determineDeviceIp(const char* interfaceName);
+		std::thread reloadThread;
+		int reloadFd;
+		bool reloading;
+		Config* reloadedConfig;
+		std::string reloadError;
 
-		char pcapErrbuf[PCAP_ERRBUF_SIZE];
-		pcap_t* pcapHandle;
+		void createReloadNotifier();
+		void onConfigReloaded();
+		void applyConfig(Config&);
 
-		char lnetErrbuf[LIBNET_ERRBUF_SIZE];
+		void createTimer();
+		void createSignalsDescriptor();
+		void createControlSocket();
+		void createReplication();
+		void createBulkLeasequery();
+		void createMetricsEndpoint();
+		std::string renderMetrics();
+		void createRateLimiters(Config&);
+		std::string describeRateLimiters();
+		void promote();
 
-		void setPacketsFilter();
+		void capture(NetworkInterface*);
+		void pollCapture();
+		void processScheduled();
+		void handle(IncomingMessage&, TransactionsStorage&, MetricsShard&, Sender&);
+		void onTimer();
+		void onSignal();
+		void trySave();
 };
 
 #endif
@@ -0,0 +1,82 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+#include "memory_accounting.h"
+
+#define CACHE_LINE_SIZE 64
+
+/*
+ * Bounded lock-free queue for exactly one producer and one consumer thread.
+ * Slots are filled and consumed in place (acquire/publish, front/pop), so large
+ * messages are never copied through temporaries. Capacity is rounded up to power of two.
+ */
+template <class T> class SpscRing {
+	public:
+		SpscRing(size_t requestedCapacity): head(0), cachedTail(0), tail(0), cachedHead(0) {
+			size_t capacity = 1;
+			while(capacity < requestedCapacity) {
+				capacity <<= 1;
+			}
+			slots.resize(capacity);
+			mask = capacity - 1;
+		}
+
+		/* Producer side, returns NULL when ring is full */
+		T* acquire() {
+			size_t currentHead = head.load(std::memory_order_relaxed);
+			if(currentHead - cachedTail > mask) {
+				cachedTail = tail.load(std::memory_order_acquire);
+				if(currentHead - cachedTail > mask) {
+					return NULL;
+				}
+			}
+			return &slots[currentHead & mask];
+		}
+
+		void publish() {
+			head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+		/* Consumer side, returns NULL when ring is empty */
+		T* front() {
+			size_t currentTail = tail.load(std::memory_order_relaxed);
+			if(currentTail == cachedHead) {
+				cachedHead = head.load(std::memory_order_acquire);
+				if(currentTail == cachedHead) {
+					return NULL;
+				}
+			}
+			return &slots[currentTail & mask];
+		}
+
+		void pop() {
+			tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+		/* Approximate when called concurrently, meant for monitoring */
+		size_t size() const {
+			return head.load(std::memory_order_relaxed) - tail.load(std::memory_order_relaxed);
+		}
+
+		size_t capacity() const {
+			return mask + 1;
+		}
+
+	private:
+		TrackedVector<T, MEMORY_IO_BUFFERS> slots;
+		size_t mask;
+
+		/* Producer and consumer indexes live on separate cache lines to avoid false sharing */
+		char headPadding[CACHE_LINE_SIZE];
+		std::atomic<size_t> head;
+		size_t cachedTail;
+		char tailPadding[CACHE_LINE_SIZE];
+		std::atomic<size_t> tail;
+		size_t cachedHead;
+		char endPadding[CACHE_LINE_SIZE];
+};
+
+#endif
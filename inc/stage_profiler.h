@@ -0,0 +1,44 @@
+#ifndef STAGE_PROFILER_H
+#define STAGE_PROFILER_H
+
+#include <stdint.h>
+#include <string>
+
+enum ProfiledStage { STAGE_PARSE, STAGE_OPTIONS, STAGE_RESOLVE, STAGE_LOOKUP, STAGE_ALLOCATE, STAGE_PACK, STAGE_SEND, STAGES_COUNT };
+
+/*
+ * Per thread histograms of time spent in dispatch stages, in TSC cycles where available, nanoseconds otherwise.
+ * Only built in with ./configure --profile (DHCP_PROFILING), otherwise the PROFILE_* macros expand to nothing.
+ */
+class StageProfiler {
+	public:
+		static uint64_t now();
+		static void record(ProfiledStage, uint64_t elapsed);
+		static std::string dump();
+};
+
+class StageTimer {
+	public:
+		StageTimer(ProfiledStage profiledStage): stage(profiledStage), start(StageProfiler::now()) {}
+		~StageTimer() {
+			StageProfiler::record(stage, StageProfiler::now() - start);
+		}
+
+	private:
+		ProfiledStage stage;
+		uint64_t start;
+};
+
+#ifdef DHCP_PROFILING
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(stage) StageTimer PROFILE_CONCAT(stageTimer, __LINE__)(stage)
+#define PROFILE_BEGIN(name) uint64_t name = StageProfiler::now()
+#define PROFILE_END(name, stage) StageProfiler::record(stage, StageProfiler::now() - name)
+#else
+#define PROFILE_SCOPE(stage)
+#define PROFILE_BEGIN(name)
+#define PROFILE_END(name, stage)
+#endif
+
+#endif
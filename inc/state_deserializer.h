@@ -5,11 +5,16 @@
 #include "../inc/hardware_address.h"
 #include "../inc/client_special_id.h"
 #include "../inc/addresses_pool.h"
+#include "../inc/lease_file_format.h"
 #include <stdio.h>
 #include <stdint.h>
-#include <list>
-#include <unordered_set>
 
+#define LEASE_SECTIONS_COUNT 4
+
+/*
+ * Maps cache file into memory and validates it. Records are exposed in place,
+ * so they are never copied before being turned into allocator structures.
+ */
 class StateDeserializer {
 	public:
 		StateDeserializer(const char* filePath);
@@ -17,16 +22,29 @@ class StateDeserializer {
 
 		static bool cacheExists(const char* filePath);
 
-		size_t deserialize(AllocatedAddress* allocatedAddress);
-		size_t deserialize(HardwareAddress* hardwareAddress);
-		size_t deserialize(ClientSpecialId*);
-		size_t deserialize(uint32_t*);
-		size_t deserialize(time_t*);
-		size_t deserialize(std::list<uint32_t>*);
-		size_t deserialize(std::unordered_set<uint32_t>*);
-		size_t deserialize(AddressesPool*);
+		bool isValid();
+
+		size_t getRecords(const HardwareLeaseRecord** records);
+		size_t getRecords(const SpecialIdLeaseRecord** records);
+		size_t getRecords(const PoolRecord** records);
+		size_t getRecords(const AbandonedAddressRecord** records);
+
+		static uint32_t deserialize(const LeaseRecord&, AllocatedAddress*);
+		static void deserialize(const HardwareLeaseRecord&, HardwareAddress*);
+		static void deserialize(const SpecialIdLeaseRecord&, ClientSpecialId*);
+
 	private:
-		FILE* file;		
+		uint8_t* mapping;
+		size_t mappingSize;
+		bool valid;
+
+		const LeaseSectionHeader* sections[LEASE_SECTIONS_COUNT + 1];
+
+		void map(const char* filePath);
+		bool validate();
+		bool validateSection(const LeaseSectionHeader*, size_t availableSize, size_t* sectionSize);
+		size_t expectedRecordSize(uint32_t sectionType);
+		template <class T> size_t getSection(uint32_t type, const T** records);
 };
 
 #endif
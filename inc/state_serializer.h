@@ -5,26 +5,36 @@
 #include "../inc/hardware_address.h"
 #include "../inc/client_special_id.h"
 #include "../inc/addresses_pool.h"
+#include "../inc/lease_file_format.h"
 #include <stdio.h>
 #include <stdint.h>
-#include <list>
-#include <unordered_set>
+#include <string>
+#include <vector>
 
 class StateSerializer {
 	public:
 		StateSerializer(const char* filePath);
-		~StateSerializer();
-
-		void serialize(const AllocatedAddress& allocatedAddress);
-		void serialize(const HardwareAddress& hardwareAddress);
-		void serialize(const ClientSpecialId&);
-		void serialize(const uint32_t);
-		void serializeTime(const time_t); // Needs to have different name, some compilers would not distinguish between time_t and uint32_t
-		void serialize(const std::list<uint32_t>&);
-		void serialize(const std::unordered_set<uint32_t>&);
+
+		void serialize(uint32_t networkAddress, const HardwareAddress&, const AllocatedAddress&);
+		void serialize(uint32_t networkAddress, const ClientSpecialId&, const AllocatedAddress&);
 		void serialize(const AddressesPool&);
+
+		/* Writes collected records to temporary file, syncs it and atomically replaces the cache with it */
+		void commit();
+
 	private:
-		FILE* file;		
+		std::string filePath;
+
+		std::vector<HardwareLeaseRecord> hardwareLeases;
+		std::vector<SpecialIdLeaseRecord> specialIdLeases;
+		std::vector<PoolRecord> pools;
+		std::vector<AbandonedAddressRecord> abandonedAddresses;
+
+		void fillLeaseRecord(LeaseRecord&, uint32_t networkAddress, const AllocatedAddress&);
+		void writeHeader(FILE*, uint32_t sectionsCount);
+		template <class T> void writeSection(FILE*, uint32_t type, const std::vector<T>&);
+		void write(FILE*, const void* data, size_t size);
+		void syncDirectory();
 };
 
 #endif
@@ -0,0 +1,21 @@
+#ifndef TASKS_POOL_H
+#define TASKS_POOL_H
+
+#include <functional>
+#include <vector>
+
+/*
+ * Runs batch of independent tasks on up to threadsCount threads and waits for all of them.
+ * First exception thrown by a task is rethrown to the caller after every thread has finished.
+ */
+class TasksPool {
+	public:
+		TasksPool(unsigned threadsCount);
+
+		void run(const std::vector<std::function<void()> >& tasks);
+
+	private:
+		unsigned threadsCount;
+};
+
+#endif
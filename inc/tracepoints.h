@@ -0,0 +1,55 @@
+#ifndef TRACEPOINTS_H
+#define TRACEPOINTS_H
+
+#include "client.h"
+
+/*
+ * USDT probes of the dhcp_server provider, usable from bpftrace and perf. A probe is a single nop
+ * until a tracer attaches, so they stay compiled in whenever <sys/sdt.h> is available at build time.
+ *
+ * packet__receive(xid, chaddr, giaddr, length)
+ * handler__entry(type, xid, clientKey, subnet)
+ * handler__exit(type, xid, clientKey, subnet, address)
+ * lease__allocate(clientKey, subnet, address), lease__refresh(clientKey, subnet, address)
+ * lease__free(clientKey, subnet, address, reusable), lease__reclaim(clientKey, subnet, address)
+ * transaction__create(xid, address), transaction__expire(xid)
+ * snapshot__start(networks), snapshot__end(networks, saved)
+ *
+ * Allocator probes fire inside handler__entry/handler__exit of the same thread, which carries the xid.
+ * Client key points to the client identifier when the client sent one, to chaddr otherwise.
+ */
+#if defined(__has_include) && !defined(DHCP_NO_TRACEPOINTS)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define DHCP_TRACEPOINTS
+#endif
+#endif
+
+#ifdef DHCP_TRACEPOINTS
+#define TRACE1(name, a) DTRACE_PROBE1(dhcp_server, name, a)
+#define TRACE2(name, a, b) DTRACE_PROBE2(dhcp_server, name, a, b)
+#define TRACE3(name, a, b, c) DTRACE_PROBE3(dhcp_server, name, a, b, c)
+#define TRACE4(name, a, b, c, d) DTRACE_PROBE4(dhcp_server, name, a, b, c, d)
+#define TRACE5(name, a, b, c, d, e) DTRACE_PROBE5(dhcp_server, name, a, b, c, d, e)
+#else
+/* Arguments are still type checked, but never evaluated */
+#define TRACE1(name, a) ((void)sizeof(a))
+#define TRACE2(name, a, b) (TRACE1(name, a), (void)sizeof(b))
+#define TRACE3(name, a, b, c) (TRACE2(name, a, b), (void)sizeof(c))
+#define TRACE4(name, a, b, c, d) (TRACE3(name, a, b, c), (void)sizeof(d))
+#define TRACE5(name, a, b, c, d, e) (TRACE4(name, a, b, c, d), (void)sizeof(e))
+#endif
+
+inline const uint8_t* tracedClientKey(const HardwareAddress& hardwareAddress) {
+	return hardwareAddress.hardwareAddress;
+}
+
+inline const uint8_t* tracedClientKey(const ClientSpecialId& specialId) {
+	return specialId.value;
+}
+
+inline const uint8_t* tracedClientKey(const Client& client) {
+	return client.identificationMethod == BASED_ON_HARDWARE ? tracedClientKey(client.hardwareAddress) : tracedClientKey(client.specialId);
+}
+
+#endif
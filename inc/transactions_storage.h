@@ -3,32 +3,34 @@
 
 #include "transaction.h"
 #include "config.h"
+#include "clock.h"
+#include "memory_accounting.h"
 #include <unordered_map>
-#include <signal.h>
+#include <deque>
+#include <utility>
 #include <time.h>
 
-class TransactionsStorage;
-
-struct CleanTaskData {
-	uint32_t transactionId;
-	timer_t timer;
-	TransactionsStorage* storage;
-};
-
 class TransactionsStorage {
 	public:
-		TransactionsStorage(Config& config);
+		TransactionsStorage(Config& config, Clock& clock);
 		Transaction& createTransaction(uint32_t xid, AllocatedAddress*);
 		const Transaction& getTransaction(uint32_t id);
 		void removeTransaction(uint32_t id);
 		bool transactionExists(uint32_t id);
 
+		/* Drops transactions older than configured storage time, called periodically by the server */
+		void removeExpired();
+
 	private:
 		Config& config;
-		std::unordered_map<uint32_t, Transaction> transactions;
-		std::unordered_map<uint32_t, CleanTaskData> cleanTasksData;
+		Clock& clock;
+		TrackedUnorderedMap<uint32_t, Transaction, MEMORY_TRANSACTIONS> transactions;
+		TrackedUnorderedMap<uint32_t, time_t, MEMORY_TRANSACTIONS> expirationTimes;
+
+		/* Storage time is constant, so expiration order equals creation order */
+		TrackedDeque<std::pair<time_t, uint32_t>, MEMORY_TRANSACTIONS> expirationQueue;
 
-		void scheduleCleanTask(uint32_t transactionId);
+		time_t now();
 };
 
 #endif
@@ -0,0 +1,21 @@
+#ifndef VLAN_TAGS_H
+#define VLAN_TAGS_H
+
+#include <stdint.h>
+
+/* Single 802.1Q tag or QinQ pair */
+#define MAX_VLAN_TAGS 2
+#define VLAN_ID_COUNT 4096
+#define VLAN_ID_MASK 0x0fff
+
+/*
+ * Tags of a received frame, outermost first, in host byte order.
+ * Replies are sent with the same tags, so priority and tag protocol are kept as well.
+ */
+struct VlanTags {
+	uint8_t count;
+	uint16_t protocols[MAX_VLAN_TAGS];
+	uint16_t controls[MAX_VLAN_TAGS];
+};
+
+#endif
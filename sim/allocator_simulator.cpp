@@ -0,0 +1,350 @@
+#include "allocator_simulator.h"
+#include <time.h>
+#include <string.h>
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+static const char* operationNames[OPERATIONS_COUNT] = {
+	"discover", "request", "renew", "release", "decline", "reboot", "exhaust"
+};
+
+LatencyHistogram::LatencyHistogram(): count(0), max(0) {
+	memset(buckets, 0, sizeof(buckets));
+}
+
+/* Values below SUB_BUCKETS get exact buckets, above that every power of two is split linearly */
+unsigned LatencyHistogram::bucketOf(uint64_t nanoseconds) {
+	if(nanoseconds < SUB_BUCKETS) {
+		return nanoseconds;
+	}
+	unsigned exponent = 63 - __builtin_clzll(nanoseconds);
+	unsigned subBucket = (nanoseconds >> (exponent - 3)) & (SUB_BUCKETS - 1);
+
+	return (exponent - 2) * SUB_BUCKETS + subBucket;
+}
+
+uint64_t LatencyHistogram::upperBound(unsigned bucket) {
+	if(bucket < SUB_BUCKETS) {
+		return bucket;
+	}
+	unsigned exponent = bucket / SUB_BUCKETS + 2;
+	uint64_t subBucket = bucket % SUB_BUCKETS;
+
+	return ((SUB_BUCKETS + subBucket + 1) << (exponent - 3)) - 1;
+}
+
+void LatencyHistogram::record(uint64_t nanoseconds) {
+	++buckets[bucketOf(nanoseconds)];
+	++count;
+	max = std::max(max, nanoseconds);
+}
+
+/* Upper bound of the bucket holding the percentile, never above the real maximum */
+uint64_t LatencyHistogram::percentile(double fraction) {
+	uint64_t rank = (uint64_t)(fraction * count);
+	uint64_t seen = 0;
+	for(unsigned i = 0; i < BUCKETS; ++i) {
+		seen += buckets[i];
+		if(seen > rank) {
+			return min(upperBound(i), max);
+		}
+	}
+
+	return max;
+}
+
+uint64_t LatencyHistogram::getCount() {
+	return count;
+}
+
+uint64_t LatencyHistogram::getMax() {
+	return max;
+}
+
+AllocatorSimulator::AllocatorSimulator(Config& configuration, uint32_t clients)
+	: config(configuration), clock(time(NULL)), allocator(configuration, clock), transactions(configuration, clock),
+	clientsCount(clients), nextXid(1), operationsInSecond(0), peakLeases(0), peakLeasesBytes(0), peakTransactionsBytes(0),
+	poolsBytes(0), exhaustedAfter(0), reclaimed(0) {
+
+	memset(failures, 0, sizeof(failures));
+	const unordered_map<uint32_t, AddressesPool*>& pools = allocator.getPools();
+	for(unordered_map<uint32_t, AddressesPool*>::const_iterator it = pools.begin(); it != pools.end(); it++) {
+		networks.push_back(it->first);
+	}
+	if(networks.empty()) {
+		throw runtime_error("Simulation needs at least one pool");
+	}
+	sort(networks.begin(), networks.end());
+	leaseTime = pools.find(networks[0])->second->getDescriptor()->leaseTime;
+
+	/* Churn brings a fifth of the population as new clients */
+	statuses.resize(clientsCount + clientsCount / 5, CLIENT_ABSENT);
+}
+
+/*
+ * Renewals happen at T1 of the first pool. Departed clients never come back,
+ * so their leases are expired when the pools run out and get reclaimed.
+ */
+void AllocatorSimulator::run() {
+	join(0, clientsCount);
+
+	advance(leaseTime / 2);
+	for(uint32_t id = 0; id < clientsCount; ++id) {
+		renew(id);
+	}
+
+	for(uint32_t id = 0; id < clientsCount; ++id) {
+		if(id % 10 == 0) {
+			release(id);
+		}
+		else if(id % 100 == 1) {
+			decline(id);
+		}
+		else if(id % 5 == 2) {
+			statuses[id] = CLIENT_DEPARTED;
+		}
+	}
+	join(clientsCount, statuses.size() - clientsCount);
+
+	advance(leaseTime / 2);
+	for(uint32_t id = 0; id < statuses.size(); ++id) {
+		reboot(id);
+	}
+	for(uint32_t id = 0; id < statuses.size(); ++id) {
+		renew(id);
+	}
+
+	advance(leaseTime / 2 + leaseTime / 10);
+	exhaust();
+	sampleMemory();
+}
+
+Client AllocatorSimulator::makeClient(uint32_t id) {
+	/* Value initialization zeroes identifiers, HardwareAddress constructor leaves them untouched */
+	Client client = Client();
+	client.identificationMethod = BASED_ON_HARDWARE;
+	client.hardwareAddress.addressType = 1;
+	client.hardwareAddress.hardwareAddress[0] = 0x02;
+	client.hardwareAddress.hardwareAddress[2] = id >> 24;
+	client.hardwareAddress.hardwareAddress[3] = id >> 16;
+	client.hardwareAddress.hardwareAddress[4] = id >> 8;
+	client.hardwareAddress.hardwareAddress[5] = id;
+	client.networkAddress = networks[id % networks.size()];
+
+	return client;
+}
+
+/* Offers of one simulated second are made before their requests, so transactions accumulate like on the wire */
+void AllocatorSimulator::join(uint32_t firstId, uint32_t count) {
+	for(uint32_t batchStart = 0; batchStart < count; batchStart += SIMULATED_OPERATIONS_PER_SECOND) {
+		uint32_t batchSize = min((uint32_t)SIMULATED_OPERATIONS_PER_SECOND, count - batchStart);
+		uint32_t firstXid = nextXid;
+		nextXid += batchSize;
+
+		for(uint32_t i = 0; i < batchSize; ++i) {
+			discover(firstId + batchStart + i, firstXid + i, OPERATION_DISCOVER);
+		}
+		for(uint32_t i = 0; i < batchSize; ++i) {
+			if(request(firstXid + i)) {
+				statuses[firstId + batchStart + i] = CLIENT_ACTIVE;
+			}
+		}
+	}
+}
+
+bool AllocatorSimulator::discover(uint32_t id, uint32_t xid, SimulatedOperation operation) {
+	Client client = makeClient(id);
+	bool allocated = true;
+
+	uint64_t start = nowNs();
+	AllocatedAddress* address = allocator.hasClientAllocatedAddress(client) ? &allocator.refreshLeaseTime(client) : allocator.allocateAddressFor(client);
+	if(address != NULL) {
+		transactions.createTransaction(xid, address);
+	}
+	else {
+		allocated = false;
+		++failures[operation];
+	}
+	histograms[operation].record(nowNs() - start);
+	tick();
+
+	return allocated;
+}
+
+bool AllocatorSimulator::request(uint32_t xid) {
+	bool acknowledged = false;
+
+	uint64_t start = nowNs();
+	if(transactions.transactionExists(xid)) {
+		acknowledged = transactions.getTransaction(xid).allocatedAddress != NULL;
+	}
+	transactions.removeTransaction(xid);
+	histograms[OPERATION_REQUEST].record(nowNs() - start);
+	tick();
+
+	if(!acknowledged) {
+		++failures[OPERATION_REQUEST];
+	}
+	return acknowledged;
+}
+
+void AllocatorSimulator::renew(uint32_t id) {
+	if(statuses[id] != CLIENT_ACTIVE) {
+		return;
+	}
+	Client client = makeClient(id);
+
+	uint64_t start = nowNs();
+	if(allocator.hasClientAllocatedAddress(client)) {
+		allocator.refreshLeaseTime(client);
+	}
+	else {
+		++failures[OPERATION_RENEW];
+	}
+	histograms[OPERATION_RENEW].record(nowNs() - start);
+	tick();
+}
+
+void AllocatorSimulator::release(uint32_t id) {
+	if(statuses[id] != CLIENT_ACTIVE) {
+		return;
+	}
+	Client client = makeClient(id);
+
+	uint64_t start = nowNs();
+	allocator.freeClientAddress(client);
+	histograms[OPERATION_RELEASE].record(nowNs() - start);
+	tick();
+
+	statuses[id] = CLIENT_RELEASED;
+}
+
+void AllocatorSimulator::decline(uint32_t id) {
+	if(statuses[id] != CLIENT_ACTIVE) {
+		return;
+	}
+	Client client = makeClient(id);
+
+	uint64_t start = nowNs();
+	allocator.freeClientAddressButLeaveUnavailable(client);
+	histograms[OPERATION_DECLINE].record(nowNs() - start);
+	tick();
+
+	statuses[id] = CLIENT_DECLINED;
+}
+
+/* INIT-REBOOT of every active client after a power outage, lease is only looked up */
+void AllocatorSimulator::reboot(uint32_t id) {
+	if(statuses[id] != CLIENT_ACTIVE) {
+		return;
+	}
+	Client client = makeClient(id);
+
+	uint64_t start = nowNs();
+	if(!allocator.hasClientAllocatedAddress(client) || allocator.getAllocatedAddress(client).ipAddress == 0) {
+		++failures[OPERATION_REBOOT];
+	}
+	histograms[OPERATION_REBOOT].record(nowNs() - start);
+	tick();
+}
+
+/* New clients join until allocation fails, pools reclaim expired leases on the way */
+void AllocatorSimulator::exhaust() {
+	uint64_t poolsSize = 0;
+	const unordered_map<uint32_t, AddressesPool*>& pools = allocator.getPools();
+	for(unordered_map<uint32_t, AddressesPool*>::const_iterator it = pools.begin(); it != pools.end(); it++) {
+		poolsSize += it->second->getUsage().size;
+	}
+
+	uint64_t reclaimsBefore = countReclaims();
+	uint32_t id = statuses.size();
+	for(uint64_t i = 0; i <= poolsSize; ++i, ++id) {
+		uint32_t xid = nextXid++;
+		bool allocated = discover(id, xid, OPERATION_EXHAUST);
+		transactions.removeTransaction(xid);
+		if(!allocated) {
+			break;
+		}
+		++exhaustedAfter;
+	}
+	reclaimed = countReclaims() - reclaimsBefore;
+}
+
+/* Housekeeping of the server, done once per simulated second */
+void AllocatorSimulator::tick() {
+	if(++operationsInSecond < SIMULATED_OPERATIONS_PER_SECOND) {
+		return;
+	}
+	operationsInSecond = 0;
+	advance(1);
+}
+
+void AllocatorSimulator::advance(uint32_t seconds) {
+	clock.advance((uint64_t)seconds * 1000);
+	transactions.removeExpired();
+	sampleMemory();
+}
+
+void AllocatorSimulator::sampleMemory() {
+	uint64_t leases = countLeases();
+	int64_t leasesBytes = MemoryAccounting::getBytes(MEMORY_LEASES);
+	if(leases >= peakLeases) {
+		peakLeases = leases;
+		peakLeasesBytes = leasesBytes;
+	}
+	peakTransactionsBytes = max(peakTransactionsBytes, MemoryAccounting::getBytes(MEMORY_TRANSACTIONS));
+	poolsBytes = max(poolsBytes, MemoryAccounting::getBytes(MEMORY_POOLS));
+}
+
+uint64_t AllocatorSimulator::countLeases() {
+	uint64_t leases = 0;
+	const unordered_map<uint32_t, AddressesPool*>& pools = allocator.getPools();
+	for(unordered_map<uint32_t, AddressesPool*>::const_iterator it = pools.begin(); it != pools.end(); it++) {
+		leases += it->second->getUsage().leased;
+	}
+
+	return leases;
+}
+
+uint64_t AllocatorSimulator::countReclaims() {
+	uint64_t reclaims = 0;
+	const unordered_map<uint32_t, AddressesPool*>& pools = allocator.getPools();
+	for(unordered_map<uint32_t, AddressesPool*>::const_iterator it = pools.begin(); it != pools.end(); it++) {
+		reclaims += it->second->getUsage().reclaims;
+	}
+
+	return reclaims;
+}
+
+uint64_t AllocatorSimulator::nowNs() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+/* Latencies include one clock_gettime call, about 20ns */
+string AllocatorSimulator::report() {
+	ostringstream description;
+	description << "clients " << clientsCount << " pools " << networks.size() << " lease_time " << leaseTime << "\n"
+		<< "operation count failures p50_ns p99_ns p999_ns max_ns\n";
+	for(unsigned i = 0; i < OPERATIONS_COUNT; ++i) {
+		LatencyHistogram& histogram = histograms[i];
+		description << operationNames[i] << " " << histogram.getCount() << " " << failures[i]
+			<< " " << histogram.percentile(0.5) << " " << histogram.percentile(0.99)
+			<< " " << histogram.percentile(0.999) << " " << histogram.getMax() << "\n";
+	}
+
+	description << "peak_leases " << peakLeases << "\n"
+		<< "leases_bytes " << peakLeasesBytes << "\n"
+		<< "bytes_per_lease " << (peakLeases ? peakLeasesBytes / (int64_t)peakLeases : 0) << "\n"
+		<< "pools_bytes " << poolsBytes << "\n"
+		<< "transactions_peak_bytes " << peakTransactionsBytes << "\n"
+		<< "allocated_until_exhaustion " << exhaustedAfter << "\n"
+		<< "reclaimed_during_exhaustion " << reclaimed << "\n";
+
+	return description.str();
+}
@@ -0,0 +1,94 @@
+#ifndef ALLOCATOR_SIMULATOR_H
+#define ALLOCATOR_SIMULATOR_H
+
+#include "../inc/addresses_allocator.h"
+#include "../inc/transactions_storage.h"
+#include "../inc/clock.h"
+#include "../inc/config.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+enum SimulatedOperation { OPERATION_DISCOVER, OPERATION_REQUEST, OPERATION_RENEW, OPERATION_RELEASE, OPERATION_DECLINE, OPERATION_REBOOT, OPERATION_EXHAUST, OPERATIONS_COUNT };
+
+/* Housekeeping runs every simulated second, that many operations are done in one second */
+#define SIMULATED_OPERATIONS_PER_SECOND 10000
+
+/* Log-linear histogram of nanoseconds, every power of two is split into 8 buckets */
+class LatencyHistogram {
+	public:
+		LatencyHistogram();
+
+		void record(uint64_t nanoseconds);
+		uint64_t percentile(double fraction);
+		uint64_t getCount();
+		uint64_t getMax();
+
+	private:
+		static const unsigned SUB_BUCKETS = 8;
+		static const unsigned BUCKETS = 64 * SUB_BUCKETS;
+
+		uint64_t buckets[BUCKETS];
+		uint64_t count;
+		uint64_t max;
+
+		static unsigned bucketOf(uint64_t nanoseconds);
+		static uint64_t upperBound(unsigned bucket);
+};
+
+/*
+ * Drives allocator and transactions storage the way handlers do, without packets and sockets,
+ * under a virtual clock. One run goes through the whole lease lifecycle of a population:
+ * joins, renewals at T1, releases, declines, churn, mass reboot and finally pool exhaustion,
+ * where expired leases of departed clients are reclaimed. Clients are spread over all configured pools.
+ */
+class AllocatorSimulator {
+	public:
+		AllocatorSimulator(Config&, uint32_t clientsCount);
+
+		void run();
+		std::string report();
+
+	private:
+		enum ClientStatus { CLIENT_ABSENT, CLIENT_ACTIVE, CLIENT_RELEASED, CLIENT_DECLINED, CLIENT_DEPARTED };
+
+		Config& config;
+		VirtualClock clock;
+		AddressesAllocator allocator;
+		TransactionsStorage transactions;
+
+		uint32_t clientsCount;
+		std::vector<uint32_t> networks;
+		std::vector<uint8_t> statuses;
+		uint32_t leaseTime;
+		uint32_t nextXid;
+		uint64_t operationsInSecond;
+
+		LatencyHistogram histograms[OPERATIONS_COUNT];
+		uint64_t failures[OPERATIONS_COUNT];
+		uint64_t peakLeases;
+		int64_t peakLeasesBytes;
+		int64_t peakTransactionsBytes;
+		int64_t poolsBytes;
+		uint64_t exhaustedAfter;
+		uint64_t reclaimed;
+
+		Client makeClient(uint32_t id);
+		void join(uint32_t firstId, uint32_t count);
+		bool discover(uint32_t id, uint32_t xid, SimulatedOperation);
+		bool request(uint32_t xid);
+		void renew(uint32_t id);
+		void release(uint32_t id);
+		void decline(uint32_t id);
+		void reboot(uint32_t id);
+		void exhaust();
+
+		void tick();
+		void advance(uint32_t seconds);
+		void sampleMemory();
+		uint64_t countLeases();
+		uint64_t countReclaims();
+		static uint64_t nowNs();
+};
+
+#endif
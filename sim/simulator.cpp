@@ -0,0 +1,32 @@
+#include "allocator_simulator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace std;
+
+int main(int argc, char** argv) {
+	if(argc < 2) {
+		fprintf(stderr, "Usage: %s config.json [clients...]\n", argv[0]);
+		return 1;
+	}
+
+	Config config(argv[1]);
+	vector<uint32_t> populations;
+	for(int i = 2; i < argc; ++i) {
+		populations.push_back(strtoul(argv[i], NULL, 10));
+	}
+	if(populations.empty()) {
+		populations.push_back(100000);
+		populations.push_back(1000000);
+		populations.push_back(10000000);
+	}
+
+	for(vector<uint32_t>::iterator it = populations.begin(); it != populations.end(); it++) {
+		AllocatorSimulator simulator(config, *it);
+		simulator.run();
+		printf("%s\n", simulator.report().c_str());
+	}
+
+	return 0;
+}
@@ -1,18 +1,58 @@
 #include "../inc/addresses_allocator.h"
+#include "../inc/stage_profiler.h"
+#include "../inc/tasks_pool.h"
+#include "../inc/tracepoints.h"
+#include "../inc/lease_times.h"
+#include <endian.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <vector>
 
 using namespace std;
 
-AddressesAllocator::AddressesAllocator(Config& configToUse):config(configToUse) {
-	const list<PoolDescriptor>& poolsDescriptors = config.getPoolsDescriptors();
+AddressesAllocator::AddressesAllocator(Config& configToUse, Clock& clockToUse):config(configToUse), clock(clockToUse), leaseListener(NULL) {
+	createPools();
+	tryToLoadCachedState();
+}
+
+/*
+ * Pools of already known networks are resized in place and keep their leases,
+ * pools which disappeared from configuration keep serving existing leases until restart.
+ */
+void AddressesAllocator::reconfigure() {
+	createPools();
+}
+
+void AddressesAllocator::createPools() {
+	const vector<PoolDescriptor>& poolsDescriptors = config.getPoolsDescriptors();
+	addressesPools.reserve(addressesPools.size() + poolsDescriptors.size());
 
-	for(list<PoolDescriptor>::const_iterator descriptorsIt = poolsDescriptors.begin(); descriptorsIt != poolsDescriptors.end(); descriptorsIt++) {
+	for(vector<PoolDescriptor>::const_iterator descriptorsIt = poolsDescriptors.begin(); descriptorsIt != poolsDescriptors.end(); descriptorsIt++) {
 		const PoolDescriptor& poolDescriptor = *descriptorsIt;
-		AddressesPool* pool = new AddressesPool(poolDescriptor);
+		uint32_t networkAddress = poolDescriptor.startAddress & poolDescriptor.networkMask;
+
+		unordered_map<uint32_t, AddressesPool*>::iterator poolIt = addressesPools.find(networkAddress);
+		if(poolIt != addressesPools.end()) {
+			poolIt->second->reconfigure(poolDescriptor);
+			continue;
+		}
 
+		AddressesPool* pool = new AddressesPool(poolDescriptor);
 		addressesPools[pool->getNetworkAddress()] = pool;
+		prepareNetwork(pool->getNetworkAddress());
 	}
 
-	tryToLoadCachedState();
+	/* Networks of served interfaces and their VLANs exist even without a pool, clients there are simply not served */
+	const vector<InterfaceDescriptor>& interfaces = config.getInterfaces();
+	for(vector<InterfaceDescriptor>::const_iterator interfacesIt = interfaces.begin(); interfacesIt != interfaces.end(); interfacesIt++) {
+		prepareNetwork(interfacesIt->networkAddress);
+		for(vector<VlanNetwork>::const_iterator vlansIt = interfacesIt->vlans.begin(); vlansIt != interfacesIt->vlans.end(); vlansIt++) {
+			prepareNetwork(vlansIt->networkAddress);
+		}
+	}
 }
 
 AddressesAllocator::~AddressesAllocator() {
@@ -21,66 +61,125 @@ AddressesAllocator::~AddressesAllocator() {
 	}
 }
 
-AllocatedAddress& AddressesAllocator::allocateAddressFor(const Client& client) {
-	uint32_t nextAddress = findNextAddr(client.networkAddress);
+AllocatedAddress* AddressesAllocator::allocateAddressFor(const Client& client) {
+	PROFILE_SCOPE(STAGE_ALLOCATE);
+	unordered_map<uint32_t, AddressesPool*>::iterator poolIt = addressesPools.find(client.networkAddress);
+	if(poolIt == addressesPools.end()) {
+		return NULL;
+	}
+
+	uint32_t nextAddress = findNextAddr(poolIt->second, client);
+	TRACE3(lease__allocate, tracedClientKey(client), client.networkAddress, nextAddress);
+	if(!nextAddress) {
+		return NULL;
+	}
 
+	markModified(client.networkAddress);
 	if(client.identificationMethod == BASED_ON_HARDWARE) {
-		return allocate(client.networkAddress, client.hardwareAddress, nextAddress);
+		return &allocate(client.networkAddress, client.hardwareAddress, nextAddress);
 	}
 	else {
-		return allocate(client.networkAddress, client.specialId, nextAddress);
+		return &allocate(client.networkAddress, client.specialId, nextAddress);
 	}
 }
 
-uint32_t AddressesAllocator::findNextAddr(uint32_t network) {
-	try {
-		return addressesPools[network]->getNext();
-	}
-	catch(runtime_error& e) {
-		return reuseOutdatedAddress(network);
+uint32_t AddressesAllocator::findNextAddr(AddressesPool* pool, const Client& client) {
+	uint32_t clientHash = pool->getDescriptor()->allocation == ALLOCATE_HASHED ? hashClient(client) : 0;
+	uint32_t address = pool->getNext(clientHash);
+
+	return address ? address : reuseOutdatedAddress(pool, clientHash);
+}
+
+/*
+ * Scanning leases of a full pool costs time proportional to its size. The scan remembers when
+ * the earliest remaining lease expires, so further requests to the exhausted pool fail at once.
+ */
+uint32_t AddressesAllocator::reuseOutdatedAddress(AddressesPool* pool, uint32_t clientHash) {
+	uint32_t network = pool->getNetworkAddress();
+	time_t now = clock.seconds();
+	time_t& nextExpiration = reclaimableAt.find(network)->second;
+	if(now < nextExpiration) {
+		return 0;
 	}
+
+	nextExpiration = numeric_limits<time_t>::max();
+	reuseOutdatedAddress(pool, getAddressesInNetwork(allocatedByHardware, network), now, nextExpiration);
+	reuseOutdatedAddress(pool, getAddressesInNetwork(allocatedBySpecialId, network), now, nextExpiration);
+
+	return pool->getNext(clientHash);
 }
 
-uint32_t AddressesAllocator::reuseOutdatedAddress(uint32_t network) {
-	AddressesPool* pool = addressesPools[network];
-	reuseOutdatedAddress(pool, allocatedByHardware[network]);
-	reuseOutdatedAddress(pool, allocatedBySpecialId[network]);
+/*
+ * FNV-1a of the client key without trailing zero padding. Depends only on the key bytes,
+ * so every server instance and every restart computes the same preferred address.
+ */
+uint32_t AddressesAllocator::hashClient(const Client& client) {
+	const uint8_t* key;
+	size_t length;
+	uint32_t hash = 2166136261u;
+	if(client.identificationMethod == BASED_ON_HARDWARE) {
+		hash = (hash ^ client.hardwareAddress.addressType) * 16777619u;
+		key = client.hardwareAddress.hardwareAddress;
+		length = MAX_HADDR_SIZE;
+	}
+	else {
+		hash = (hash ^ client.specialId.type) * 16777619u;
+		key = client.specialId.value;
+		length = CLIENT_SPECIAL_ID_MAX_LEN;
+	}
+
+	while(length > 0 && key[length - 1] == 0) {
+		--length;
+	}
+	for(size_t i = 0; i < length; ++i) {
+		hash = (hash ^ key[i]) * 16777619u;
+	}
 
-	return pool->getNext();
+	return hash;
 }
 
-template <class T> void AddressesAllocator::reuseOutdatedAddress(AddressesPool* pool, std::map<T, AllocatedAddress>& addresses) {
-	for(typename map<T, AllocatedAddress>::const_iterator it = addresses.begin(); it != addresses.end(); it++) {
+template <class T> void AddressesAllocator::reuseOutdatedAddress(AddressesPool* pool, LeasesMap<T>& addresses, time_t now, time_t& nextExpiration) {
+	for(typename LeasesMap<T>::iterator it = addresses.begin(); it != addresses.end();) {
 		const AllocatedAddress& allocatedAddress = it->second;
-		if(time(NULL) - allocatedAddress.allocationTime > allocatedAddress.leaseTime) {
-			pool->abandon(allocatedAddress.ipAddress);
-			addresses.erase(it);
+		time_t expiration = allocatedAddress.allocationTime + allocatedAddress.leaseTime + 1;
+		if(now >= expiration) {
+			pool->reclaim(allocatedAddress.ipAddress);
+			TRACE3(lease__reclaim, tracedClientKey(it->first), pool->getNetworkAddress(), allocatedAddress.ipAddress);
+			notifyRemoved(pool->getNetworkAddress(), it->first, allocatedAddress.ipAddress, true);
+			it = addresses.erase(it);
+		}
+		else {
+			nextExpiration = min(nextExpiration, expiration);
+			it++;
 		}
 	}
 }
 
 AllocatedAddress& AddressesAllocator::allocate(const uint32_t networkAddress, const HardwareAddress& hardwareAddress, const uint32_t ip) {
-	AllocatedAddress& allocatedAddress = allocatedByHardware[networkAddress][hardwareAddress];
+	AllocatedAddress& allocatedAddress = getAddressesInNetwork(allocatedByHardware, networkAddress)[hardwareAddress];
 	fillAddress(networkAddress, ip, allocatedAddress);
+	notifyUpdated(networkAddress, hardwareAddress, allocatedAddress);
 
 	return allocatedAddress;
 }
 
 AllocatedAddress& AddressesAllocator::allocate(const uint32_t networkAddress, const ClientSpecialId& specialId, const uint32_t ip) {
-	AllocatedAddress& allocatedAddress = allocatedBySpecialId[networkAddress][specialId];
+	AllocatedAddress& allocatedAddress = getAddressesInNetwork(allocatedBySpecialId, networkAddress)[specialId];
 	fillAddress(networkAddress, ip, allocatedAddress);
+	notifyUpdated(networkAddress, specialId, allocatedAddress);
 
 	return allocatedAddress;
 }
 
 void AddressesAllocator::fillAddress(uint32_t networkAddress, uint32_t ip, AllocatedAddress& allocatedAddress) {
-	const PoolDescriptor& poolDescriptor = addressesPools[networkAddress]->descriptor;
+	fillAddress(getPool(networkAddress)->getDescriptor(), ip, allocatedAddress);
+}
+
+void AddressesAllocator::fillAddress(const shared_ptr<const PoolDescriptor>& poolDescriptor, uint32_t ip, AllocatedAddress& allocatedAddress) {
 	allocatedAddress.ipAddress = ip;
-	allocatedAddress.mask = poolDescriptor.networkMask;
-	allocatedAddress.dnsServers = poolDescriptor.dnsServers;
-	allocatedAddress.routers = poolDescriptor.routers;
-	allocatedAddress.leaseTime = poolDescriptor.leaseTime;
-	allocatedAddress.allocationTime = time(NULL);
+	allocatedAddress.descriptor = poolDescriptor;
+	allocatedAddress.leaseTime = LeaseTimes::leaseTime(*poolDescriptor, ip);
+	allocatedAddress.allocationTime = clock.seconds();
 }
 
 uint32_t AddressesAllocator::determineClientNetwork(uint32_t giaddr) {
@@ -100,141 +199,491 @@ uint32_t AddressesAllocator::matchNetworkToAddress(uint32_t address) {
 }
 
 bool AddressesAllocator::hasClientAllocatedAddress(const Client& client) {
+	PROFILE_SCOPE(STAGE_LOOKUP);
 	if(client.identificationMethod == BASED_ON_HARDWARE) {
 		return allocatedByHardware.find(client.networkAddress) != allocatedByHardware.end() 
-				&& allocatedByHardware[client.networkAddress].find(client.hardwareAddress) != allocatedByHardware[client.networkAddress].end();
+				&& getAddressesInNetwork(allocatedByHardware, client.networkAddress).count(client.hardwareAddress) > 0;
 	}
 	else {
 		return allocatedBySpecialId.find(client.networkAddress) != allocatedBySpecialId.end() 
-				&& allocatedBySpecialId[client.networkAddress].find(client.specialId) != allocatedBySpecialId[client.networkAddress].end();
+				&& getAddressesInNetwork(allocatedBySpecialId, client.networkAddress).count(client.specialId) > 0;
 	}
 }
 
 void AddressesAllocator::freeClientAddress(const Client& client) {
+	PROFILE_SCOPE(STAGE_ALLOCATE);
 	if(hasClientAllocatedAddress(client)) {
-		uint32_t freedIpAddress = (client.identificationMethod == BASED_ON_HARDWARE) ? free(client.networkAddress, client.hardwareAddress) 
-			: free(client.networkAddress, client.specialId);
-		addressesPools[client.networkAddress]->abandon(freedIpAddress);
+		markModified(client.networkAddress);
+		uint32_t freedIpAddress = (client.identificationMethod == BASED_ON_HARDWARE) ? free(client.networkAddress, client.hardwareAddress, true) 
+			: free(client.networkAddress, client.specialId, true);
+		getPool(client.networkAddress)->abandon(freedIpAddress);
 	}
 }
 
-uint32_t AddressesAllocator::free(uint32_t networkAddress, const HardwareAddress& hardwareAddress) {
-	uint32_t freedAddress = allocatedByHardware[networkAddress][hardwareAddress].ipAddress;
-	allocatedByHardware[networkAddress].erase(hardwareAddress);
+uint32_t AddressesAllocator::free(uint32_t networkAddress, const HardwareAddress& hardwareAddress, bool reusable) {
+	LeasesMap<HardwareAddress>& addressesInNetwork = getAddressesInNetwork(allocatedByHardware, networkAddress);
+	uint32_t freedAddress = addressesInNetwork[hardwareAddress].ipAddress;
+	addressesInNetwork.erase(hardwareAddress);
+	TRACE4(lease__free, tracedClientKey(hardwareAddress), networkAddress, freedAddress, (int)reusable);
+	notifyRemoved(networkAddress, hardwareAddress, freedAddress, reusable);
 
 	return freedAddress;
 }
 
-uint32_t AddressesAllocator::free(uint32_t networkAddress, const ClientSpecialId& specialId) {
-	uint32_t freedAddress = allocatedBySpecialId[networkAddress][specialId].ipAddress;
-	allocatedBySpecialId[networkAddress].erase(specialId);
+uint32_t AddressesAllocator::free(uint32_t networkAddress, const ClientSpecialId& specialId, bool reusable) {
+	LeasesMap<ClientSpecialId>& addressesInNetwork = getAddressesInNetwork(allocatedBySpecialId, networkAddress);
+	uint32_t freedAddress = addressesInNetwork[specialId].ipAddress;
+	addressesInNetwork.erase(specialId);
+	TRACE4(lease__free, tracedClientKey(specialId), networkAddress, freedAddress, (int)reusable);
+	notifyRemoved(networkAddress, specialId, freedAddress, reusable);
 
 	return freedAddress;
 }
 
 AllocatedAddress& AddressesAllocator::getAllocatedAddress(const Client& client) {
+	PROFILE_SCOPE(STAGE_LOOKUP);
 	if(client.identificationMethod == BASED_ON_HARDWARE) {
-		return allocatedByHardware[client.networkAddress][client.hardwareAddress];
+		return getAddressesInNetwork(allocatedByHardware, client.networkAddress)[client.hardwareAddress];
 	}
 	else {
-		return allocatedBySpecialId[client.networkAddress][client.specialId];
+		return getAddressesInNetwork(allocatedBySpecialId, client.networkAddress)[client.specialId];
 	}
 }
 
 
 void AddressesAllocator::freeClientAddressButLeaveUnavailable(const Client& client) {
+	PROFILE_SCOPE(STAGE_ALLOCATE);
 	if(hasClientAllocatedAddress(client)) {
-		(client.identificationMethod == BASED_ON_HARDWARE) ? free(client.networkAddress, client.hardwareAddress) : free(client.networkAddress, client.specialId);
+		markModified(client.networkAddress);
+		uint32_t declinedIpAddress = (client.identificationMethod == BASED_ON_HARDWARE) ? free(client.networkAddress, client.hardwareAddress, false)
+			: free(client.networkAddress, client.specialId, false);
+		getPool(client.networkAddress)->quarantine(declinedIpAddress);
 	}
 }
 
 void AddressesAllocator::softDelete(const Client& client) {
+	PROFILE_SCOPE(STAGE_ALLOCATE);
 	if(hasClientAllocatedAddress(client)) {
+		markModified(client.networkAddress);
 		AllocatedAddress& allocatedAddress = getAllocatedAddress(client);
 		allocatedAddress.allocationTime -= allocatedAddress.leaseTime;
+		notifyUpdated(client, allocatedAddress);
 	}
 }
 
 AllocatedAddress& AddressesAllocator::refreshLeaseTime(const Client& client) {
+	PROFILE_SCOPE(STAGE_ALLOCATE);
+	markModified(client.networkAddress);
 	AllocatedAddress& allocatedAddress = getAllocatedAddress(client);
-	allocatedAddress.allocationTime = time(NULL);
+	fillAddress(client.networkAddress, allocatedAddress.ipAddress, allocatedAddress);
+	TRACE3(lease__refresh, tracedClientKey(client), client.networkAddress, allocatedAddress.ipAddress);
+	notifyUpdated(client, allocatedAddress);
 
 	return allocatedAddress;
 }
 
-void AddressesAllocator::saveState() {
-	StateSerializer serializer(config.getCacheFile());
+const unordered_map<uint32_t, AddressesPool*>& AddressesAllocator::getPools() {
+	return addressesPools;
+}
 
-	saveAllocatedAddresses(serializer, allocatedByHardware);
-	saveAllocatedAddresses(serializer, allocatedBySpecialId);
+void AddressesAllocator::setLeaseListener(LeaseListener* listener) {
+	leaseListener = listener;
+}
 
-	saveAddressesPools(serializer);
+void AddressesAllocator::notifyUpdated(const Client& client, const AllocatedAddress& allocatedAddress) {
+	if(client.identificationMethod == BASED_ON_HARDWARE) {
+		notifyUpdated(client.networkAddress, client.hardwareAddress, allocatedAddress);
+	}
+	else {
+		notifyUpdated(client.networkAddress, client.specialId, allocatedAddress);
+	}
+}
+
+template <class T> void AddressesAllocator::notifyUpdated(uint32_t networkAddress, const T& clientId, const AllocatedAddress& allocatedAddress) {
+	noteExpiration(networkAddress, allocatedAddress);
+	if(leaseListener != NULL) {
+		leaseListener->onLeaseUpdated(networkAddress, clientId, allocatedAddress);
+	}
+}
+
+template <class T> void AddressesAllocator::notifyRemoved(uint32_t networkAddress, const T& clientId, uint32_t ipAddress, bool reusable) {
+	if(leaseListener != NULL) {
+		leaseListener->onLeaseRemoved(networkAddress, clientId, ipAddress, reusable);
+	}
 }
 
-template <class T> void AddressesAllocator::saveAllocatedAddresses(StateSerializer& serializer, map<uint32_t, map<T, AllocatedAddress> >& addresses) {
-	serializer.serialize(addresses.size());
-	for(typename map<uint32_t, map<T, AllocatedAddress> >::const_iterator it = addresses.begin(); it != addresses.end(); it++) {
-		serializer.serialize(it->first);
+/* New or shortened lease may expire before the time remembered by the last reclaim scan */
+void AddressesAllocator::noteExpiration(uint32_t networkAddress, const AllocatedAddress& allocatedAddress) {
+	unordered_map<uint32_t, time_t>::iterator reclaimableIt = reclaimableAt.find(networkAddress);
+	if(reclaimableIt != reclaimableAt.end()) {
+		reclaimableIt->second = min(reclaimableIt->second, allocatedAddress.allocationTime + (time_t)allocatedAddress.leaseTime + 1);
+	}
+}
 
-		const map<T, AllocatedAddress>& allocatedInNetwork = it->second;
-		serializer.serialize(allocatedInNetwork.size());
+void AddressesAllocator::replayLeases(LeaseListener& listener) {
+	replayLeases(listener, allocatedByHardware);
+	replayLeases(listener, allocatedBySpecialId);
+}
 
-		for(typename map<T, AllocatedAddress>::const_iterator it = allocatedInNetwork.begin(); it != allocatedInNetwork.end(); it++) {
-			serializer.serialize(it->first);
-			serializer.serialize(it->second);
+template <class T> void AddressesAllocator::replayLeases(LeaseListener& listener, map<uint32_t, LeasesMap<T> >& addresses) {
+	for(typename map<uint32_t, LeasesMap<T> >::const_iterator networkIt = addresses.begin(); networkIt != addresses.end(); networkIt++) {
+		const LeasesMap<T>& allocatedInNetwork = networkIt->second;
+		for(typename LeasesMap<T>::const_iterator it = allocatedInNetwork.begin(); it != allocatedInNetwork.end(); it++) {
+			listener.onLeaseUpdated(networkIt->first, it->first, it->second);
 		}
 	}
 }
 
-void AddressesAllocator::saveAddressesPools(StateSerializer& serializer) {
-	serializer.serialize(addressesPools.size());
-	for(unordered_map<uint32_t, AddressesPool*>::const_iterator it = addressesPools.begin(); it != addressesPools.end(); it++) {
-		serializer.serialize(it->first);
-		serializer.serialize(*it->second);
+void AddressesAllocator::replayLeases(LeaseListener& listener, uint32_t networkAddress) {
+	replayLeases(listener, networkAddress, allocatedByHardware);
+	replayLeases(listener, networkAddress, allocatedBySpecialId);
+}
+
+template <class T> void AddressesAllocator::replayLeases(LeaseListener& listener, uint32_t networkAddress, map<uint32_t, LeasesMap<T> >& addresses) {
+	typename map<uint32_t, LeasesMap<T> >::const_iterator networkIt = addresses.find(networkAddress);
+	if(networkIt == addresses.end()) {
+		return;
 	}
+
+	for(typename LeasesMap<T>::const_iterator it = networkIt->second.begin(); it != networkIt->second.end(); it++) {
+		listener.onLeaseUpdated(networkAddress, it->first, it->second);
+	}
+}
+
+void AddressesAllocator::restoreLease(uint32_t networkAddress, const HardwareAddress& hardwareAddress, const AllocatedAddress& allocatedAddress) {
+	restoreLease(networkAddress, hardwareAddress, allocatedAddress, allocatedByHardware);
+}
+
+void AddressesAllocator::restoreLease(uint32_t networkAddress, const ClientSpecialId& specialId, const AllocatedAddress& allocatedAddress) {
+	restoreLease(networkAddress, specialId, allocatedAddress, allocatedBySpecialId);
 }
 
+template <class T> void AddressesAllocator::restoreLease(uint32_t networkAddress, const T& clientId, const AllocatedAddress& restored, map<uint32_t, LeasesMap<T> >& addresses) {
+	unordered_map<uint32_t, AddressesPool*>::iterator poolIt = addressesPools.find(networkAddress);
+	if(poolIt == addressesPools.end()) {
+		return;
+	}
+	AddressesPool* pool = poolIt->second;
+	LeasesMap<T>& addressesInNetwork = getAddressesInNetwork(addresses, networkAddress);
+
+	typename LeasesMap<T>::iterator existingIt = addressesInNetwork.find(clientId);
+	if(existingIt != addressesInNetwork.end() && existingIt->second.ipAddress != restored.ipAddress) {
+		pool->abandon(existingIt->second.ipAddress);
+	}
+
+	AllocatedAddress& allocatedAddress = addressesInNetwork[clientId];
+	fillAddress(pool->getDescriptor(), restored.ipAddress, allocatedAddress);
+	allocatedAddress.leaseTime = restored.leaseTime;
+	allocatedAddress.allocationTime = restored.allocationTime;
+
+	pool->reserve(restored.ipAddress);
+	noteExpiration(networkAddress, allocatedAddress);
+	markModified(networkAddress);
+}
+
+void AddressesAllocator::removeLease(uint32_t networkAddress, const HardwareAddress& hardwareAddress, bool reusable) {
+	removeLease(networkAddress, hardwareAddress, reusable, allocatedByHardware);
+}
+
+void AddressesAllocator::removeLease(uint32_t networkAddress, const ClientSpecialId& specialId, bool reusable) {
+	removeLease(networkAddress, specialId, reusable, allocatedBySpecialId);
+}
+
+template <class T> void AddressesAllocator::removeLease(uint32_t networkAddress, const T& clientId, bool reusable, map<uint32_t, LeasesMap<T> >& addresses) {
+	unordered_map<uint32_t, AddressesPool*>::iterator poolIt = addressesPools.find(networkAddress);
+	if(poolIt == addressesPools.end()) {
+		return;
+	}
+	LeasesMap<T>& addressesInNetwork = getAddressesInNetwork(addresses, networkAddress);
+
+	typename LeasesMap<T>::iterator existingIt = addressesInNetwork.find(clientId);
+	if(existingIt != addressesInNetwork.end()) {
+		if(reusable) {
+			poolIt->second->abandon(existingIt->second.ipAddress);
+		}
+		else {
+			poolIt->second->quarantine(existingIt->second.ipAddress);
+		}
+		addressesInNetwork.erase(existingIt);
+		markModified(networkAddress);
+	}
+}
+
+void AddressesAllocator::clearLeases() {
+	for(unordered_map<uint32_t, AddressesPool*>::iterator poolsIt = addressesPools.begin(); poolsIt != addressesPools.end(); poolsIt++) {
+		uint32_t networkAddress = poolsIt->first;
+		poolsIt->second->reset();
+		getAddressesInNetwork(allocatedByHardware, networkAddress).clear();
+		getAddressesInNetwork(allocatedBySpecialId, networkAddress).clear();
+		markModified(networkAddress);
+	}
+}
+
+/*
+ * Per network structures are created up front and later only looked up, so threads
+ * owning different networks never modify shared containers. Called again on reconfigure,
+ * state of a known network is left as is, so unsaved leases stay marked.
+ */
+void AddressesAllocator::prepareNetwork(uint32_t networkAddress) {
+	allocatedByHardware[networkAddress];
+	allocatedBySpecialId[networkAddress];
+	modifiedNetworks.insert(make_pair(networkAddress, false));
+	reclaimableAt.insert(make_pair(networkAddress, (time_t)0));
+}
+
+AddressesPool* AddressesAllocator::getPool(uint32_t networkAddress) {
+	unordered_map<uint32_t, AddressesPool*>::iterator poolIt = addressesPools.find(networkAddress);
+	if(poolIt == addressesPools.end()) {
+		throw runtime_error("There is no pool for given network");
+	}
+	return poolIt->second;
+}
+
+template <class T> LeasesMap<T>& AddressesAllocator::getAddressesInNetwork(map<uint32_t, LeasesMap<T> >& addresses, uint32_t networkAddress) {
+	return addresses.find(networkAddress)->second;
+}
+
+void AddressesAllocator::markModified(uint32_t networkAddress) {
+	unordered_map<uint32_t, bool>::iterator modifiedIt = modifiedNetworks.find(networkAddress);
+	if(modifiedIt != modifiedNetworks.end()) {
+		modifiedIt->second = true;
+	}
+}
+
+string AddressesAllocator::getPartitionFilePath(uint32_t networkAddress) {
+	struct in_addr address;
+	address.s_addr = htonl(networkAddress);
+
+	char networkString[INET_ADDRSTRLEN] = {0};
+	inet_ntop(AF_INET, &address, networkString, sizeof(networkString));
+
+	return string(config.getCacheFile()) + "." + networkString;
+}
+
+/*
+ * Every network is persisted to its own partition file and only networks modified
+ * since the last save are written. Partitions are independent, so they are written in parallel
+ * while the maps stay untouched by the caller.
+ */
+void AddressesAllocator::saveState() {
+	vector<uint32_t> networks;
+	for(unordered_map<uint32_t, bool>::iterator it = modifiedNetworks.begin(); it != modifiedNetworks.end(); it++) {
+		if(it->second) {
+			networks.push_back(it->first);
+		}
+	}
+	vector<char> saved(networks.size(), 0);
+	TRACE1(snapshot__start, networks.size());
+
+	vector<function<void()> > tasks;
+	for(size_t i = 0; i < networks.size(); ++i) {
+		tasks.push_back([this, &networks, &saved, i]() {
+			savePartition(networks[i]);
+			saved[i] = 1;
+		});
+	}
+
+	try {
+		TasksPool(config.getPersistenceThreads()).run(tasks);
+	}
+	catch(...) {
+		for(size_t i = 0; i < networks.size(); ++i) {
+			modifiedNetworks[networks[i]] = !saved[i];
+		}
+		TRACE2(snapshot__end, networks.size(), count(saved.begin(), saved.end(), 1));
+		throw;
+	}
+	for(size_t i = 0; i < networks.size(); ++i) {
+		modifiedNetworks[networks[i]] = false;
+	}
+	TRACE2(snapshot__end, networks.size(), networks.size());
+}
+
+void AddressesAllocator::savePartition(uint32_t networkAddress) {
+	StateSerializer serializer(getPartitionFilePath(networkAddress).c_str());
+
+	saveAllocatedAddresses(serializer, networkAddress, allocatedByHardware);
+	saveAllocatedAddresses(serializer, networkAddress, allocatedBySpecialId);
+
+	unordered_map<uint32_t, AddressesPool*>::const_iterator poolIt = addressesPools.find(networkAddress);
+	if(poolIt != addressesPools.end()) {
+		serializer.serialize(*poolIt->second);
+	}
+	serializer.commit();
+}
+
+template <class T> void AddressesAllocator::saveAllocatedAddresses(StateSerializer& serializer, uint32_t networkAddress, map<uint32_t, LeasesMap<T> >& addresses) {
+	typename map<uint32_t, LeasesMap<T> >::const_iterator networkIt = addresses.find(networkAddress);
+	if(networkIt == addresses.end()) {
+		return;
+	}
+
+	const LeasesMap<T>& allocatedInNetwork = networkIt->second;
+	for(typename LeasesMap<T>::const_iterator it = allocatedInNetwork.begin(); it != allocatedInNetwork.end(); it++) {
+		serializer.serialize(networkAddress, it->first, it->second);
+	}
+}
+
+/* Every loader thread touches only structures of the partition it is loading */
 void AddressesAllocator::tryToLoadCachedState() {
-	if(StateDeserializer::cacheExists(config.getCacheFile())) {
-		StateDeserializer deserializer(config.getCacheFile());
+	vector<function<void()> > tasks;
+	for(unordered_map<uint32_t, AddressesPool*>::iterator poolsIt = addressesPools.begin(); poolsIt != addressesPools.end(); poolsIt++) {
+		uint32_t networkAddress = poolsIt->first;
+		tasks.push_back(bind(&AddressesAllocator::loadPartition, this, networkAddress));
+	}
 
-		loadAllocatedAddresses(deserializer, allocatedByHardware);
-		loadAllocatedAddresses(deserializer, allocatedBySpecialId);
+	TasksPool(config.getPersistenceThreads()).run(tasks);
+	importLegacyCache();
+}
+
+void AddressesAllocator::loadPartition(uint32_t networkAddress) {
+	string partitionFilePath = getPartitionFilePath(networkAddress);
+	if(!StateDeserializer::cacheExists(partitionFilePath.c_str())) {
+		return;
+	}
 
-		loadAddressesPools(deserializer);
+	StateDeserializer deserializer(partitionFilePath.c_str());
+	if(!deserializer.isValid()) {
+		return;
 	}
+
+	AddressesPool* pool = addressesPools.find(networkAddress)->second;
+	loadAddressesPool(deserializer, pool);
+
+	time_t now = clock.seconds();
+	loadAllocatedAddresses<HardwareLeaseRecord>(deserializer, pool, allocatedByHardware.find(networkAddress)->second, now);
+	loadAllocatedAddresses<SpecialIdLeaseRecord>(deserializer, pool, allocatedBySpecialId.find(networkAddress)->second, now);
+	pool->recountQuarantined(allocatedByHardware.find(networkAddress)->second.size() + allocatedBySpecialId.find(networkAddress)->second.size());
 }
 
-template <class T> void AddressesAllocator::loadAllocatedAddresses(StateDeserializer& deserializer, map<uint32_t, map<T, AllocatedAddress> >& addresses) {
-	uint32_t networksCount = 0;
-	deserializer.deserialize(&networksCount);
-	for(unsigned networkIdx = 0; networkIdx < networksCount; ++networkIdx) {
-		uint32_t networkAddress = 0;
-		deserializer.deserialize(&networkAddress);
+/*
+ * Records are stored in map order, so every insert lands at the end of the network map
+ * and the hinted emplace costs amortized constant time. Leases which expired while
+ * the server was down are returned to the pool instead of being loaded.
+ */
+template <class R, class T> void AddressesAllocator::loadAllocatedAddresses(StateDeserializer& deserializer, AddressesPool* pool, LeasesMap<T>& addressesInNetwork, time_t now) {
+	const R* records = NULL;
+	size_t recordsCount = deserializer.getRecords(&records);
+
+	for(size_t i = 0; i < recordsCount; ++i) {
+		AllocatedAddress allocatedAddress;
+		uint32_t networkAddress = StateDeserializer::deserialize(records[i].lease, &allocatedAddress);
+
+		if(networkAddress != pool->getNetworkAddress()) {
+			continue;
+		}
+		if(now - allocatedAddress.allocationTime > allocatedAddress.leaseTime) {
+			pool->abandon(allocatedAddress.ipAddress);
+			continue;
+		}
+
+		T clientId;
+		StateDeserializer::deserialize(records[i], &clientId);
 
-		map<T, AllocatedAddress>& addressesInNetwork = addresses[networkAddress];
-		uint32_t numberOfAddressesInNetwork = 0;
-		deserializer.deserialize(&numberOfAddressesInNetwork);
+		uint32_t leaseTime = allocatedAddress.leaseTime;
+		time_t allocationTime = allocatedAddress.allocationTime;
+		fillAddress(pool->getDescriptor(), allocatedAddress.ipAddress, allocatedAddress);
+		allocatedAddress.leaseTime = leaseTime;
+		allocatedAddress.allocationTime = allocationTime;
 
-		for(unsigned addressIdx = 0; addressIdx < numberOfAddressesInNetwork; ++addressIdx) {
-			T clientId;
-			AllocatedAddress allocatedAddress;
+		pool->reserve(allocatedAddress.ipAddress);
+		addressesInNetwork.emplace_hint(addressesInNetwork.end(), clientId, allocatedAddress);
+	}
+}
+
+/*
+ * Cache of older versions is read once: only networks without a lease file take leases from it,
+ * they are saved in the new format right away and the old file is renamed, so it is not read again.
+ */
+void AddressesAllocator::importLegacyCache() {
+	const char* legacyPath = config.getCacheFile();
+	if(!StateDeserializer::cacheExists(legacyPath)) {
+		return;
+	}
 
-			deserializer.deserialize(&clientId);
-			deserializer.deserialize(&allocatedAddress);
+	LegacyStateDeserializer legacy(legacyPath);
+	if(!legacy.isValid()) {
+		fprintf(stderr, "Cache file %s is not a lease cache of an older version, its leases are ignored\n", legacyPath);
+		return;
+	}
 
-			addressesInNetwork[clientId] = allocatedAddress;
+	unordered_set<uint32_t> networks;
+	for(unordered_map<uint32_t, AddressesPool*>::iterator poolsIt = addressesPools.begin(); poolsIt != addressesPools.end(); poolsIt++) {
+		if(!StateDeserializer::cacheExists(getPartitionFilePath(poolsIt->first).c_str())) {
+			networks.insert(poolsIt->first);
 		}
 	}
+
+	const vector<LegacyPool>& pools = legacy.getPools();
+	for(vector<LegacyPool>::const_iterator it = pools.begin(); it != pools.end(); it++) {
+		if(networks.find(it->networkAddress) == networks.end()) {
+			continue;
+		}
+		AddressesPool* pool = addressesPools.find(it->networkAddress)->second;
+		pool->restore(it->nextToAssign);
+		for(vector<uint32_t>::const_iterator abandonedIt = it->abandonedAddresses.begin(); abandonedIt != it->abandonedAddresses.end(); abandonedIt++) {
+			pool->abandon(*abandonedIt);
+		}
+	}
+
+	time_t now = clock.seconds();
+	size_t imported = importLegacyLeases(legacy.getHardwareLeases(), networks, allocatedByHardware, now)
+		+ importLegacyLeases(legacy.getSpecialIdLeases(), networks, allocatedBySpecialId, now);
+	for(unordered_set<uint32_t>::iterator it = networks.begin(); it != networks.end(); it++) {
+		addressesPools.find(*it)->second->recountQuarantined(allocatedByHardware.find(*it)->second.size() + allocatedBySpecialId.find(*it)->second.size());
+		markModified(*it);
+	}
+
+	try {
+		saveState();
+	}
+	catch(runtime_error& e) {
+		fprintf(stderr, "Could not save %zu leases imported from legacy cache file %s, it will be read again: %s\n", imported, legacyPath, e.what());
+		return;
+	}
+
+	string importedPath = string(legacyPath) + ".imported";
+	rename(legacyPath, importedPath.c_str());
+	fprintf(stderr, "Imported %zu leases from legacy cache file %s, moved it to %s\n", imported, legacyPath, importedPath.c_str());
 }
 
-void AddressesAllocator::loadAddressesPools(StateDeserializer& deserializer) {
-	uint32_t numberOfPools = 0;
-	deserializer.deserialize(&numberOfPools);
+/* Leases which expired while the server was down are returned to the pool, like when loading a lease file */
+template <class T> size_t AddressesAllocator::importLegacyLeases(const vector<LegacyLease<T> >& leases, const unordered_set<uint32_t>& networks, map<uint32_t, LeasesMap<T> >& addresses, time_t now) {
+	size_t imported = 0;
+	for(typename vector<LegacyLease<T> >::const_iterator it = leases.begin(); it != leases.end(); it++) {
+		if(networks.find(it->networkAddress) == networks.end()) {
+			continue;
+		}
+		if(now - it->allocationTime > it->leaseTime) {
+			addressesPools.find(it->networkAddress)->second->abandon(it->ipAddress);
+			continue;
+		}
+
+		AllocatedAddress allocatedAddress;
+		allocatedAddress.ipAddress = it->ipAddress;
+		allocatedAddress.leaseTime = it->leaseTime;
+		allocatedAddress.allocationTime = it->allocationTime;
+		restoreLease(it->networkAddress, it->clientId, allocatedAddress, addresses);
+		++imported;
+	}
+
+	return imported;
+}
 
-	for(unsigned i = 0; i < numberOfPools; ++i) {
-		uint32_t network = 0;
-		deserializer.deserialize(&network);
-		deserializer.deserialize(addressesPools[network]);
+void AddressesAllocator::loadAddressesPool(StateDeserializer& deserializer, AddressesPool* pool) {
+	const PoolRecord* pools = NULL;
+	size_t poolsCount = deserializer.getRecords(&pools);
+	for(size_t i = 0; i < poolsCount; ++i) {
+		if(le32toh(pools[i].networkAddress) == pool->getNetworkAddress()) {
+			pool->restore(le32toh(pools[i].nextToAssign));
+		}
+	}
+
+	const AbandonedAddressRecord* abandoned = NULL;
+	size_t abandonedCount = deserializer.getRecords(&abandoned);
+	for(size_t i = 0; i < abandonedCount; ++i) {
+		if(le32toh(abandoned[i].networkAddress) == pool->getNetworkAddress()) {
+			pool->abandon(le32toh(abandoned[i].address));
+		}
 	}
 }
@@ -4,43 +4,291 @@
 #include <arpa/inet.h>
 #include <time.h>
 #include <string>
-#include <stdexcept>
+#include <algorithm>
 
 using namespace std;
 
-AddressesPool::AddressesPool(const PoolDescriptor& poolDescriptor): descriptor(poolDescriptor) {
-	nextToAssign = descriptor.startAddress;
-	networkAddress = calculateNetworkAddress(descriptor.startAddress, descriptor.networkMask);
+AddressesPool::AddressesPool(const PoolDescriptor& poolDescriptor): descriptor(new PoolDescriptor(poolDescriptor)),
+	usedCount(0), quarantinedCount(0), allocationsCount(0), reclaimsCount(0) {
+	nextToAssign = descriptor->startAddress;
+	networkAddress = calculateNetworkAddress(descriptor->startAddress, descriptor->networkMask);
+	if(isHashed()) {
+		usedAddresses.assign((getSize() + 63) / 64, 0);
+	}
+	publish();
+}
+
+void AddressesPool::reconfigure(const PoolDescriptor& poolDescriptor) {
+	shared_ptr<const PoolDescriptor> previous = descriptor;
+	uint32_t previousStart = descriptor->startAddress;
+	descriptor = std::make_shared<const PoolDescriptor>(poolDescriptor);
+
+	if(previous->allocation == ALLOCATE_HASHED || isHashed()) {
+		bool sameRange = previous->startAddress == descriptor->startAddress && previous->endAddress == descriptor->endAddress;
+		if(!(sameRange && previous->allocation == descriptor->allocation)) {
+			TrackedVector<uint64_t, MEMORY_POOLS> previousUsed;
+			previousUsed.swap(usedAddresses);
+			convert(*previous, previousUsed);
+		}
+		publish();
+		return;
+	}
+
+	for(TrackedUnorderedSet<uint32_t, MEMORY_POOLS>::iterator it = abandonedAddresses.begin(); it != abandonedAddresses.end();) {
+		it = isInRange(*it) ? ++it : abandonedAddresses.erase(it);
+	}
+
+	/* Addresses prepended to the range were never assigned */
+	for(uint32_t address = descriptor->startAddress; address < previousStart && address < nextToAssign && address <= descriptor->endAddress; ++address) {
+		abandonedAddresses.insert(address);
+	}
+
+	/* Never lowered on shrink, addresses above new end may still be leased when range grows again */
+	if(nextToAssign < descriptor->startAddress) {
+		nextToAssign = descriptor->startAddress;
+	}
+	publish();
+}
+
+const std::shared_ptr<const PoolDescriptor>& AddressesPool::getDescriptor() {
+	return descriptor;
+}
+
+bool AddressesPool::isInRange(uint32_t address) {
+	return address >= descriptor->startAddress && address <= descriptor->endAddress;
 }
 
 bool AddressesPool::mayContain(uint32_t address) {
-	return calculateNetworkAddress(address, descriptor.networkMask) == networkAddress;
+	return calculateNetworkAddress(address, descriptor->networkMask) == networkAddress;
 }
 
 uint32_t AddressesPool::calculateNetworkAddress(uint32_t address, uint32_t mask) {
 	return (address & mask);
 }
 
-uint32_t AddressesPool::getNext() {
-	uint32_t address = findAbandonedAddress();
-	abandonedAddresses.erase(address);
+/*
+ * Hashed pools and pools switching strategy are rebuilt address by address from the previous state,
+ * addresses outside of the new range are left out like in sequential pools.
+ */
+void AddressesPool::convert(const PoolDescriptor& previous, TrackedVector<uint64_t, MEMORY_POOLS>& previousUsed) {
+	auto wasUsed = [&](uint32_t address) {
+		if(address < previous.startAddress || address > previous.endAddress) {
+			return false;
+		}
+		if(previous.allocation == ALLOCATE_HASHED) {
+			uint32_t offset = address - previous.startAddress;
+			return ((previousUsed[offset >> 6] >> (offset & 63)) & 1) != 0;
+		}
+		return address < nextToAssign && abandonedAddresses.find(address) == abandonedAddresses.end();
+	};
+
+	uint64_t first = max(descriptor->startAddress, previous.startAddress);
+	uint64_t last = min(descriptor->endAddress, previous.endAddress);
+	if(isHashed()) {
+		usedAddresses.assign((getSize() + 63) / 64, 0);
+		usedCount = 0;
+		for(uint64_t address = first; address <= last; ++address) {
+			if(wasUsed(address)) {
+				setUsed(address, true);
+			}
+		}
+		abandonedAddresses.clear();
+		nextToAssign = descriptor->startAddress;
+		return;
+	}
 
-	return address ? address : generateFreshAddress();
+	/* Back to sequential: everything up to the last used address counts as assigned */
+	uint64_t next = descriptor->startAddress;
+	for(uint64_t address = first; address <= last; ++address) {
+		if(wasUsed(address)) {
+			next = address + 1;
+		}
+	}
+	abandonedAddresses.clear();
+	for(uint64_t address = descriptor->startAddress; address < next; ++address) {
+		if(!wasUsed(address)) {
+			abandonedAddresses.insert(address);
+		}
+	}
+	nextToAssign = next;
+	usedCount = 0;
+}
+
+uint32_t AddressesPool::getNext(uint32_t clientHash) {
+	uint32_t address;
+	if(isHashed()) {
+		address = probeFreeAddress(clientHash);
+	}
+	else {
+		address = findAbandonedAddress();
+		abandonedAddresses.erase(address);
+		if(!address) {
+			address = generateFreshAddress();
+		}
+	}
+	if(!address) {
+		return 0;
+	}
+
+	allocationsCount.store(allocationsCount.load(memory_order_relaxed) + 1, memory_order_relaxed);
+	publish();
+	return address;
 }
 
 uint32_t AddressesPool::generateFreshAddress() {
-	if(nextToAssign > descriptor.endAddress) {
-		throw runtime_error("No more addresses to assign");
+	if(nextToAssign > descriptor->endAddress) {
+		return 0;
 	}
 	return nextToAssign++;
 }
 
+/* Linear probing from the preferred offset, wrapping around at the end of the range */
+uint32_t AddressesPool::probeFreeAddress(uint32_t clientHash) {
+	uint32_t size = getSize();
+	if(usedCount >= size) {
+		return 0;
+	}
+
+	uint32_t preferred = clientHash % size;
+	uint32_t offset = findUnusedOffset(preferred, size);
+	if(offset == size) {
+		offset = findUnusedOffset(0, preferred);
+	}
+
+	uint32_t address = descriptor->startAddress + offset;
+	setUsed(address, true);
+	return address;
+}
+
+/* Checks 64 addresses at a time, returns to when all of [from, to) are used */
+uint32_t AddressesPool::findUnusedOffset(uint32_t from, uint32_t to) {
+	while(from < to) {
+		uint64_t unused = ~usedAddresses[from >> 6] & (~0ULL << (from & 63));
+		if(unused) {
+			uint32_t offset = (from & ~63u) + __builtin_ctzll(unused);
+			return offset < to ? offset : to;
+		}
+		from = (from & ~63u) + 64;
+	}
+
+	return to;
+}
+
+bool AddressesPool::isHashed() {
+	return descriptor->allocation == ALLOCATE_HASHED;
+}
+
+bool AddressesPool::isUsed(uint32_t address) {
+	uint32_t offset = address - descriptor->startAddress;
+	return ((usedAddresses[offset >> 6] >> (offset & 63)) & 1) != 0;
+}
+
+void AddressesPool::setUsed(uint32_t address, bool used) {
+	if(isUsed(address) == used) {
+		return;
+	}
+	uint32_t offset = address - descriptor->startAddress;
+	usedAddresses[offset >> 6] ^= 1ULL << (offset & 63);
+	usedCount += used ? 1 : -1;
+}
+
 uint32_t AddressesPool::findAbandonedAddress() {
 	return (abandonedAddresses.begin() == abandonedAddresses.end()) ? 0 : *abandonedAddresses.begin();
 }
 
 void AddressesPool::abandon(uint32_t address) {
-	abandonedAddresses.insert(address);
+	if(!isInRange(address)) {
+		return;
+	}
+
+	if(isHashed()) {
+		setUsed(address, false);
+	}
+	else {
+		abandonedAddresses.insert(address);
+	}
+	publish();
+}
+
+void AddressesPool::reclaim(uint32_t address) {
+	abandon(address);
+	reclaimsCount.store(reclaimsCount.load(memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+void AddressesPool::quarantine(uint32_t address) {
+	if(isInRange(address)) {
+		quarantinedCount.store(quarantinedCount.load(memory_order_relaxed) + 1, memory_order_relaxed);
+	}
+}
+
+void AddressesPool::reserve(uint32_t address) {
+	if(!isInRange(address)) {
+		return;
+	}
+
+	if(isHashed()) {
+		setUsed(address, true);
+		publish();
+		return;
+	}
+	abandonedAddresses.erase(address);
+	for(; nextToAssign <= address; ++nextToAssign) {
+		if(nextToAssign != address) {
+			abandonedAddresses.insert(nextToAssign);
+		}
+	}
+	publish();
+}
+
+void AddressesPool::restore(uint32_t savedNextToAssign) {
+	if(!isHashed() && savedNextToAssign >= descriptor->startAddress && savedNextToAssign <= descriptor->endAddress + 1) {
+		nextToAssign = savedNextToAssign;
+		publish();
+	}
+}
+
+void AddressesPool::reset() {
+	nextToAssign = descriptor->startAddress;
+	abandonedAddresses.clear();
+	usedAddresses.assign(usedAddresses.size(), 0);
+	usedCount = 0;
+	quarantinedCount.store(0, memory_order_relaxed);
+	publish();
+}
+
+void AddressesPool::recountQuarantined(size_t leasesCount) {
+	uint32_t assigned = assignedCount.load(memory_order_relaxed);
+	uint32_t handedOut = assigned - min(abandonedCount.load(memory_order_relaxed), assigned);
+	quarantinedCount.store(leasesCount < handedOut ? handedOut - leasesCount : 0, memory_order_relaxed);
+}
+
+/* Counts are published after every change, so usage is read without touching the pool structures */
+PoolUsage AddressesPool::getUsage() {
+	PoolUsage usage;
+	uint32_t assigned = assignedCount.load(memory_order_relaxed);
+	usage.size = getSize();
+	usage.unassigned = usage.size - assigned;
+	usage.abandoned = min(abandonedCount.load(memory_order_relaxed), assigned);
+	usage.quarantined = min(quarantinedCount.load(memory_order_relaxed), assigned - usage.abandoned);
+	usage.leased = assigned - usage.abandoned - usage.quarantined;
+	usage.allocations = allocationsCount.load(memory_order_relaxed);
+	usage.reclaims = reclaimsCount.load(memory_order_relaxed);
+
+	return usage;
+}
+
+uint32_t AddressesPool::getSize() {
+	return descriptor->endAddress - descriptor->startAddress + 1;
+}
+
+/* Assigned are addresses below nextToAssign in sequential pools and handed out ones in hashed pools */
+void AddressesPool::publish() {
+	uint32_t assigned = usedCount;
+	if(!isHashed()) {
+		assigned = nextToAssign <= descriptor->startAddress ? 0 : min(nextToAssign, descriptor->endAddress + 1) - descriptor->startAddress;
+	}
+	assignedCount.store(assigned, memory_order_relaxed);
+	abandonedCount.store(abandonedAddresses.size(), memory_order_relaxed);
 }
 
 uint32_t AddressesPool::getNetworkAddress() {
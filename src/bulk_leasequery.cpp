@@ -0,0 +1,453 @@
+#include "../inc/bulk_leasequery.h"
+#include "../inc/packer.h"
+#include "../inc/options.h"
+#include "../inc/packet_converter.h"
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#define DHCP_MAGIC_COOKIE 0x63825363
+#define ETHERNET_HTYPE 1
+#define ETHERNET_HLEN 6
+#define LEASEQUERY_READ_SIZE 4096
+
+using namespace std;
+
+BulkLeasequery::BulkLeasequery(EventLoop& loop, AddressesAllocator& addressesAllocator, Pipeline* handlersPipeline, Config& config, Clock& leasesClock, uint32_t ip)
+	: eventLoop(loop), allocator(addressesAllocator), pipeline(handlersPipeline), clock(leasesClock), serverIp(ip),
+	maxConnections(config.getLeasequeryMaxConnections()), bufferSize(config.getLeasequeryBufferSize()),
+	collecting(NULL), queries(0), leasesSent(0), rejectedConnections(0) {
+	listen(config);
+}
+
+BulkLeasequery::~BulkLeasequery() {
+	while(!connections.empty()) {
+		closeConnection(connections.begin()->first);
+	}
+	eventLoop.unwatch(listeningFd);
+	close(listeningFd);
+}
+
+void BulkLeasequery::listen(Config& config) {
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(config.getLeasequeryPort());
+	if(inet_pton(AF_INET, config.getLeasequeryAddress(), &address.sin_addr) != 1) {
+		throw runtime_error("Invalid leasequery address");
+	}
+
+	listeningFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(listeningFd < 0) {
+		throw runtime_error("Could not create leasequery socket");
+	}
+
+	int reuse = 1;
+	setsockopt(listeningFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	if(bind(listeningFd, (struct sockaddr*)&address, sizeof(address)) < 0 || ::listen(listeningFd, SOMAXCONN) < 0) {
+		close(listeningFd);
+		throw runtime_error("Could not bind leasequery socket");
+	}
+
+	eventLoop.watch(listeningFd, EPOLLIN, [this](uint32_t) { acceptConnection(); });
+}
+
+/* Every connection may hold a snapshot, so their number is limited */
+void BulkLeasequery::acceptConnection() {
+	int fd;
+	while((fd = accept4(listeningFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		if(connections.size() >= maxConnections) {
+			++rejectedConnections;
+			close(fd);
+			continue;
+		}
+
+		connections[fd] = Connection();
+		eventLoop.watch(fd, EPOLLIN, [this, fd](uint32_t events) { handleConnection(fd, events); });
+	}
+}
+
+void BulkLeasequery::closeConnection(int fd) {
+	eventLoop.unwatch(fd);
+	connections.erase(fd);
+	close(fd);
+}
+
+/*
+ * Queries of one connection are answered in order. Next query is started only after
+ * the previous one was fully written, requestor can half-close the connection after sending queries.
+ */
+void BulkLeasequery::handleConnection(int fd, uint32_t events) {
+	unordered_map<int, Connection>::iterator connectionIt = connections.find(fd);
+	if(connectionIt == connections.end()) {
+		return;
+	}
+	Connection& connection = connectionIt->second;
+
+	if(events & (EPOLLHUP | EPOLLERR)) {
+		closeConnection(fd);
+		return;
+	}
+	if(events & EPOLLIN) {
+		readQueries(fd, connection);
+	}
+
+	for(;;) {
+		fillOutput(connection);
+		writeOutput(fd, connection);
+		if(connections.find(fd) == connections.end()) {
+			return;
+		}
+		if(connection.querying || connection.outputOffset < connection.output.size()) {
+			break;
+		}
+		if(!startNextQuery(connection)) {
+			break;
+		}
+	}
+
+	if(!connection.querying && connection.output.empty() && connection.inputClosed) {
+		closeConnection(fd);
+		return;
+	}
+	updateEvents(fd, connection);
+}
+
+void BulkLeasequery::readQueries(int fd, Connection& connection) {
+	char buffer[LEASEQUERY_READ_SIZE];
+	while(connection.input.size() < bufferSize) {
+		ssize_t readBytes = read(fd, buffer, sizeof(buffer));
+		if(readBytes < 0) {
+			if(errno != EAGAIN) {
+				connection.inputClosed = true;
+			}
+			return;
+		}
+		if(readBytes == 0) {
+			connection.inputClosed = true;
+			return;
+		}
+		connection.input.append(buffer, readBytes);
+	}
+}
+
+/* Invalid framing leaves no way to find the next query, connection is closed after pending output */
+bool BulkLeasequery::startNextQuery(Connection& connection) {
+	if(connection.input.size() < sizeof(uint16_t)) {
+		return false;
+	}
+
+	size_t length = ((uint8_t)connection.input[0] << 8) | (uint8_t)connection.input[1];
+	if(length < LEASEQUERY_MESSAGE_HEADER_SIZE || length > sizeof(DHCPMessage)) {
+		connection.input.clear();
+		connection.inputClosed = true;
+		return false;
+	}
+	if(connection.input.size() < sizeof(uint16_t) + length) {
+		return false;
+	}
+
+	++queries;
+	bool valid = parseQuery((const uint8_t*)connection.input.data() + sizeof(uint16_t), length, connection.query);
+	connection.input.erase(0, sizeof(uint16_t) + length);
+	connection.xid = connection.query.xid;
+	connection.baseTime = clock.seconds();
+	if(!valid) {
+		appendDone(connection, LEASEQUERY_STATUS_MALFORMED_QUERY);
+		return true;
+	}
+
+	connection.snapshot.clear();
+	connection.snapshotOffset = 0;
+	connection.networks = findQueriedNetworks(connection.query);
+	connection.nextNetwork = 0;
+	connection.querying = true;
+	return true;
+}
+
+/* Pools are never removed, so every network holding leases has one. Query for a subnet touches only its network */
+vector<uint32_t> BulkLeasequery::findQueriedNetworks(const Query& query) {
+	vector<uint32_t> networks;
+	const unordered_map<uint32_t, AddressesPool*>& pools = allocator.getPools();
+	for(unordered_map<uint32_t, AddressesPool*>::const_iterator it = pools.begin(); it != pools.end(); it++) {
+		if(query.subnetAddress && (query.subnetAddress & it->second->getDescriptor()->networkMask) != it->first) {
+			continue;
+		}
+		networks.push_back(it->first);
+	}
+	sort(networks.begin(), networks.end());
+
+	return networks;
+}
+
+void BulkLeasequery::collectNetwork(Connection& connection, uint32_t networkAddress) {
+	connection.snapshot.clear();
+	connection.snapshotOffset = 0;
+	collecting = &connection;
+	{
+		PipelinePause pause(pipeline, networkAddress);
+		allocator.replayLeases(*this, networkAddress);
+	}
+	collecting = NULL;
+}
+
+bool BulkLeasequery::parseQuery(const uint8_t* rawMessage, size_t length, Query& query) {
+	DHCPMessage message;
+	memset(&message, 0, sizeof(message));
+	memcpy(&message, rawMessage, length);
+	PacketConverter::toHostReprezentation(message);
+
+	memset(&query, 0, sizeof(query));
+	query.xid = message.xid;
+	if(message.op != BOOTREQUEST || message.hlen > MAX_HADDR_SIZE) {
+		return false;
+	}
+
+	Options options(message.options, length - offsetof(DHCPMessage, options));
+	options.toHostReprezentation();
+	if(!options.exists(DHCP_MESSAGE_TYPE) || *options.get(DHCP_MESSAGE_TYPE).value != DHCPBULKLEASEQUERY) {
+		return false;
+	}
+
+	if(message.hlen > 0) {
+		query.byHardwareAddress = true;
+		query.htype = message.htype;
+		memcpy(query.chaddr, message.chaddr, message.hlen);
+	}
+	if(options.exists(CLIENT_IDENTIFIER)) {
+		Option& clientIdOption = options.get(CLIENT_IDENTIFIER);
+		if(clientIdOption.length < 1) {
+			return false;
+		}
+		query.bySpecialId = true;
+		query.specialId.type = *clientIdOption.value;
+		memcpy(query.specialId.value, clientIdOption.value + 1, clientIdOption.length - 1);
+	}
+	if(query.byHardwareAddress && query.bySpecialId) {
+		return false;
+	}
+
+	query.subnetAddress = message.ciaddr;
+	if(options.exists(QUERY_START_TIME) && options.get(QUERY_START_TIME).length == sizeof(uint32_t)) {
+		query.startTime = *((uint32_t*)options.get(QUERY_START_TIME).value);
+	}
+	if(options.exists(QUERY_END_TIME) && options.get(QUERY_END_TIME).length == sizeof(uint32_t)) {
+		query.endTime = *((uint32_t*)options.get(QUERY_END_TIME).value);
+	}
+
+	return true;
+}
+
+void BulkLeasequery::onLeaseUpdated(uint32_t networkAddress, const HardwareAddress& hardwareAddress, const AllocatedAddress& address) {
+	if(!matches(networkAddress, hardwareAddress, address)) {
+		return;
+	}
+
+	uint8_t keyLength = MAX_HADDR_SIZE;
+	if(hardwareAddress.addressType == ETHERNET_HTYPE) {
+		keyLength = ETHERNET_HLEN;
+	}
+	else {
+		while(keyLength > 0 && hardwareAddress.hardwareAddress[keyLength - 1] == 0) {
+			--keyLength;
+		}
+	}
+	collect(address, BASED_ON_HARDWARE, hardwareAddress.addressType, hardwareAddress.hardwareAddress, keyLength);
+}
+
+/* Identifier length is not stored with the lease, trailing zeros are dropped */
+void BulkLeasequery::onLeaseUpdated(uint32_t networkAddress, const ClientSpecialId& specialId, const AllocatedAddress& address) {
+	if(!matches(networkAddress, specialId, address)) {
+		return;
+	}
+
+	size_t keyLength = CLIENT_SPECIAL_ID_MAX_LEN - 1;
+	while(keyLength > 0 && specialId.value[keyLength - 1] == 0) {
+		--keyLength;
+	}
+	collect(address, BASED_ON_SPECIAL_ID, specialId.type, specialId.value, keyLength);
+}
+
+template <class T> bool BulkLeasequery::matches(uint32_t networkAddress, const T& clientId, const AllocatedAddress& address) {
+	if(collecting == NULL) {
+		return false;
+	}
+	const Query& query = collecting->query;
+	if(query.subnetAddress && (query.subnetAddress & address.descriptor->networkMask) != networkAddress) {
+		return false;
+	}
+	if((query.startTime && address.allocationTime < query.startTime) || (query.endTime && address.allocationTime > query.endTime)) {
+		return false;
+	}
+
+	return (!query.byHardwareAddress && !query.bySpecialId) || matchesClient(query, clientId);
+}
+
+bool BulkLeasequery::matchesClient(const Query& query, const HardwareAddress& hardwareAddress) {
+	return query.byHardwareAddress && hardwareAddress.addressType == query.htype
+		&& memcmp(hardwareAddress.hardwareAddress, query.chaddr, MAX_HADDR_SIZE) == 0;
+}
+
+bool BulkLeasequery::matchesClient(const Query& query, const ClientSpecialId& specialId) {
+	return query.bySpecialId && specialId.type == query.specialId.type
+		&& memcmp(specialId.value, query.specialId.value, CLIENT_SPECIAL_ID_MAX_LEN) == 0;
+}
+
+void BulkLeasequery::collect(const AllocatedAddress& address, uint8_t identificationMethod, uint8_t keyType, const uint8_t* key, uint8_t keyLength) {
+	LeaseRecord record;
+	record.ipAddress = address.ipAddress;
+	record.leaseTime = address.leaseTime;
+	record.allocationTime = address.allocationTime;
+	record.identificationMethod = identificationMethod;
+	record.keyType = keyType;
+	record.keyLength = keyLength;
+
+	LeasequeryBytes& snapshot = collecting->snapshot;
+	snapshot.insert(snapshot.end(), (const uint8_t*)&record, (const uint8_t*)&record + sizeof(record));
+	snapshot.insert(snapshot.end(), key, key + keyLength);
+}
+
+/* Encodes snapshot records only while less than bufferSize bytes wait for the socket, next network is copied when one is sent */
+void BulkLeasequery::fillOutput(Connection& connection) {
+	if(connection.outputOffset > 0) {
+		connection.output.erase(connection.output.begin(), connection.output.begin() + connection.outputOffset);
+		connection.outputOffset = 0;
+	}
+
+	while(connection.querying && connection.output.size() < bufferSize) {
+		if(connection.snapshotOffset >= connection.snapshot.size()) {
+			if(connection.nextNetwork < connection.networks.size()) {
+				collectNetwork(connection, connection.networks[connection.nextNetwork++]);
+				continue;
+			}
+			appendDone(connection, LEASEQUERY_STATUS_SUCCESS);
+			connection.querying = false;
+			LeasequeryBytes().swap(connection.snapshot);
+			vector<uint32_t>().swap(connection.networks);
+			break;
+		}
+
+		LeaseRecord record;
+		memcpy(&record, &connection.snapshot[connection.snapshotOffset], sizeof(record));
+		appendLease(connection, record, &connection.snapshot[connection.snapshotOffset + sizeof(record)]);
+		connection.snapshotOffset += sizeof(record) + record.keyLength;
+	}
+}
+
+void BulkLeasequery::writeOutput(int fd, Connection& connection) {
+	while(connection.outputOffset < connection.output.size()) {
+		ssize_t writtenBytes = write(fd, &connection.output[connection.outputOffset], connection.output.size() - connection.outputOffset);
+		if(writtenBytes < 0) {
+			if(errno != EAGAIN) {
+				closeConnection(fd);
+			}
+			return;
+		}
+		connection.outputOffset += writtenBytes;
+	}
+
+	connection.output.clear();
+	connection.outputOffset = 0;
+}
+
+/*
+ * Reading stops while input buffer is full, it is drained as queries get answered.
+ * Running query waits for writability, so one round encodes at most bufferSize bytes and other events are not starved.
+ */
+void BulkLeasequery::updateEvents(int fd, Connection& connection) {
+	uint32_t events = 0;
+	if(!connection.inputClosed && connection.input.size() < bufferSize) {
+		events |= EPOLLIN;
+	}
+	if(connection.querying || connection.outputOffset < connection.output.size()) {
+		events |= EPOLLOUT;
+	}
+	eventLoop.modify(fd, events);
+}
+
+/* Times are relative to base time of the query, the moment it was started, LEASEQUERYDONE carries the same one */
+void BulkLeasequery::appendLease(Connection& connection, const LeaseRecord& record, const uint8_t* key) {
+	bool active = record.allocationTime + record.leaseTime > connection.baseTime;
+
+	DHCPMessage reply;
+	prepareReply(reply, connection.xid);
+	reply.ciaddr = record.ipAddress;
+	if(record.identificationMethod == BASED_ON_HARDWARE) {
+		reply.htype = record.keyType;
+		reply.hlen = record.keyLength;
+		memcpy(reply.chaddr, key, record.keyLength);
+	}
+
+	Packer packer(reply.options);
+	packer.pack(DHCP_MESSAGE_TYPE, (uint8_t)(active ? DHCPLEASEACTIVE : DHCPLEASEUNASSIGNED))
+		.pack(SERVER_IDENTIFIER, serverIp)
+		.pack(BASE_TIME, (uint32_t)connection.baseTime)
+		.pack(DHCP_STATE, (uint8_t)(active ? LEASE_STATE_ACTIVE : LEASE_STATE_EXPIRED))
+		.pack(CLIENT_LAST_TRANSACTION_TIME, (uint32_t)(connection.baseTime - record.allocationTime));
+	if(active) {
+		packer.pack(IP_ADDRESS_LEASE_TIME, (uint32_t)(record.allocationTime + record.leaseTime - connection.baseTime));
+	}
+	if(record.identificationMethod == BASED_ON_SPECIAL_ID) {
+		uint8_t clientId[CLIENT_SPECIAL_ID_MAX_LEN];
+		clientId[0] = record.keyType;
+		memcpy(clientId + 1, key, record.keyLength);
+		packer.pack(CLIENT_IDENTIFIER, clientId, record.keyLength + 1);
+	}
+	packer.pack(END_OPTION);
+
+	appendMessage(connection, reply, packer.getLength());
+	++leasesSent;
+}
+
+void BulkLeasequery::appendDone(Connection& connection, uint8_t status) {
+	DHCPMessage reply;
+	prepareReply(reply, connection.xid);
+
+	Packer packer(reply.options);
+	packer.pack(DHCP_MESSAGE_TYPE, (uint8_t)DHCPLEASEQUERYDONE)
+		.pack(SERVER_IDENTIFIER, serverIp)
+		.pack(BASE_TIME, (uint32_t)connection.baseTime);
+	if(status != LEASEQUERY_STATUS_SUCCESS) {
+		packer.pack(STATUS_CODE, &status, sizeof(status));
+	}
+	packer.pack(END_OPTION);
+
+	appendMessage(connection, reply, packer.getLength());
+}
+
+void BulkLeasequery::prepareReply(DHCPMessage& reply, uint32_t xid) {
+	memset(&reply, 0, sizeof(reply));
+	reply.op = BOOTREPLY;
+	reply.xid = xid;
+	reply.magicCookie = htonl(DHCP_MAGIC_COOKIE);
+}
+
+/* Every message is preceded by its length in network order */
+void BulkLeasequery::appendMessage(Connection& connection, DHCPMessage& message, size_t optionsLength) {
+	PacketConverter::toNetworkReprezentation(message);
+	Options options(message.options);
+	options.toNetworkReprezentation();
+
+	uint16_t length = offsetof(DHCPMessage, options) + optionsLength;
+	connection.output.push_back(length >> 8);
+	connection.output.push_back(length & 0xff);
+	connection.output.insert(connection.output.end(), (const uint8_t*)&message, (const uint8_t*)&message + length);
+}
+
+string BulkLeasequery::describe() {
+	ostringstream description;
+	description << "connections " << connections.size() << "\n"
+		<< "rejected_connections " << rejectedConnections << "\n"
+		<< "queries " << queries << "\n"
+		<< "leases_sent " << leasesSent << "\n";
+
+	return description.str();
+}
@@ -0,0 +1,34 @@
+#include "../inc/clock.h"
+#include "../inc/monotonic_clock.h"
+
+using namespace std;
+
+CoarseClock::CoarseClock(): startSeconds(time(NULL)), startMs(MonotonicClock::nowMs()), cachedMs(startMs) {}
+
+void CoarseClock::refresh() {
+	uint64_t now = MonotonicClock::nowMs();
+	uint64_t cached = cachedMs.load(memory_order_relaxed);
+	while(now > cached && !cachedMs.compare_exchange_weak(cached, now, memory_order_relaxed)) {}
+}
+
+time_t CoarseClock::seconds() {
+	return startSeconds + (time_t)((cachedMs.load(memory_order_relaxed) - startMs) / 1000);
+}
+
+uint64_t CoarseClock::monotonicMs() {
+	return cachedMs.load(memory_order_relaxed);
+}
+
+VirtualClock::VirtualClock(time_t startSeconds): currentMs((uint64_t)startSeconds * 1000) {}
+
+time_t VirtualClock::seconds() {
+	return (time_t)(currentMs.load(memory_order_relaxed) / 1000);
+}
+
+uint64_t VirtualClock::monotonicMs() {
+	return currentMs.load(memory_order_relaxed);
+}
+
+void VirtualClock::advance(uint64_t milliseconds) {
+	currentMs.fetch_add(milliseconds, memory_order_relaxed);
+}
@@ -1,47 +1,285 @@
 #include "../inc/config.h"
+#include "../inc/lease_times.h"
+#include "../inc/pools_parser.h"
+#include "../inc/config_file_format.h"
+#include "../inc/crc32c.h"
+#include "../inc/vlan_tags.h"
 
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <endian.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <sys/stat.h>
 
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/foreach.hpp>
 #include <string>
+#include <sstream>
+#include <unordered_map>
+#include <string.h>
 #include <strings.h>
+#include <stdio.h>
+#include <stdexcept>
 
 using boost::property_tree::ptree;
 
-Config::Config(const char* filePath) {
-	load(filePath);
+Config::Config(const char* path): filePath(path) {
+	load(path);
 }
 
 void Config::load(const char* filePath) {
-	ptree config;
-	read_json(filePath, config);
+	std::string document = readFile(filePath);
+	if(document.size() >= sizeof(CompiledConfigHeader) && memcmp(document.data(), CONFIG_FILE_MAGIC, CONFIG_FILE_MAGIC_SIZE) == 0) {
+		loadCompiled(document);
+	}
+	else {
+		loadJson(document);
+	}
+	loadSettings();
+}
+
+std::string Config::readFile(const char* filePath) {
+	FILE* file = fopen(filePath, "rb");
+	if(file == NULL) {
+		throw std::runtime_error(std::string("Could not open configuration file ") + filePath);
+	}
+
+	std::string document;
+	struct stat fileStat;
+	if(fstat(fileno(file), &fileStat) == 0) {
+		document.reserve(fileStat.st_size);
+	}
+	char buffer[65536];
+	size_t readBytes;
+	while((readBytes = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		document.append(buffer, readBytes);
+	}
+	fclose(file);
+
+	return document;
+}
+
+/* Pools are read by the streaming parser, only the remaining small document goes through ptree */
+void Config::loadJson(const std::string& document) {
+	PoolsParser parser(document.data(), document.size());
+	size_t poolsBegin, poolsEnd;
+	addressesPools.clear();
+	if(!parser.parse(addressesPools, poolsBegin, poolsEnd)) {
+		throw std::runtime_error("Configuration has no addressesPools");
+	}
+	settings = document.substr(0, poolsBegin) + "[]" + document.substr(poolsEnd);
+}
+
+void Config::loadCompiled(const std::string& document) {
+	const CompiledConfigHeader* header = (const CompiledConfigHeader*)document.data();
+	uint32_t settingsLength = le32toh(header->settingsLength);
+	uint32_t optionSetsCount = le32toh(header->optionSetsCount);
+	uint32_t addressesCount = le32toh(header->addressesCount);
+	uint32_t poolsCount = le32toh(header->poolsCount);
+
+	size_t payloadSize = (size_t)settingsLength + (size_t)optionSetsCount * sizeof(OptionSetRecord)
+		+ (size_t)addressesCount * sizeof(uint32_t) + (size_t)poolsCount * sizeof(PoolDescriptorRecord);
+	if(le32toh(header->version) != CONFIG_FILE_VERSION
+		|| le32toh(header->headerCrc) != Crc32c::compute(header, offsetof(CompiledConfigHeader, headerCrc))
+		|| document.size() != sizeof(CompiledConfigHeader) + payloadSize
+		|| le32toh(header->payloadCrc) != Crc32c::compute(document.data() + sizeof(CompiledConfigHeader), payloadSize)) {
+		throw std::runtime_error("Invalid compiled configuration");
+	}
+
+	const char* payload = document.data() + sizeof(CompiledConfigHeader);
+	settings.assign(payload, settingsLength);
+	const OptionSetRecord* optionSetRecords = (const OptionSetRecord*)(payload + settingsLength);
+	const uint32_t* addresses = (const uint32_t*)(optionSetRecords + optionSetsCount);
+	const PoolDescriptorRecord* poolRecords = (const PoolDescriptorRecord*)(addresses + addressesCount);
+
+	std::vector<std::shared_ptr<const PoolOptions> > optionSets;
+	optionSets.reserve(optionSetsCount);
+	for(uint32_t i = 0; i < optionSetsCount; ++i) {
+		uint32_t firstDnsServer = le32toh(optionSetRecords[i].firstDnsServer);
+		uint32_t dnsServersCount = le32toh(optionSetRecords[i].dnsServersCount);
+		uint32_t firstRouter = le32toh(optionSetRecords[i].firstRouter);
+		uint32_t routersCount = le32toh(optionSetRecords[i].routersCount);
+		if((uint64_t)firstDnsServer + dnsServersCount > addressesCount || (uint64_t)firstRouter + routersCount > addressesCount) {
+			throw std::runtime_error("Invalid compiled configuration");
+		}
+
+		std::shared_ptr<PoolOptions> options = std::make_shared<PoolOptions>();
+		for(uint32_t j = 0; j < dnsServersCount; ++j) {
+			options->dnsServers.push_back(le32toh(addresses[firstDnsServer + j]));
+		}
+		for(uint32_t j = 0; j < routersCount; ++j) {
+			options->routers.push_back(le32toh(addresses[firstRouter + j]));
+		}
+		optionSets.push_back(options);
+	}
+
+	addressesPools.clear();
+	addressesPools.resize(poolsCount);
+	for(uint32_t i = 0; i < poolsCount; ++i) {
+		PoolDescriptor& descriptor = addressesPools[i];
+		descriptor.startAddress = le32toh(poolRecords[i].startAddress);
+		descriptor.endAddress = le32toh(poolRecords[i].endAddress);
+		descriptor.networkMask = le32toh(poolRecords[i].networkMask);
+		descriptor.leaseTime = le32toh(poolRecords[i].leaseTime);
+		descriptor.leaseJitter = le32toh(poolRecords[i].leaseJitter);
+
+		uint32_t optionSet = le32toh(poolRecords[i].optionSet);
+		uint32_t allocation = le32toh(poolRecords[i].allocation);
+		if(optionSet >= optionSetsCount || descriptor.leaseJitter > MAX_LEASE_JITTER || allocation > ALLOCATE_HASHED || descriptor.endAddress < descriptor.startAddress) {
+			throw std::runtime_error("Invalid compiled configuration");
+		}
+		descriptor.allocation = (AllocationStrategy)allocation;
+		descriptor.options = optionSets[optionSet];
+	}
+}
+
+/* Option sets shared between pools are written once */
+void Config::compile(const char* compiledPath) {
+	std::vector<OptionSetRecord> optionSetRecords;
+	std::vector<uint32_t> addresses;
+	std::vector<PoolDescriptorRecord> poolRecords;
+	std::unordered_map<const PoolOptions*, uint32_t> optionSetIndexes;
+
+	for(std::vector<PoolDescriptor>::const_iterator it = addressesPools.begin(); it != addressesPools.end(); it++) {
+		std::unordered_map<const PoolOptions*, uint32_t>::iterator indexIt = optionSetIndexes.find(it->options.get());
+		if(indexIt == optionSetIndexes.end()) {
+			OptionSetRecord optionSet;
+			optionSet.firstDnsServer = htole32(addresses.size());
+			optionSet.dnsServersCount = htole32(it->options->dnsServers.size());
+			for(std::vector<uint32_t>::const_iterator addressIt = it->options->dnsServers.begin(); addressIt != it->options->dnsServers.end(); addressIt++) {
+				addresses.push_back(htole32(*addressIt));
+			}
+			optionSet.firstRouter = htole32(addresses.size());
+			optionSet.routersCount = htole32(it->options->routers.size());
+			for(std::vector<uint32_t>::const_iterator addressIt = it->options->routers.begin(); addressIt != it->options->routers.end(); addressIt++) {
+				addresses.push_back(htole32(*addressIt));
+			}
+
+			indexIt = optionSetIndexes.insert(std::make_pair(it->options.get(), optionSetRecords.size())).first;
+			optionSetRecords.push_back(optionSet);
+		}
 
-	interface = config.get<std::string>("interface");
-	networkAddress = extractAddress(config, "networkAddress");
-	networkMask = extractAddress(config, "networkMask");
-	
-	BOOST_FOREACH(ptree::value_type &poolNode, config.get_child("addressesPools")) {
-		ptree &pool = poolNode.second;
+		PoolDescriptorRecord pool;
+		pool.startAddress = htole32(it->startAddress);
+		pool.endAddress = htole32(it->endAddress);
+		pool.networkMask = htole32(it->networkMask);
+		pool.leaseTime = htole32(it->leaseTime);
+		pool.leaseJitter = htole32(it->leaseJitter);
+		pool.optionSet = htole32(indexIt->second);
+		pool.allocation = htole32(it->allocation);
+		poolRecords.push_back(pool);
+	}
+
+	std::string payload = settings;
+	payload.append((const char*)optionSetRecords.data(), optionSetRecords.size() * sizeof(OptionSetRecord));
+	payload.append((const char*)addresses.data(), addresses.size() * sizeof(uint32_t));
+	payload.append((const char*)poolRecords.data(), poolRecords.size() * sizeof(PoolDescriptorRecord));
 
-		PoolDescriptor poolDescriptor;
-		poolDescriptor.startAddress = extractAddress(pool, "startAddress");
-		poolDescriptor.endAddress = extractAddress(pool, "endAddress");
-		poolDescriptor.networkMask = extractAddress(pool, "networkMask");
+	CompiledConfigHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CONFIG_FILE_MAGIC, CONFIG_FILE_MAGIC_SIZE);
+	header.version = htole32(CONFIG_FILE_VERSION);
+	header.settingsLength = htole32(settings.size());
+	header.optionSetsCount = htole32(optionSetRecords.size());
+	header.addressesCount = htole32(addresses.size());
+	header.poolsCount = htole32(poolRecords.size());
+	header.payloadCrc = htole32(Crc32c::compute(payload.data(), payload.size()));
+	header.headerCrc = htole32(Crc32c::compute(&header, offsetof(CompiledConfigHeader, headerCrc)));
 
-		extractAddressesList(pool.get_child("routers"), poolDescriptor.routers);
-		extractAddressesList(pool.get_child("dnsServers"), poolDescriptor.dnsServers);
+	std::string temporaryPath = std::string(compiledPath) + ".tmp";
+	FILE* file = fopen(temporaryPath.c_str(), "wb");
+	if(file == NULL) {
+		throw std::runtime_error("Could not create " + temporaryPath);
+	}
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(payload.data(), 1, payload.size(), file) == payload.size();
+	if(fclose(file) != 0 || !written || rename(temporaryPath.c_str(), compiledPath) != 0) {
+		unlink(temporaryPath.c_str());
+		throw std::runtime_error(std::string("Could not write compiled configuration ") + compiledPath);
+	}
+}
 
-		poolDescriptor.leaseTime = pool.get<uint32_t>("leaseTime");
+void Config::loadSettings() {
+	ptree config;
+	std::istringstream settingsStream(settings);
+	read_json(settingsStream, config);
 
-		addressesPools.push_back(poolDescriptor);
+	/* Single interface may be given at top level, as in configurations from before "interfaces" */
+	interfaces.clear();
+	boost::optional<ptree&> interfacesNode = config.get_child_optional("interfaces");
+	if(interfacesNode) {
+		BOOST_FOREACH(ptree::value_type &interfaceNode, *interfacesNode) {
+			interfaces.push_back(extractInterface(interfaceNode.second));
+		}
+	}
+	else {
+		interfaces.push_back(extractInterface(config));
+	}
+	if(interfaces.empty() || interfaces.size() > MAX_INTERFACES) {
+		throw std::runtime_error("Between 1 and 255 interfaces have to be configured");
 	}
 
 	transactionStorageTime = config.get<uint32_t>("transactionStorageTime");
 	cacheFile = config.get<std::string>("cacheFile");
+	persistenceThreads = config.get<unsigned>("persistenceThreads", 0);
+	snapshotInterval = config.get<uint32_t>("snapshotInterval", 0);
+	controlSocket = config.get<std::string>("controlSocket", "");
+	pipelineWorkers = config.get<unsigned>("pipelineWorkers", 0);
+	pipelineQueueSize = config.get<unsigned>("pipelineQueueSize", 1024);
+
+	replicationRole = config.get<std::string>("replication.role", "none");
+	replicationAddress = config.get<std::string>("replication.address", "127.0.0.1");
+	replicationPort = config.get<uint16_t>("replication.port", 6767);
+	replicationResyncInterval = config.get<uint32_t>("replication.resyncInterval", 300);
+	replicationMaxBacklog = config.get<size_t>("replication.maxBacklog", 64 * 1024 * 1024);
+
+	boost::optional<ptree&> buckets = config.get_child_optional("loadBalancing.buckets");
+	if(buckets) {
+		extractBuckets(*buckets, ownedBuckets);
+	}
+	else {
+		ownedBuckets.set();
+	}
+	takeoverSeconds = config.get<uint16_t>("loadBalancing.takeoverSeconds", 0);
+
+	clientRateLimit = config.get<uint32_t>("rateLimit.clientRate", 0);
+	clientRateBurst = config.get<uint32_t>("rateLimit.clientBurst", 10);
+	relayRateLimit = config.get<uint32_t>("rateLimit.relayRate", 0);
+	relayRateBurst = config.get<uint32_t>("rateLimit.relayBurst", 1000);
+	rateLimitTableSize = config.get<size_t>("rateLimit.tableSize", 65536);
+
+	schedulerQueueSize = config.get<size_t>("scheduler.queueSize", 4096);
+	schedulerQuantum = config.get<unsigned>("scheduler.quantum", 4);
+	maxDiscoverDelay = config.get<uint32_t>("scheduler.maxDiscoverDelay", 2000);
+	maxDiscoverSecs = config.get<uint16_t>("scheduler.maxDiscoverSecs", 0);
+
+	replyCacheSize = config.get<size_t>("replyCache.size", 4096);
+	replyCacheTimeToLive = config.get<uint32_t>("replyCache.timeToLive", 10000);
+
+	metricsAddress = config.get<std::string>("metrics.address", "127.0.0.1");
+	metricsPort = config.get<uint16_t>("metrics.port", 0);
+
+	leasequeryAddress = config.get<std::string>("leasequery.address", "127.0.0.1");
+	leasequeryPort = config.get<uint16_t>("leasequery.port", 0);
+	leasequeryMaxConnections = config.get<unsigned>("leasequery.maxConnections", 4);
+	leasequeryBufferSize = config.get<size_t>("leasequery.bufferSize", 64 * 1024);
+
+	busyPollEnabled = config.get<bool>("busyPoll.enabled", false);
+	busyPollMicroseconds = config.get<unsigned>("busyPoll.socketMicroseconds", 50);
+	captureCore = config.get<int>("busyPoll.captureCore", -1);
+	workerCores.clear();
+	boost::optional<ptree&> cores = config.get_child_optional("busyPoll.workerCores");
+	if(cores) {
+		BOOST_FOREACH(ptree::value_type &core, *cores) {
+			workerCores.push_back(core.second.get_value<int>());
+		}
+	}
+}
+
+const char* Config::getFilePath() {
+	return filePath.c_str();
 }
 
 uint32_t Config::extractAddress(ptree &node, const char* key) {
@@ -50,10 +288,54 @@ uint32_t Config::extractAddress(ptree &node, const char* key) {
 	return addrFromString(addressString);
 }
 
-void Config::extractAddressesList(ptree &addresses, std::list<uint32_t>& target) {
-	BOOST_FOREACH(ptree::value_type &rawAddress, addresses) {
-		std::string addressString = rawAddress.second.data();	
-		target.push_back(addrFromString(addressString));
+InterfaceDescriptor Config::extractInterface(ptree &node) {
+	InterfaceDescriptor descriptor;
+	descriptor.name = node.get<std::string>("interface");
+	descriptor.networkAddress = extractAddress(node, "networkAddress");
+	descriptor.networkMask = extractAddress(node, "networkMask");
+
+	boost::optional<ptree&> vlans = node.get_child_optional("vlans");
+	if(vlans) {
+		BOOST_FOREACH(ptree::value_type &vlanNode, *vlans) {
+			descriptor.vlans.push_back(extractVlan(vlanNode.second));
+		}
+	}
+
+	return descriptor;
+}
+
+/* IDs 0 and 4095 are reserved, frames with them never carry a customer VLAN */
+VlanNetwork Config::extractVlan(ptree &node) {
+	VlanNetwork vlan;
+	unsigned outer = node.get<unsigned>("vlan");
+	unsigned inner = node.get<unsigned>("innerVlan", 0);
+	if(outer == 0 || outer >= VLAN_ID_MASK || inner >= VLAN_ID_MASK) {
+		throw std::runtime_error("Invalid VLAN: " + node.get<std::string>("vlan") + "." + node.get<std::string>("innerVlan", "0"));
+	}
+
+	vlan.vlan = outer;
+	vlan.innerVlan = inner;
+	vlan.networkAddress = extractAddress(node, "networkAddress");
+
+	return vlan;
+}
+
+/* Buckets are given as single numbers or ranges, e.g. ["0-127", "200"] */
+void Config::extractBuckets(ptree &buckets, std::bitset<HASH_BUCKETS_COUNT>& target) {
+	BOOST_FOREACH(ptree::value_type &rawBuckets, buckets) {
+		std::string bucketsString = rawBuckets.second.data();
+		unsigned first, last;
+		int parsed = sscanf(bucketsString.c_str(), "%u-%u", &first, &last);
+		if(parsed == 1) {
+			last = first;
+		}
+		if(parsed < 1 || first > last || last >= HASH_BUCKETS_COUNT) {
+			throw std::runtime_error("Invalid hash buckets: " + bucketsString);
+		}
+
+		for(unsigned bucket = first; bucket <= last; ++bucket) {
+			target.set(bucket);
+		}
 	}
 }
 
@@ -65,18 +347,22 @@ uint32_t Config::addrFromString(std::string& addressString) {
 }
 
 const char* Config::getInterface() {
-	return interface.c_str();;
+	return interfaces.front().name.c_str();
 }
 
 uint32_t Config::getNetworkAddress() {
-	return networkAddress;
+	return interfaces.front().networkAddress;
 }
 
 uint32_t Config::getNetworkMask() {
-	return networkMask;
+	return interfaces.front().networkMask;
 }
 
-const std::list<PoolDescriptor>& Config::getPoolsDescriptors() {
+const std::vector<InterfaceDescriptor>& Config::getInterfaces() {
+	return interfaces;
+}
+
+const std::vector<PoolDescriptor>& Config::getPoolsDescriptors() {
 	return addressesPools;
 }
 
@@ -87,3 +373,135 @@ uint32_t Config::getTransactionStorageTime() {
 const char* Config::getCacheFile() {
 	return cacheFile.c_str();
 }
+
+unsigned Config::getPersistenceThreads() {
+	return persistenceThreads;
+}
+
+uint32_t Config::getSnapshotInterval() {
+	return snapshotInterval;
+}
+
+const char* Config::getControlSocket() {
+	return controlSocket.c_str();
+}
+
+unsigned Config::getPipelineWorkers() {
+	return pipelineWorkers;
+}
+
+unsigned Config::getPipelineQueueSize() {
+	return pipelineQueueSize;
+}
+
+const char* Config::getReplicationRole() {
+	return replicationRole.c_str();
+}
+
+const char* Config::getReplicationAddress() {
+	return replicationAddress.c_str();
+}
+
+uint16_t Config::getReplicationPort() {
+	return replicationPort;
+}
+
+uint32_t Config::getReplicationResyncInterval() {
+	return replicationResyncInterval;
+}
+
+size_t Config::getReplicationMaxBacklog() {
+	return replicationMaxBacklog;
+}
+
+const std::bitset<HASH_BUCKETS_COUNT>& Config::getOwnedBuckets() {
+	return ownedBuckets;
+}
+
+uint16_t Config::getTakeoverSeconds() {
+	return takeoverSeconds;
+}
+
+uint32_t Config::getClientRateLimit() {
+	return clientRateLimit;
+}
+
+uint32_t Config::getClientRateBurst() {
+	return clientRateBurst;
+}
+
+uint32_t Config::getRelayRateLimit() {
+	return relayRateLimit;
+}
+
+uint32_t Config::getRelayRateBurst() {
+	return relayRateBurst;
+}
+
+size_t Config::getRateLimitTableSize() {
+	return rateLimitTableSize;
+}
+
+size_t Config::getSchedulerQueueSize() {
+	return schedulerQueueSize;
+}
+
+unsigned Config::getSchedulerQuantum() {
+	return schedulerQuantum;
+}
+
+uint32_t Config::getMaxDiscoverDelay() {
+	return maxDiscoverDelay;
+}
+
+uint16_t Config::getMaxDiscoverSecs() {
+	return maxDiscoverSecs;
+}
+
+size_t Config::getReplyCacheSize() {
+	return replyCacheSize;
+}
+
+uint32_t Config::getReplyCacheTimeToLive() {
+	return replyCacheTimeToLive;
+}
+
+const char* Config::getMetricsAddress() {
+	return metricsAddress.c_str();
+}
+
+uint16_t Config::getMetricsPort() {
+	return metricsPort;
+}
+
+const char* Config::getLeasequeryAddress() {
+	return leasequeryAddress.c_str();
+}
+
+uint16_t Config::getLeasequeryPort() {
+	return leasequeryPort;
+}
+
+unsigned Config::getLeasequeryMaxConnections() {
+	return leasequeryMaxConnections;
+}
+
+size_t Config::getLeasequeryBufferSize() {
+	return leasequeryBufferSize;
+}
+
+bool Config::isBusyPollEnabled() {
+	return busyPollEnabled;
+}
+
+unsigned Config::getBusyPollMicroseconds() {
+	return busyPollMicroseconds;
+}
+
+int Config::getCaptureCore() {
+	return captureCore;
+}
+
+const std::vector<int>& Config::getWorkerCores() {
+	return workerCores;
+}
@@ -0,0 +1,148 @@
+#include "../inc/control_socket.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdexcept>
+
+using namespace std;
+
+ControlSocket::ControlSocket(EventLoop& loop, const char* socketPath): eventLoop(loop), path(socketPath) {
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if(path.size() >= sizeof(address.sun_path)) {
+		throw runtime_error("Control socket path is too long");
+	}
+	strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+	listeningFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(listeningFd < 0) {
+		throw runtime_error("Could not create control socket");
+	}
+
+	unlink(path.c_str());
+	if(bind(listeningFd, (struct sockaddr*)&address, sizeof(address)) < 0 || ::listen(listeningFd, SOMAXCONN) < 0) {
+		close(listeningFd);
+		throw runtime_error("Could not bind control socket");
+	}
+
+	eventLoop.watch(listeningFd, EPOLLIN, [this](uint32_t) { acceptConnection(); });
+
+	registerCommand("help", [this](const string&) {
+		string response;
+		for(map<string, Command>::const_iterator it = commands.begin(); it != commands.end(); it++) {
+			response += it->first + "\n";
+		}
+		return response;
+	});
+}
+
+ControlSocket::~ControlSocket() {
+	while(!connections.empty()) {
+		closeConnection(connections.begin()->first);
+	}
+	eventLoop.unwatch(listeningFd);
+	close(listeningFd);
+	unlink(path.c_str());
+}
+
+void ControlSocket::registerCommand(const string& name, Command command) {
+	commands[name] = command;
+}
+
+void ControlSocket::acceptConnection() {
+	int fd;
+	while((fd = accept4(listeningFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		connections[fd] = Connection();
+		eventLoop.watch(fd, EPOLLIN | EPOLLRDHUP, [this, fd](uint32_t events) { handleConnection(fd, events); });
+	}
+}
+
+void ControlSocket::handleConnection(int fd, uint32_t events) {
+	unordered_map<int, Connection>::iterator connectionIt = connections.find(fd);
+	if(connectionIt == connections.end()) {
+		return;
+	}
+	Connection& connection = connectionIt->second;
+
+	if(events & EPOLLIN) {
+		readCommand(fd, connection);
+	}
+	else if(events & EPOLLOUT) {
+		writeResponse(fd, connection);
+	}
+	else {
+		closeConnection(fd);
+	}
+}
+
+void ControlSocket::readCommand(int fd, Connection& connection) {
+	char buffer[CONTROL_MAX_COMMAND_SIZE];
+	ssize_t readBytes = read(fd, buffer, sizeof(buffer));
+	if(readBytes <= 0) {
+		if(readBytes < 0 && errno == EAGAIN) {
+			return;
+		}
+		closeConnection(fd);
+		return;
+	}
+
+	connection.input.append(buffer, readBytes);
+	size_t lineEnd = connection.input.find('\n');
+	if(lineEnd == string::npos) {
+		if(connection.input.size() > CONTROL_MAX_COMMAND_SIZE) {
+			closeConnection(fd);
+		}
+		return;
+	}
+
+	connection.output = execute(connection.input.substr(0, lineEnd));
+	eventLoop.modify(fd, EPOLLOUT);
+	writeResponse(fd, connection);
+}
+
+void ControlSocket::writeResponse(int fd, Connection& connection) {
+	while(!connection.output.empty()) {
+		ssize_t writtenBytes = write(fd, connection.output.data(), connection.output.size());
+		if(writtenBytes < 0) {
+			if(errno != EAGAIN) {
+				closeConnection(fd);
+			}
+			return;
+		}
+		connection.output.erase(0, writtenBytes);
+	}
+	closeConnection(fd);
+}
+
+string ControlSocket::execute(const string& line) {
+	string trimmed = line;
+	if(!trimmed.empty() && trimmed[trimmed.size() - 1] == '\r') {
+		trimmed.erase(trimmed.size() - 1);
+	}
+
+	size_t nameEnd = trimmed.find(' ');
+	string name = trimmed.substr(0, nameEnd);
+	string arguments = (nameEnd == string::npos) ? "" : trimmed.substr(nameEnd + 1);
+
+	map<string, Command>::iterator commandIt = commands.find(name);
+	if(commandIt == commands.end()) {
+		return "unknown command\n";
+	}
+
+	try {
+		return commandIt->second(arguments);
+	}
+	catch(exception& e) {
+		return string("error: ") + e.what() + "\n";
+	}
+}
+
+void ControlSocket::closeConnection(int fd) {
+	eventLoop.unwatch(fd);
+	connections.erase(fd);
+	close(fd);
+}
@@ -0,0 +1,35 @@
+#include "../inc/cpu_affinity.h"
+#include <sched.h>
+#include <string>
+#include <stdexcept>
+
+using namespace std;
+
+static cpu_set_t initialCores;
+static bool initialCoresSaved = false;
+
+void CpuAffinity::pin(pthread_t thread, int core) {
+	if(core < 0) {
+		return;
+	}
+	if(core >= CPU_SETSIZE) {
+		throw runtime_error("Core " + to_string(core) + " does not exist");
+	}
+
+	if(!initialCoresSaved) {
+		initialCoresSaved = sched_getaffinity(0, sizeof(initialCores), &initialCores) == 0;
+	}
+
+	cpu_set_t cores;
+	CPU_ZERO(&cores);
+	CPU_SET(core, &cores);
+	if(pthread_setaffinity_np(thread, sizeof(cores), &cores) != 0) {
+		throw runtime_error("Could not pin thread to core " + to_string(core));
+	}
+}
+
+void CpuAffinity::unpin(pthread_t thread) {
+	if(initialCoresSaved) {
+		pthread_setaffinity_np(thread, sizeof(initialCores), &initialCores);
+	}
+}
@@ -0,0 +1,56 @@
+#include "../inc/crc32c.h"
+#include <string.h>
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLYNOMIAL 0x82f63b78
+
+uint32_t Crc32c::table[8][256];
+/* Built during static initialization, before any loader thread may use it */
+bool Crc32c::tableReady = Crc32c::buildTable();
+
+bool Crc32c::buildTable() {
+	for(uint32_t i = 0; i < 256; ++i) {
+		uint32_t crc = i;
+		for(unsigned bit = 0; bit < 8; ++bit) {
+			crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLYNOMIAL : (crc >> 1);
+		}
+		table[0][i] = crc;
+	}
+	for(uint32_t i = 0; i < 256; ++i) {
+		for(unsigned slice = 1; slice < 8; ++slice) {
+			table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xff];
+		}
+	}
+	return true;
+}
+
+uint32_t Crc32c::compute(const void* data, size_t length, uint32_t crc) {
+	const uint8_t* bytes = (const uint8_t*)data;
+	crc = ~crc;
+
+#ifdef __SSE4_2__
+	for(; length >= sizeof(uint64_t); length -= sizeof(uint64_t), bytes += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, bytes, sizeof(word));
+		crc = (uint32_t)_mm_crc32_u64(crc, word);
+	}
+	for(; length > 0; --length) {
+		crc = _mm_crc32_u8(crc, *(bytes++));
+	}
+#else
+	/* Slicing-by-8, expects little endian words */
+	for(; length >= sizeof(uint64_t); length -= sizeof(uint64_t), bytes += sizeof(uint64_t)) {
+		uint32_t low = crc ^ (bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24));
+		crc = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff] ^ table[5][(low >> 16) & 0xff] ^ table[4][low >> 24]
+			^ table[3][bytes[4]] ^ table[2][bytes[5]] ^ table[1][bytes[6]] ^ table[0][bytes[7]];
+	}
+	for(; length > 0; --length) {
+		crc = (crc >> 8) ^ table[0][(crc ^ *(bytes++)) & 0xff];
+	}
+#endif
+
+	return ~crc;
+}
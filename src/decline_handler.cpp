@@ -1,9 +1,12 @@
 #include "../inc/decline_handler.h"
+#include "../inc/tracepoints.h"
 
-DeclineHandler::DeclineHandler(TransactionsStorage& storage, Client& clientToHandle, AddressesAllocator& addrAllocator, Server& serv)
-	: transactionsStorage(storage), client(clientToHandle), allocator(addrAllocator), server(serv) {}
+DeclineHandler::DeclineHandler(TransactionsStorage& storage, Client& clientToHandle, AddressesAllocator& addrAllocator, Server& serv, Sender& responseSender)
+	: transactionsStorage(storage), client(clientToHandle), allocator(addrAllocator), server(serv), sender(responseSender) {}
 
 
-void DeclineHandler::handle(struct DHCPMessage&, Options&, uint32_t dstAddr) {
+void DeclineHandler::handle(struct DHCPMessage& message, Options&, uint32_t dstAddr) {
+	TRACE4(handler__entry, DHCPDECLINE, message.xid, tracedClientKey(client), client.networkAddress);
 	allocator.freeClientAddressButLeaveUnavailable(client);
+	TRACE5(handler__exit, DHCPDECLINE, message.xid, tracedClientKey(client), client.networkAddress, 0);
 }
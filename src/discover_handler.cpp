@@ -1,17 +1,33 @@
 #include "../inc/discover_handler.h"
 #include "../inc/packer.h"
+#include "../inc/stage_profiler.h"
 #include "../inc/protocol.h"
+#include "../inc/tracepoints.h"
+#include "../inc/lease_times.h"
 
-DiscoverHandler::DiscoverHandler(TransactionsStorage& storage, Client& clientToHandle, AddressesAllocator& addrAllocator, Server& serv)
-	: transactionsStorage(storage), client(clientToHandle), allocator(addrAllocator), server(serv) {}
+DiscoverHandler::DiscoverHandler(TransactionsStorage& storage, Client& clientToHandle, AddressesAllocator& addrAllocator, Server& serv, Sender& responseSender)
+	: transactionsStorage(storage), client(clientToHandle), allocator(addrAllocator), server(serv), sender(responseSender), poolExhausted(false) {}
 
 void DiscoverHandler::handle(struct DHCPMessage& message, Options& options, uint32_t dstAddr) {
+	TRACE4(handler__entry, DHCPDISCOVER, message.xid, tracedClientKey(client), client.networkAddress);
+	uint32_t offeredAddress = 0;
 	if(!transactionsStorage.transactionExists(message.xid)) {
-		AllocatedAddress& address = allocator.hasClientAllocatedAddress(client) ? allocator.refreshLeaseTime(client) : allocator.allocateAddressFor(client);
-
-		transactionsStorage.createTransaction(message.xid, &address);
-		sendOffer(message, address);
+		AllocatedAddress* address = allocator.hasClientAllocatedAddress(client) ? &allocator.refreshLeaseTime(client) : allocator.allocateAddressFor(client);
+		if(address == NULL) {
+			/* Client retransmits and gets an offer once an address is released or a lease expires */
+			poolExhausted = true;
+		}
+		else {
+			transactionsStorage.createTransaction(message.xid, address);
+			sendOffer(message, *address);
+			offeredAddress = address->ipAddress;
+		}
 	}
+	TRACE5(handler__exit, DHCPDISCOVER, message.xid, tracedClientKey(client), client.networkAddress, offeredAddress);
+}
+
+bool DiscoverHandler::isPoolExhausted() {
+	return poolExhausted;
 }
 
 void DiscoverHandler::sendOffer(DHCPMessage& request, AllocatedAddress& allocatedAddress) {
@@ -28,14 +44,18 @@ void DiscoverHandler::sendOffer(DHCPMessage& request, AllocatedAddress& allocate
 	memcpy(offer.chaddr, request.chaddr, MAX_HADDR_SIZE);
 	offer.magicCookie = request.magicCookie;
 
+	PROFILE_BEGIN(packStart);
 	Packer packer(offer.options);
 	packer.pack(IP_ADDRESS_LEASE_TIME, allocatedAddress.leaseTime)
+		.pack(RENEWAL_TIME, LeaseTimes::renewalTime(*allocatedAddress.descriptor, allocatedAddress.ipAddress, allocatedAddress.leaseTime))
+		.pack(REBINDING_TIME, LeaseTimes::rebindingTime(allocatedAddress.leaseTime))
 		.pack(DHCP_MESSAGE_TYPE, (uint8_t)DHCPOFFER)
-		.pack(SERVER_IDENTIFIER, server.serverIp)
-		.pack(SUBNET_MASK, allocatedAddress.mask)
-		.pack(ROUTERS, allocatedAddress.routers)
-		.pack(DNS_OPTION, allocatedAddress.dnsServers)
+		.pack(SERVER_IDENTIFIER, server.getServerIp(client))
+		.pack(SUBNET_MASK, allocatedAddress.descriptor->networkMask)
+		.pack(ROUTERS, allocatedAddress.descriptor->options->routers)
+		.pack(DNS_OPTION, allocatedAddress.descriptor->options->dnsServers)
 		.pack(END_OPTION);
+	PROFILE_END(packStart, STAGE_PACK);
 
-	server.sender->send(offer, DHCPOFFER);
+	sender.send(offer, DHCPOFFER);
 }
@@ -0,0 +1,87 @@
+#include "../inc/event_loop.h"
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdexcept>
+
+using namespace std;
+
+EventLoop::EventLoop(): running(false) {
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if(epollFd < 0) {
+		throw runtime_error("Could not create epoll instance");
+	}
+}
+
+EventLoop::~EventLoop() {
+	close(epollFd);
+}
+
+void EventLoop::watch(int fd, uint32_t events, Handler handler) {
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.fd = fd;
+
+	if(epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+		throw runtime_error("Could not watch descriptor");
+	}
+	handlers[fd] = handler;
+}
+
+void EventLoop::modify(int fd, uint32_t events) {
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.fd = fd;
+
+	epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+}
+
+void EventLoop::unwatch(int fd) {
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+	handlers.erase(fd);
+}
+
+void EventLoop::run() {
+	running = true;
+	while(running) {
+		dispatch(-1);
+	}
+}
+
+void EventLoop::spin(function<void()> poller, unsigned rounds) {
+	running = true;
+	while(running) {
+		for(unsigned i = 0; i < rounds && running; ++i) {
+			poller();
+		}
+		dispatch(0);
+	}
+}
+
+void EventLoop::dispatch(int timeoutMs) {
+	struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+	int eventsCount = epoll_wait(epollFd, events, EVENT_LOOP_MAX_EVENTS, timeoutMs);
+	if(eventsCount < 0) {
+		if(errno == EINTR) {
+			return;
+		}
+		throw runtime_error("Waiting for events failed");
+	}
+
+	for(int i = 0; i < eventsCount && running; ++i) {
+		/* Handler may unwatch descriptors reported later in the same batch */
+		unordered_map<int, Handler>::iterator handlerIt = handlers.find(events[i].data.fd);
+		if(handlerIt != handlers.end()) {
+			Handler handler = handlerIt->second;
+			handler(events[i].events);
+		}
+	}
+}
+
+void EventLoop::stop() {
+	running = false;
+}
@@ -1,11 +1,14 @@
 #include "../inc/inform_handler.h"
 #include "../inc/packer.h"
+#include "../inc/stage_profiler.h"
+#include "../inc/tracepoints.h"
 
-InformHandler::InformHandler(TransactionsStorage& storage, Client& clientToHandle, AddressesAllocator& addrAllocator, Server& serv)
-	: transactionsStorage(storage), client(clientToHandle), allocator(addrAllocator), server(serv) {}
+InformHandler::InformHandler(TransactionsStorage& storage, Client& clientToHandle, AddressesAllocator& addrAllocator, Server& serv, Sender& responseSender)
+	: transactionsStorage(storage), client(clientToHandle), allocator(addrAllocator), server(serv), sender(responseSender) {}
 
 
 void InformHandler::handle(struct DHCPMessage& message, Options& options, uint32_t dstAddr) {
+	TRACE4(handler__entry, DHCPINFORM, message.xid, tracedClientKey(client), client.networkAddress);
 	if(allocator.hasClientAllocatedAddress(client)) {
 		DHCPMessage ack;
 		memset(&ack, 0, sizeof(ack));
@@ -22,14 +25,17 @@ void InformHandler::handle(struct DHCPMessage& message, Options& options, uint32
 
 		const AllocatedAddress& allocatedAddress = allocator.getAllocatedAddress(client);
 
+		PROFILE_BEGIN(packStart);
 		Packer packer(ack.options);
 		packer.pack(DHCP_MESSAGE_TYPE, (uint8_t)DHCPACK)
-			.pack(SERVER_IDENTIFIER, server.serverIp)
-			.pack(SUBNET_MASK, allocatedAddress.mask)
-			.pack(ROUTERS, allocatedAddress.routers)
-			.pack(DNS_OPTION, allocatedAddress.dnsServers)
+			.pack(SERVER_IDENTIFIER, server.getServerIp(client))
+			.pack(SUBNET_MASK, allocatedAddress.descriptor->networkMask)
+			.pack(ROUTERS, allocatedAddress.descriptor->options->routers)
+			.pack(DNS_OPTION, allocatedAddress.descriptor->options->dnsServers)
 			.pack(END_OPTION);
+		PROFILE_END(packStart, STAGE_PACK);
 		
-		server.sender->send(ack, DHCPACK);
+		sender.send(ack, DHCPACK);
 	}
+	TRACE5(handler__exit, DHCPINFORM, message.xid, tracedClientKey(client), client.networkAddress, 0);
 }
@@ -0,0 +1,38 @@
+#include "../inc/lease_times.h"
+
+uint32_t LeaseTimes::leaseTime(const PoolDescriptor& descriptor, uint32_t ipAddress) {
+	uint32_t leaseTime = spread(descriptor.leaseTime, descriptor.leaseJitter, mix(ipAddress));
+	return leaseTime ? leaseTime : 1;
+}
+
+/* Different seed than lease time, so T1 is not tied to the lease length */
+uint32_t LeaseTimes::renewalTime(const PoolDescriptor& descriptor, uint32_t ipAddress, uint32_t leaseTime) {
+	uint32_t renewalTime = (uint64_t)leaseTime * RENEWAL_TIME_NUMERATOR / RENEWAL_TIME_DENOMINATOR;
+	renewalTime = spread(renewalTime, descriptor.leaseJitter, mix(~ipAddress));
+
+	uint32_t rebinding = rebindingTime(leaseTime);
+	return renewalTime < rebinding ? renewalTime : rebinding;
+}
+
+uint32_t LeaseTimes::rebindingTime(uint32_t leaseTime) {
+	return (uint64_t)leaseTime * REBINDING_TIME_NUMERATOR / REBINDING_TIME_DENOMINATOR;
+}
+
+uint32_t LeaseTimes::spread(uint32_t value, uint32_t jitterPercent, uint32_t seed) {
+	uint64_t window = (uint64_t)value * jitterPercent / 100;
+	if(window == 0) {
+		return value;
+	}
+	return value - window / 2 + seed % (window + 1);
+}
+
+/* Finalizer of MurmurHash3, neighbouring addresses end up far apart in the window */
+uint32_t LeaseTimes::mix(uint32_t seed) {
+	seed ^= seed >> 16;
+	seed *= 0x85ebca6b;
+	seed ^= seed >> 13;
+	seed *= 0xc2b2ae35;
+	seed ^= seed >> 16;
+
+	return seed;
+}
@@ -0,0 +1,104 @@
+#include "../inc/legacy_state_deserializer.h"
+
+using namespace std;
+
+LegacyStateDeserializer::LegacyStateDeserializer(const char* filePath): valid(false) {
+	file = fopen(filePath, "rb");
+	if(file == NULL) {
+		return;
+	}
+
+	valid = readLeases(hardwareLeases) && readLeases(specialIdLeases) && readPools() && fgetc(file) == EOF;
+	fclose(file);
+	file = NULL;
+}
+
+bool LegacyStateDeserializer::isValid() {
+	return valid;
+}
+
+const vector<LegacyLease<HardwareAddress> >& LegacyStateDeserializer::getHardwareLeases() {
+	return hardwareLeases;
+}
+
+const vector<LegacyLease<ClientSpecialId> >& LegacyStateDeserializer::getSpecialIdLeases() {
+	return specialIdLeases;
+}
+
+const vector<LegacyPool>& LegacyStateDeserializer::getPools() {
+	return pools;
+}
+
+/* Networks count, then every network with its leases count, each lease followed by its mask, DNS servers and routers */
+template <class T> bool LegacyStateDeserializer::readLeases(vector<LegacyLease<T> >& leases) {
+	uint32_t networksCount = 0;
+	if(!read(networksCount)) {
+		return false;
+	}
+
+	for(uint32_t networkIdx = 0; networkIdx < networksCount; ++networkIdx) {
+		uint32_t networkAddress = 0;
+		uint32_t leasesCount = 0;
+		if(!read(networkAddress) || !read(leasesCount)) {
+			return false;
+		}
+
+		for(uint32_t leaseIdx = 0; leaseIdx < leasesCount; ++leaseIdx) {
+			LegacyLease<T> lease;
+			uint32_t mask = 0;
+			lease.networkAddress = networkAddress;
+			if(!readClientId(lease.clientId) || !read(lease.ipAddress) || !read(mask) || !read(lease.leaseTime)
+				|| !read(lease.allocationTime) || !skipList() || !skipList()) {
+				return false;
+			}
+			leases.push_back(lease);
+		}
+	}
+
+	return true;
+}
+
+/* Every pool is preceded by its network once more */
+bool LegacyStateDeserializer::readPools() {
+	uint32_t poolsCount = 0;
+	if(!read(poolsCount)) {
+		return false;
+	}
+
+	for(uint32_t i = 0; i < poolsCount; ++i) {
+		LegacyPool pool;
+		uint32_t poolKey = 0;
+		uint32_t abandonedCount = 0;
+		if(!read(poolKey) || !read(pool.networkAddress) || !read(pool.nextToAssign) || !read(abandonedCount)) {
+			return false;
+		}
+
+		for(uint32_t j = 0; j < abandonedCount; ++j) {
+			uint32_t address = 0;
+			if(!read(address)) {
+				return false;
+			}
+			pool.abandonedAddresses.push_back(address);
+		}
+		pools.push_back(pool);
+	}
+
+	return true;
+}
+
+bool LegacyStateDeserializer::readClientId(HardwareAddress& hardwareAddress) {
+	return read(hardwareAddress.addressType) && read(hardwareAddress.hardwareAddress);
+}
+
+bool LegacyStateDeserializer::readClientId(ClientSpecialId& specialId) {
+	return read(specialId.type) && read(specialId.value);
+}
+
+bool LegacyStateDeserializer::skipList() {
+	uint32_t elementsCount = 0;
+	return read(elementsCount) && fseek(file, (long)elementsCount * sizeof(uint32_t), SEEK_CUR) == 0;
+}
+
+template <class V> bool LegacyStateDeserializer::read(V& value) {
+	return fread(&value, sizeof(value), 1, file) == 1;
+}
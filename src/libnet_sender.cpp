@@ -0,0 +1,89 @@
+#include "../inc/libnet_sender.h"
+#include "../inc/protocol.h"
+#include "../inc/option.h"
+#include "../inc/packet_converter.h"
+#include "../inc/options.h"
+#include "../inc/stage_profiler.h"
+
+#include <linux/if_ether.h>
+
+#define BROADCAST_ADDR_LEN 6
+
+LibnetSender::LibnetSender(libnet_t* lnetHandle) {
+	this->lnetHandle = lnetHandle;
+	memset(sourceHardwareAddress, 0, ETHER_ADDR_LEN);
+
+	struct libnet_ether_addr* hardwareAddress = libnet_get_hwaddr(lnetHandle);
+	if(hardwareAddress != NULL) {
+		memcpy(sourceHardwareAddress, hardwareAddress->ether_addr_octet, ETHER_ADDR_LEN);
+	}
+}
+
+void LibnetSender::send(DHCPMessage& response, unsigned messageType) {
+	VlanTags untagged;
+	untagged.count = 0;
+	sendTagged(response, messageType, untagged);
+}
+
+void LibnetSender::sendTagged(DHCPMessage& response, unsigned messageType, const VlanTags& vlanTags) {
+	PROFILE_SCOPE(STAGE_SEND);
+	uint32_t targetIpAddress = 0;
+	uint8_t targetHardwareAddress[BROADCAST_ADDR_LEN];
+	fillBroadcastAddress(targetHardwareAddress);
+
+	if(response.giaddr != 0) {
+		targetIpAddress = response.giaddr;
+		if(messageType == DHCPNAK) {
+			response.flags |= BROADCAST_FLAG;
+		}
+	}
+	else if(messageType == DHCPNAK) {
+		targetIpAddress = IP_BROADCAST_ADDR;
+	}
+	else if(response.giaddr == 0 && response.ciaddr != 0) {
+		targetIpAddress = response.ciaddr;
+	}
+	else if(response.flags & BROADCAST_FLAG) {
+		targetIpAddress = IP_BROADCAST_ADDR;
+	}
+	else {
+		targetIpAddress = response.yiaddr;
+		memcpy(targetHardwareAddress, response.chaddr, BROADCAST_ADDR_LEN);
+	}
+
+	PacketConverter::toNetworkReprezentation(response);
+	Options options(response.options);
+	options.toNetworkReprezentation();
+
+	libnet_build_udp(Protocol::getServicePortByName("bootps", "udp"), Protocol::getServicePortByName("bootpc", "udp"), LIBNET_UDP_H + sizeof(response), 0, (uint8_t*)&response, sizeof(response), lnetHandle, 0);
+
+	libnet_autobuild_ipv4(LIBNET_IPV4_H + LIBNET_UDP_H + sizeof(response), IPPROTO_UDP, htonl(targetIpAddress), lnetHandle);
+
+	buildEthernet(targetHardwareAddress, vlanTags);
+
+	libnet_write(lnetHandle);
+	libnet_clear_packet(lnetHandle);
+}
+
+/*
+ * libnet builds a single 802.1Q header, the inner tag of a QinQ frame is passed as its payload,
+ * which lands between the outer tag and the IP header.
+ */
+void LibnetSender::buildEthernet(uint8_t* targetHardwareAddress, const VlanTags& vlanTags) {
+	if(vlanTags.count == 0) {
+		libnet_autobuild_ethernet(targetHardwareAddress, ETH_P_IP, lnetHandle);
+		return;
+	}
+
+	uint16_t outerControl = vlanTags.controls[0];
+	uint16_t innerTag[2] = {htons(vlanTags.controls[1]), htons(ETH_P_IP)};
+	bool doubleTagged = vlanTags.count > 1;
+
+	libnet_build_802_1q(targetHardwareAddress, sourceHardwareAddress, vlanTags.protocols[0], outerControl >> 13, (outerControl >> 12) & 1, outerControl & VLAN_ID_MASK,
+		doubleTagged ? vlanTags.protocols[1] : ETH_P_IP, doubleTagged ? (uint8_t*)innerTag : NULL, doubleTagged ? sizeof(innerTag) : 0, lnetHandle, 0);
+}
+
+void LibnetSender::fillBroadcastAddress(uint8_t* buffer) {
+	uint8_t broadcastAddr[BROADCAST_ADDR_LEN] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+	memcpy(buffer, broadcastAddr, BROADCAST_ADDR_LEN);
+}
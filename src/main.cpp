@@ -2,29 +2,25 @@
 #include "../inc/addresses_allocator.h"
 #include "../inc/server.h"
 #include "../inc/transactions_storage.h"
+#include "../inc/clock.h"
+#include <string.h>
 
-#include <signal.h>
-#include <stdlib.h>
-
-Server* server;
-
-void finish(int signum) {
-	server->save();
-	delete server;
-
-	exit(EXIT_SUCCESS);
-}
-
+/* "--compile-config source target" writes binary configuration, which may be used instead of config.json */
 int main(int argc, char** argv) {
-	signal(SIGINT, finish);
-
-	/* Static objects will be auto cleaned after calling exit() */
-	static Config config("config.json");
-	static TransactionsStorage storage(config);
-	static AddressesAllocator allocator(config);
-
-	server = new Server(config, allocator, storage);
-	server->listen();
+	if(argc == 4 && strcmp(argv[1], "--compile-config") == 0) {
+		Config source(argv[2]);
+		source.compile(argv[3]);
+		return 0;
+	}
+
+	Config config(argc > 1 ? argv[1] : "config.json");
+	CoarseClock clock;
+	TransactionsStorage storage(config, clock);
+	AddressesAllocator allocator(config, clock);
+
+	Server server(config, allocator, storage, clock);
+	server.listen();
+	server.save();
 
 	return 0;
 }
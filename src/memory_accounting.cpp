@@ -0,0 +1,129 @@
+#include "../inc/memory_accounting.h"
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <mutex>
+#include <sstream>
+
+using namespace std;
+
+static const char* subsystemNames[MEMORY_SUBSYSTEMS_COUNT] = {
+	"leases", "pools", "transactions", "reply_cache", "io_buffers"
+};
+
+struct MemoryShard {
+	MemoryShard() {
+		for(unsigned i = 0; i < MEMORY_SUBSYSTEMS_COUNT; ++i) {
+			bytes[i] = 0;
+			peaks[i] = 0;
+		}
+	}
+
+	atomic<int64_t> bytes[MEMORY_SUBSYSTEMS_COUNT];
+	/* Highest bytes since the last merge, reset to current bytes by it */
+	atomic<int64_t> peaks[MEMORY_SUBSYSTEMS_COUNT];
+};
+
+static mutex shardsMutex;
+static vector<MemoryShard*> shards;
+/* Bytes counted by threads which already exited, memory may be released by another thread */
+static MemoryShard retiredShard;
+static atomic<int64_t> highWaterMarks[MEMORY_SUBSYSTEMS_COUNT];
+
+static void mergePeaks();
+
+static void raisePeak(atomic<int64_t>& peak, int64_t bytes) {
+	int64_t knownPeak = peak.load(memory_order_relaxed);
+	while(bytes > knownPeak && !peak.compare_exchange_weak(knownPeak, bytes, memory_order_relaxed)) {}
+}
+
+struct ThreadShard {
+	ThreadShard(): shard(new MemoryShard()) {
+		lock_guard<mutex> lock(shardsMutex);
+		shards.push_back(shard);
+	}
+
+	~ThreadShard() {
+		lock_guard<mutex> lock(shardsMutex);
+		mergePeaks();
+		for(unsigned i = 0; i < MEMORY_SUBSYSTEMS_COUNT; ++i) {
+			retiredShard.bytes[i].fetch_add(shard->bytes[i].load(memory_order_relaxed), memory_order_relaxed);
+		}
+		shards.erase(find(shards.begin(), shards.end(), shard));
+		delete shard;
+	}
+
+	MemoryShard* shard;
+};
+
+static thread_local ThreadShard threadShard;
+
+/* Peak is only contended when a merge resets it at the same time */
+void MemoryAccounting::allocated(MemorySubsystem subsystem, size_t bytes) {
+	MemoryShard* shard = threadShard.shard;
+	atomic<int64_t>& counter = shard->bytes[subsystem];
+	int64_t current = counter.load(memory_order_relaxed) + (int64_t)bytes;
+	counter.store(current, memory_order_relaxed);
+	raisePeak(shard->peaks[subsystem], current);
+}
+
+void MemoryAccounting::released(MemorySubsystem subsystem, size_t bytes) {
+	atomic<int64_t>& counter = threadShard.shard->bytes[subsystem];
+	counter.store(counter.load(memory_order_relaxed) - (int64_t)bytes, memory_order_relaxed);
+}
+
+/* Memory released by a different thread than the one which allocated it makes single shards negative, the sum stays exact */
+int64_t MemoryAccounting::getBytes(MemorySubsystem subsystem) {
+	lock_guard<mutex> lock(shardsMutex);
+	int64_t bytes = retiredShard.bytes[subsystem].load(memory_order_relaxed);
+	for(vector<MemoryShard*>::iterator it = shards.begin(); it != shards.end(); it++) {
+		bytes += (*it)->bytes[subsystem].load(memory_order_relaxed);
+	}
+
+	return bytes;
+}
+
+/*
+ * Called with shards locked. Sum of values every shard reached at any moment since the previous merge
+ * is at least the sum at any single moment. Shards are left with their current bytes as the next peak,
+ * so memory moved between threads does not accumulate across merges. Peak is taken before bytes are read,
+ * an allocation racing with the merge lands in one of the two windows.
+ */
+static void mergePeaks() {
+	for(unsigned i = 0; i < MEMORY_SUBSYSTEMS_COUNT; ++i) {
+		int64_t peak = retiredShard.bytes[i].load(memory_order_relaxed);
+		for(vector<MemoryShard*>::iterator it = shards.begin(); it != shards.end(); it++) {
+			int64_t shardPeak = (*it)->peaks[i].exchange(numeric_limits<int64_t>::min(), memory_order_relaxed);
+			int64_t bytes = (*it)->bytes[i].load(memory_order_relaxed);
+			raisePeak((*it)->peaks[i], bytes);
+			peak += max(shardPeak, bytes);
+		}
+		if(peak > highWaterMarks[i].load(memory_order_relaxed)) {
+			highWaterMarks[i].store(peak, memory_order_relaxed);
+		}
+	}
+}
+
+void MemoryAccounting::sample() {
+	lock_guard<mutex> lock(shardsMutex);
+	mergePeaks();
+}
+
+/* Bytes per lease include the client index, both live in the same map nodes */
+string MemoryAccounting::render(uint64_t leasesCount) {
+	sample();
+
+	ostringstream bytes, highWater;
+	bytes << "# TYPE dhcp_memory_bytes gauge\n";
+	highWater << "# TYPE dhcp_memory_high_water_bytes gauge\n";
+	for(unsigned i = 0; i < MEMORY_SUBSYSTEMS_COUNT; ++i) {
+		bytes << "dhcp_memory_bytes{subsystem=\"" << subsystemNames[i] << "\"} " << getBytes((MemorySubsystem)i) << "\n";
+		highWater << "dhcp_memory_high_water_bytes{subsystem=\"" << subsystemNames[i] << "\"} " << highWaterMarks[i].load(memory_order_relaxed) << "\n";
+	}
+
+	ostringstream perLease;
+	perLease << "# TYPE dhcp_memory_bytes_per_lease gauge\n"
+		<< "dhcp_memory_bytes_per_lease " << (leasesCount ? getBytes(MEMORY_LEASES) / (int64_t)leasesCount : 0) << "\n";
+
+	return bytes.str() + highWater.str() + perLease.str();
+}
@@ -0,0 +1,210 @@
+#include "../inc/metrics.h"
+#include <sys/time.h>
+#include <sstream>
+
+using namespace std;
+
+static const char* messageTypeNames[METRICS_MESSAGE_TYPES] = {
+	"other", "discover", "offer", "request", "decline", "ack", "nak", "release", "inform"
+};
+
+static const char* dropReasonNames[DROP_REASONS_COUNT] = {
+	"malformed", "rate_limited", "not_owned", "standby", "queue_full", "unknown_network", "pool_exhausted"
+};
+
+/* Same order as ClientState in request_handler.h */
+static const char* clientStateNames[METRICS_CLIENT_STATES] = {
+	"selecting", "init_reboot", "renewing", "rebinding", "unknown"
+};
+
+static const double latencyQuantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+MetricsShard::MetricsShard() {
+	for(unsigned i = 0; i < METRICS_MESSAGE_TYPES; ++i) {
+		received[i] = 0;
+		replied[i] = 0;
+	}
+	for(unsigned i = 0; i < DROP_REASONS_COUNT; ++i) {
+		dropped[i] = 0;
+	}
+	for(unsigned i = 0; i < METRICS_CLIENT_STATES; ++i) {
+		requestStates[i] = 0;
+	}
+	for(unsigned i = 0; i < LATENCY_BUCKETS; ++i) {
+		latency[i] = 0;
+		captureDelay[i] = 0;
+	}
+	latencySum = 0;
+	captureDelaySum = 0;
+}
+
+void MetricsShard::increment(atomic<uint64_t>& counter, uint64_t value) {
+	counter.store(counter.load(memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+unsigned MetricsShard::messageTypeIndex(unsigned messageType) {
+	return messageType < METRICS_MESSAGE_TYPES ? messageType : 0;
+}
+
+void MetricsShard::countReceived(unsigned messageType) {
+	increment(received[messageTypeIndex(messageType)]);
+}
+
+void MetricsShard::countReplied(unsigned messageType) {
+	increment(replied[messageTypeIndex(messageType)]);
+}
+
+void MetricsShard::countDropped(DropReason reason) {
+	increment(dropped[reason]);
+}
+
+void MetricsShard::countRequestState(unsigned clientState) {
+	if(clientState < METRICS_CLIENT_STATES) {
+		increment(requestStates[clientState]);
+	}
+}
+
+void MetricsShard::recordLatency(int64_t microseconds) {
+	record(latency, latencySum, microseconds);
+}
+
+void MetricsShard::recordCaptureDelay(int64_t microseconds) {
+	record(captureDelay, captureDelaySum, microseconds);
+}
+
+void MetricsShard::record(atomic<uint64_t>* buckets, atomic<uint64_t>& sum, int64_t microseconds) {
+	if(microseconds < 0) {
+		microseconds = 0;
+	}
+	increment(buckets[Metrics::latencyBucket(microseconds)]);
+	increment(sum, microseconds);
+}
+
+Metrics::~Metrics() {
+	for(vector<MetricsShard*>::iterator it = shards.begin(); it != shards.end(); it++) {
+		delete *it;
+	}
+}
+
+MetricsShard* Metrics::createShard() {
+	shards.push_back(new MetricsShard());
+	return shards.back();
+}
+
+int64_t Metrics::wallClockUs() {
+	struct timeval time;
+	gettimeofday(&time, NULL);
+
+	return (int64_t)time.tv_sec * 1000000 + time.tv_usec;
+}
+
+unsigned Metrics::latencyBucket(int64_t microseconds) {
+	uint64_t value = microseconds;
+	if(value < LATENCY_EXACT_BUCKETS) {
+		return value;
+	}
+
+	unsigned exponent = 63 - __builtin_clzll(value);
+	if(exponent > LATENCY_MAX_EXPONENT) {
+		return LATENCY_BUCKETS - 1;
+	}
+	unsigned subBucket = (value >> (exponent - LATENCY_SUB_BUCKETS_BITS)) & ((1 << LATENCY_SUB_BUCKETS_BITS) - 1);
+
+	return LATENCY_EXACT_BUCKETS + ((exponent - LATENCY_SUB_BUCKETS_BITS) << LATENCY_SUB_BUCKETS_BITS) + subBucket;
+}
+
+/* Exclusive upper bound of values counted in bucket */
+uint64_t Metrics::latencyBucketUpperBound(unsigned bucket) {
+	if(bucket < LATENCY_EXACT_BUCKETS) {
+		return bucket + 1;
+	}
+
+	unsigned shift = (bucket - LATENCY_EXACT_BUCKETS) >> LATENCY_SUB_BUCKETS_BITS;
+	uint64_t subBucket = (bucket - LATENCY_EXACT_BUCKETS) & ((1 << LATENCY_SUB_BUCKETS_BITS) - 1);
+
+	return ((1 << LATENCY_SUB_BUCKETS_BITS) + subBucket + 1) << shift;
+}
+
+template <size_t N> void Metrics::sum(atomic<uint64_t> (MetricsShard::*counters)[N], uint64_t* totals) {
+	for(size_t i = 0; i < N; ++i) {
+		totals[i] = 0;
+	}
+	for(vector<MetricsShard*>::iterator it = shards.begin(); it != shards.end(); it++) {
+		atomic<uint64_t>* shardCounters = (*it)->*counters;
+		for(size_t i = 0; i < N; ++i) {
+			totals[i] += shardCounters[i].load(memory_order_relaxed);
+		}
+	}
+}
+
+uint64_t Metrics::sum(atomic<uint64_t> MetricsShard::*counter) {
+	uint64_t total = 0;
+	for(vector<MetricsShard*>::iterator it = shards.begin(); it != shards.end(); it++) {
+		total += ((*it)->*counter).load(memory_order_relaxed);
+	}
+
+	return total;
+}
+
+/*
+ * Histogram is exported with power of two boundaries, full resolution
+ * is used for quantiles, which are reported as bucket upper bounds.
+ */
+void Metrics::renderLatency(ostringstream& output, const char* name, const uint64_t* buckets, uint64_t sum) {
+	uint64_t count = 0;
+	output << "# TYPE " << name << "_microseconds histogram\n";
+	for(unsigned i = 0; i < LATENCY_BUCKETS; ++i) {
+		count += buckets[i];
+		uint64_t upperBound = latencyBucketUpperBound(i);
+		if((upperBound & (upperBound - 1)) == 0 && i != LATENCY_BUCKETS - 1) {
+			output << name << "_microseconds_bucket{le=\"" << upperBound << "\"} " << count << "\n";
+		}
+	}
+	output << name << "_microseconds_bucket{le=\"+Inf\"} " << count << "\n"
+		<< name << "_microseconds_sum " << sum << "\n"
+		<< name << "_microseconds_count " << count << "\n";
+
+	output << "# TYPE " << name << "_quantile_microseconds gauge\n";
+	for(unsigned q = 0; q < sizeof(latencyQuantiles) / sizeof(latencyQuantiles[0]); ++q) {
+		uint64_t rank = (uint64_t)(latencyQuantiles[q] * count), seen = 0;
+		unsigned bucket = 0;
+		for(; bucket < LATENCY_BUCKETS - 1 && (seen += buckets[bucket]) <= rank; ++bucket);
+		output << name << "_quantile_microseconds{quantile=\"" << latencyQuantiles[q] << "\"} "
+			<< (count ? latencyBucketUpperBound(bucket) : 0) << "\n";
+	}
+}
+
+string Metrics::render() {
+	uint64_t received[METRICS_MESSAGE_TYPES], replied[METRICS_MESSAGE_TYPES];
+	uint64_t dropped[DROP_REASONS_COUNT], requestStates[METRICS_CLIENT_STATES];
+	uint64_t latency[LATENCY_BUCKETS], captureDelay[LATENCY_BUCKETS];
+	sum(&MetricsShard::received, received);
+	sum(&MetricsShard::replied, replied);
+	sum(&MetricsShard::dropped, dropped);
+	sum(&MetricsShard::requestStates, requestStates);
+	sum(&MetricsShard::latency, latency);
+	sum(&MetricsShard::captureDelay, captureDelay);
+
+	ostringstream output;
+	output << "# TYPE dhcp_received_total counter\n";
+	for(unsigned i = 0; i < METRICS_MESSAGE_TYPES; ++i) {
+		output << "dhcp_received_total{type=\"" << messageTypeNames[i] << "\"} " << received[i] << "\n";
+	}
+	output << "# TYPE dhcp_replied_total counter\n";
+	for(unsigned i = 0; i < METRICS_MESSAGE_TYPES; ++i) {
+		output << "dhcp_replied_total{type=\"" << messageTypeNames[i] << "\"} " << replied[i] << "\n";
+	}
+	output << "# TYPE dhcp_dropped_total counter\n";
+	for(unsigned i = 0; i < DROP_REASONS_COUNT; ++i) {
+		output << "dhcp_dropped_total{reason=\"" << dropReasonNames[i] << "\"} " << dropped[i] << "\n";
+	}
+	output << "# TYPE dhcp_request_state_total counter\n";
+	for(unsigned i = 0; i < METRICS_CLIENT_STATES; ++i) {
+		output << "dhcp_request_state_total{state=\"" << clientStateNames[i] << "\"} " << requestStates[i] << "\n";
+	}
+
+	renderLatency(output, "dhcp_reply_latency", latency, sum(&MetricsShard::latencySum));
+	renderLatency(output, "dhcp_capture_delay", captureDelay, sum(&MetricsShard::captureDelaySum));
+
+	return output.str();
+}
@@ -0,0 +1,125 @@
+#include "../inc/metrics_endpoint.h"
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+MetricsEndpoint::MetricsEndpoint(EventLoop& loop, const char* listenAddress, uint16_t port, Renderer metricsRenderer)
+	: eventLoop(loop), renderer(metricsRenderer) {
+
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	if(inet_pton(AF_INET, listenAddress, &address.sin_addr) != 1) {
+		throw runtime_error("Invalid metrics address");
+	}
+
+	listeningFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(listeningFd < 0) {
+		throw runtime_error("Could not create metrics socket");
+	}
+
+	int reuse = 1;
+	setsockopt(listeningFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	if(bind(listeningFd, (struct sockaddr*)&address, sizeof(address)) < 0 || ::listen(listeningFd, SOMAXCONN) < 0) {
+		close(listeningFd);
+		throw runtime_error("Could not bind metrics socket");
+	}
+
+	eventLoop.watch(listeningFd, EPOLLIN, [this](uint32_t) { acceptConnection(); });
+}
+
+MetricsEndpoint::~MetricsEndpoint() {
+	while(!connections.empty()) {
+		closeConnection(connections.begin()->first);
+	}
+	eventLoop.unwatch(listeningFd);
+	close(listeningFd);
+}
+
+void MetricsEndpoint::acceptConnection() {
+	int fd;
+	while((fd = accept4(listeningFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		connections[fd] = Connection();
+		eventLoop.watch(fd, EPOLLIN | EPOLLRDHUP, [this, fd](uint32_t events) { handleConnection(fd, events); });
+	}
+}
+
+void MetricsEndpoint::handleConnection(int fd, uint32_t events) {
+	unordered_map<int, Connection>::iterator connectionIt = connections.find(fd);
+	if(connectionIt == connections.end()) {
+		return;
+	}
+	Connection& connection = connectionIt->second;
+
+	if(events & EPOLLIN) {
+		readRequest(fd, connection);
+	}
+	else if(events & EPOLLOUT) {
+		writeResponse(fd, connection);
+	}
+	else {
+		closeConnection(fd);
+	}
+}
+
+/* Request itself is not interpreted, headers are only read to the end before responding */
+void MetricsEndpoint::readRequest(int fd, Connection& connection) {
+	char buffer[METRICS_MAX_REQUEST_SIZE];
+	ssize_t readBytes = read(fd, buffer, sizeof(buffer));
+	if(readBytes <= 0) {
+		if(readBytes < 0 && errno == EAGAIN) {
+			return;
+		}
+		closeConnection(fd);
+		return;
+	}
+
+	connection.input.append(buffer, readBytes);
+	if(connection.input.find("\r\n\r\n") == string::npos && connection.input.find("\n\n") == string::npos) {
+		if(connection.input.size() > METRICS_MAX_REQUEST_SIZE) {
+			closeConnection(fd);
+		}
+		return;
+	}
+
+	string body = renderer();
+	ostringstream response;
+	response << "HTTP/1.0 200 OK\r\n"
+		<< "Content-Type: text/plain; version=0.0.4\r\n"
+		<< "Content-Length: " << body.size() << "\r\n"
+		<< "Connection: close\r\n\r\n"
+		<< body;
+
+	connection.output = response.str();
+	eventLoop.modify(fd, EPOLLOUT);
+	writeResponse(fd, connection);
+}
+
+void MetricsEndpoint::writeResponse(int fd, Connection& connection) {
+	while(!connection.output.empty()) {
+		ssize_t writtenBytes = write(fd, connection.output.data(), connection.output.size());
+		if(writtenBytes < 0) {
+			if(errno != EAGAIN) {
+				closeConnection(fd);
+			}
+			return;
+		}
+		connection.output.erase(0, writtenBytes);
+	}
+	closeConnection(fd);
+}
+
+void MetricsEndpoint::closeConnection(int fd) {
+	eventLoop.unwatch(fd);
+	connections.erase(fd);
+	close(fd);
+}
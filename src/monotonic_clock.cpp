@@ -0,0 +1,9 @@
+#include "../inc/monotonic_clock.h"
+#include <time.h>
+
+uint64_t MonotonicClock::nowMs() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &time);
+
+	return (uint64_t)time.tv_sec * 1000 + time.tv_nsec / 1000000;
+}
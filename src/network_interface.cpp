@@ -0,0 +1,123 @@
+#include "../inc/network_interface.h"
+#include "../inc/protocol.h"
+
+#include <stdio.h>
+#include <linux/if_ether.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <stdexcept>
+#include <errno.h>
+#include <sys/socket.h>
+
+#define MAX_FILTER_SIZE 128
+
+using namespace std;
+
+NetworkInterface::NetworkInterface(const InterfaceDescriptor& descriptor, uint8_t interfaceIndex): name(descriptor.name), index(interfaceIndex) {
+	serverIp = determineDeviceIp(name.c_str());
+
+	pcapHandle = pcap_create(name.c_str(), pcapErrbuf);
+	if(pcapHandle == NULL) {
+		throw runtime_error(pcapErrbuf);
+	}
+	pcap_set_snaplen(pcapHandle, 65535);
+	pcap_set_immediate_mode(pcapHandle, 1);
+	if(pcap_activate(pcapHandle) != 0) {
+		throw runtime_error(pcapErrbuf);
+	}
+	if(pcap_setnonblock(pcapHandle, 1, pcapErrbuf) < 0) {
+		throw runtime_error(pcapErrbuf);
+	}
+
+	lnetHandle = libnet_init(LIBNET_LINK, name.c_str(), lnetErrbuf);
+	if(lnetHandle == NULL) {
+		pcap_close(pcapHandle);
+		throw runtime_error(lnetErrbuf);
+	}
+	sender = new LibnetSender(lnetHandle);
+
+	setPacketsFilter(descriptor.networkMask, !descriptor.vlans.empty());
+}
+
+NetworkInterface::~NetworkInterface() {
+	delete sender;
+	libnet_destroy(lnetHandle);
+	pcap_close(pcapHandle);
+}
+
+uint32_t NetworkInterface::determineDeviceIp(const char* interfaceName) {
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+	struct ifreq ifr;
+	ifr.ifr_addr.sa_family = AF_INET;
+	strncpy(ifr.ifr_name, interfaceName, IFNAMSIZ-1);
+	ioctl(fd, SIOCGIFADDR, &ifr);
+	close(fd);
+
+	return ntohl(((struct sockaddr_in *)&ifr.ifr_addr)->sin_addr.s_addr);
+}
+
+/* Each "vlan" moves following checks past one more tag, so a trunk matches untagged, single and double tagged frames */
+void NetworkInterface::setPacketsFilter(uint32_t networkMask, bool trunk) {
+	struct bpf_program fp;
+
+	uint16_t bootpServerPort = Protocol::getServicePortByName("bootps", "udp");
+	uint16_t bootpClientPort = Protocol::getServicePortByName("bootpc", "udp");
+
+	char dhcpFilter[MAX_FILTER_SIZE] = {0};
+	snprintf(dhcpFilter, MAX_FILTER_SIZE, "ether proto 0x%04x and udp dst port %u and udp src port %u", ETH_P_IP, bootpServerPort, bootpClientPort);
+
+	string filter = dhcpFilter;
+	if(trunk) {
+		filter = "(" + filter + ") or (vlan and ((" + filter + ") or (vlan and " + filter + ")))";
+	}
+	if(pcap_compile(pcapHandle, &fp, filter.c_str(), 0, networkMask) != 0) {
+		throw runtime_error(pcap_geterr(pcapHandle));
+	}
+	if(pcap_setfilter(pcapHandle, &fp) < 0) {
+		throw runtime_error(pcap_geterr(pcapHandle));
+	}
+}
+
+int NetworkInterface::capture(pcap_handler handler, u_char* user) {
+	int received = pcap_dispatch(pcapHandle, -1, handler, user);
+	if(received < 0) {
+		throw runtime_error(pcap_geterr(pcapHandle));
+	}
+
+	return received;
+}
+
+int NetworkInterface::getCaptureFd() {
+	int captureFd = pcap_get_selectable_fd(pcapHandle);
+	if(captureFd < 0) {
+		throw runtime_error("Capture device " + name + " can not be polled");
+	}
+
+	return captureFd;
+}
+
+/* Without it the capture ring is still polled from user space */
+void NetworkInterface::enableBusyPoll(int microseconds) {
+	if(setsockopt(getCaptureFd(), SOL_SOCKET, SO_BUSY_POLL, &microseconds, sizeof(microseconds)) < 0) {
+		fprintf(stderr, "Kernel busy polling not available on %s: %s\n", name.c_str(), strerror(errno));
+	}
+}
+
+const char* NetworkInterface::getName() {
+	return name.c_str();
+}
+
+uint8_t NetworkInterface::getIndex() {
+	return index;
+}
+
+uint32_t NetworkInterface::getServerIp() {
+	return serverIp;
+}
+
+Sender& NetworkInterface::getSender() {
+	return *sender;
+}
@@ -1,23 +1,109 @@
 #include "../inc/network_resolver.h"
 
-#include "../inc/unknown_network_exception.h"
+#include <string.h>
 
-NetworkResolver::NetworkResolver(Config& conf): config(conf) {}
+NetworkResolver::NetworkResolver(Config& config) {
+	memset(unknownRelays, 0, sizeof(unknownRelays));
+	const std::vector<InterfaceDescriptor>& interfaces = config.getInterfaces();
+	for(std::vector<InterfaceDescriptor>::const_iterator interfacesIterator = interfaces.begin(); interfacesIterator != interfaces.end(); interfacesIterator++) {
+		interfaceNetworks.push_back(InterfaceNetworks());
+		InterfaceNetworks& networks = interfaceNetworks.back();
+		networks.untagged = interfacesIterator->networkAddress;
 
-uint32_t NetworkResolver::determineNetworkAddress(uint32_t giaddr) {
-	return !giaddr ? config.getNetworkAddress() : findNetworkAddressInDescriptors(giaddr);
-}
+		const std::vector<VlanNetwork>& vlans = interfacesIterator->vlans;
+		for(std::vector<VlanNetwork>::const_iterator vlansIterator = vlans.begin(); vlansIterator != vlans.end(); vlansIterator++) {
+			if(vlansIterator->innerVlan != 0) {
+				networks.doubleTagged[doubleTagKey(vlansIterator->vlan, vlansIterator->innerVlan)] = vlansIterator->networkAddress;
+				continue;
+			}
+			if(networks.singleTagged.empty()) {
+				networks.singleTagged.resize(VLAN_ID_COUNT, 0);
+			}
+			networks.singleTagged[vlansIterator->vlan] = vlansIterator->networkAddress;
+		}
+	}
 
-uint32_t NetworkResolver::findNetworkAddressInDescriptors(uint32_t giaddr) {
-	const std::list<PoolDescriptor>& poolsDescriptors = config.getPoolsDescriptors();
-	std::list<PoolDescriptor>::const_iterator descriptorsIterator = poolsDescriptors.begin();
+	const std::vector<PoolDescriptor>& poolsDescriptors = config.getPoolsDescriptors();
+	std::vector<PoolDescriptor>::const_iterator descriptorsIterator = poolsDescriptors.begin();
 
 	for(; descriptorsIterator != poolsDescriptors.end(); descriptorsIterator++) {
 		const PoolDescriptor& descriptor = *descriptorsIterator;
-		if((giaddr & descriptor.networkMask) == (descriptor.startAddress & descriptor.networkMask))	{
-			return giaddr & descriptor.networkMask;
+		std::vector<MaskNetworks>::iterator masksIterator = maskNetworks.begin();
+		while(masksIterator != maskNetworks.end() && masksIterator->networkMask > descriptor.networkMask) {
+			masksIterator++;
+		}
+		if(masksIterator == maskNetworks.end() || masksIterator->networkMask != descriptor.networkMask) {
+			masksIterator = maskNetworks.insert(masksIterator, MaskNetworks());
+			masksIterator->networkMask = descriptor.networkMask;
+		}
+		masksIterator->networkAddresses.insert(descriptor.startAddress & descriptor.networkMask);
+	}
+}
+
+/* Interface missing from reloaded configuration has no network until restart */
+bool NetworkResolver::determineNetworkAddress(uint32_t giaddr, uint8_t interfaceIndex, const VlanTags& vlanTags, uint32_t& networkAddress) {
+	if(!giaddr) {
+		if(interfaceIndex >= interfaceNetworks.size()) {
+			return false;
+		}
+		const InterfaceNetworks& networks = interfaceNetworks[interfaceIndex];
+		if(vlanTags.count == 0) {
+			networkAddress = networks.untagged;
+			return true;
 		}
+		return findVlanNetwork(networks, vlanTags, networkAddress);
+	}
+
+	uint32_t& unknownRelay = unknownRelays[unknownRelaySlot(giaddr)];
+	if(unknownRelay == giaddr) {
+		return false;
 	}
+	if(!findNetworkAddressInDescriptors(giaddr, networkAddress)) {
+		unknownRelay = giaddr;
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Configurations use few distinct masks, so lookup costs one hash probe per mask instead of scanning every pool.
+ * Relay matches only networks configured with the mask it is probed with, longest prefix first.
+ */
+bool NetworkResolver::findNetworkAddressInDescriptors(uint32_t giaddr, uint32_t& networkAddress) {
+	for(std::vector<MaskNetworks>::const_iterator masksIterator = maskNetworks.begin(); masksIterator != maskNetworks.end(); masksIterator++) {
+		uint32_t candidate = giaddr & masksIterator->networkMask;
+		if(masksIterator->networkAddresses.find(candidate) != masksIterator->networkAddresses.end()) {
+			networkAddress = candidate;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool NetworkResolver::findVlanNetwork(const InterfaceNetworks& networks, const VlanTags& vlanTags, uint32_t& networkAddress) {
+	uint16_t outerVlan = vlanTags.controls[0] & VLAN_ID_MASK;
+	if(vlanTags.count == 1) {
+		if(networks.singleTagged.empty() || networks.singleTagged[outerVlan] == 0) {
+			return false;
+		}
+		networkAddress = networks.singleTagged[outerVlan];
+		return true;
+	}
+
+	std::unordered_map<uint32_t, uint32_t>::const_iterator networkIterator = networks.doubleTagged.find(doubleTagKey(outerVlan, vlanTags.controls[1] & VLAN_ID_MASK));
+	if(networkIterator == networks.doubleTagged.end()) {
+		return false;
+	}
+	networkAddress = networkIterator->second;
+	return true;
+}
+
+uint32_t NetworkResolver::doubleTagKey(uint16_t outerVlan, uint16_t innerVlan) {
+	return ((uint32_t)outerVlan << 12) | innerVlan;
+}
 
-	throw UnknownNetworkException("Searched network could not be found");
+unsigned NetworkResolver::unknownRelaySlot(uint32_t giaddr) {
+	return ((giaddr * 2654435761u) >> 16) % UNKNOWN_RELAYS_CACHE_SIZE;
 }
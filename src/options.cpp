@@ -74,6 +74,24 @@ void Options::tryToSetHostBytesOrder(Option& option) {
 		case IP_ADDRESS_LEASE_TIME: 
 			toHost32(option);
 			break;
+		case RENEWAL_TIME: 
+			toHost32(option);
+			break;
+		case REBINDING_TIME: 
+			toHost32(option);
+			break;
+		case CLIENT_LAST_TRANSACTION_TIME: 
+			toHost32(option);
+			break;
+		case BASE_TIME: 
+			toHost32(option);
+			break;
+		case QUERY_START_TIME: 
+			toHost32(option);
+			break;
+		case QUERY_END_TIME: 
+			toHost32(option);
+			break;
 		case SERVER_IDENTIFIER: 
 			toHost32(option);
 			break;
@@ -121,6 +139,24 @@ void Options::tryToSetNetworkBytesOrder(Option& option) {
 		case IP_ADDRESS_LEASE_TIME: 
 			toNetwork32(option);
 			break;
+		case RENEWAL_TIME: 
+			toNetwork32(option);
+			break;
+		case REBINDING_TIME: 
+			toNetwork32(option);
+			break;
+		case CLIENT_LAST_TRANSACTION_TIME: 
+			toNetwork32(option);
+			break;
+		case BASE_TIME: 
+			toNetwork32(option);
+			break;
+		case QUERY_START_TIME: 
+			toNetwork32(option);
+			break;
+		case QUERY_END_TIME: 
+			toNetwork32(option);
+			break;
 		case SERVER_IDENTIFIER: 
 			toNetwork32(option);
 			break;
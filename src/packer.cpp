@@ -4,6 +4,7 @@
 using namespace std;
 
 Packer::Packer(uint8_t* buffer) {
+	this->start = buffer;
 	this->buffer = buffer;
 }
 
@@ -27,12 +28,12 @@ Packer& Packer::pack(uint8_t optionType, uint8_t value) {
 	return *this;
 }
 
-Packer& Packer::pack(uint8_t optionType, const std::list<uint32_t>& value) {
+Packer& Packer::pack(uint8_t optionType, const std::vector<uint32_t>& value) {
 	if(!value.empty()) {
 		*(buffer++) = optionType;
 		*(buffer++) = value.size() * sizeof(uint32_t);
 
-		for(list<uint32_t>::const_iterator it = value.begin(); it != value.end(); it++) {
+		for(vector<uint32_t>::const_iterator it = value.begin(); it != value.end(); it++) {
 			uint32_t element = *it;
 			memcpy(buffer, &element, sizeof(element));
 			buffer += sizeof(element);
@@ -42,8 +43,22 @@ Packer& Packer::pack(uint8_t optionType, const std::list<uint32_t>& value) {
 	return *this;
 }
 
+Packer& Packer::pack(uint8_t optionType, const uint8_t* value, uint8_t length) {
+	*(buffer++) = optionType;
+	*(buffer++) = length;
+
+	memcpy(buffer, value, length);
+	buffer += length;
+
+	return *this;
+}
+
 Packer& Packer::pack(uint8_t optionType) {
 	*(buffer++) = optionType;
 
 	return *this;
 }
+
+size_t Packer::getLength() {
+	return buffer - start;
+}
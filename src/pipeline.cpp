@@ -0,0 +1,284 @@
+#include "../inc/pipeline.h"
+#include "../inc/cpu_affinity.h"
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <sstream>
+#include <unordered_set>
+
+using namespace std;
+
+Pipeline::Worker::Worker(Config& config, Clock& clock, size_t queueSize, MetricsShard* metricsShard)
+	: incoming(queueSize), outgoing(queueSize), scheduler(config), replyCache(config), transactionsStorage(config, clock), sender(outgoing), metrics(metricsShard), dropped(0), processed(0) {}
+
+Pipeline::Pipeline(Config& pipelineConfig, RequestProcessor& requestProcessor, Clock& pipelineClock, const vector<Sender*>& interfaceSenders, Metrics& metrics)
+	: config(pipelineConfig), processor(requestProcessor), clock(pipelineClock), transmitters(interfaceSenders), running(false), transmitted(0), activeWorkers(0), transmitMetrics(metrics.createShard()), busyPoll(config.isBusyPollEnabled()), cores(config.getWorkerCores()) {
+
+	for(unsigned i = 0; i < config.getPipelineWorkers(); ++i) {
+		workers.push_back(new Worker(config, clock, config.getPipelineQueueSize(), metrics.createShard()));
+	}
+	warnAboutNetworksSpread();
+}
+
+Pipeline::~Pipeline() {
+	stop();
+	for(vector<Worker*>::iterator it = workers.begin(); it != workers.end(); it++) {
+		delete *it;
+	}
+}
+
+void Pipeline::start() {
+	running = true;
+	activeWorkers = workers.size();
+	for(vector<Worker*>::iterator it = workers.begin(); it != workers.end(); it++) {
+		(*it)->thread = thread(&Pipeline::work, this, *it);
+	}
+	transmitThread = thread(&Pipeline::transmit, this);
+
+	/* Pinned after all threads exist, so a failure leaves a pipeline which still stops cleanly */
+	for(size_t i = 0; i < workers.size(); ++i) {
+		CpuAffinity::pin(workers[i]->thread.native_handle(), coreOf(i));
+	}
+	CpuAffinity::pin(transmitThread.native_handle(), coreOf(workers.size()));
+}
+
+int Pipeline::coreOf(size_t thread) {
+	return thread < cores.size() ? cores[thread] : -1;
+}
+
+/* Workers drain their queues before exiting, transmit stage stops after the last worker */
+void Pipeline::stop() {
+	if(!running.exchange(false)) {
+		return;
+	}
+
+	for(vector<Worker*>::iterator it = workers.begin(); it != workers.end(); it++) {
+		(*it)->thread.join();
+	}
+	transmitThread.join();
+}
+
+size_t Pipeline::selectWorker(uint32_t networkAddress) {
+	uint32_t hash = networkAddress * 2654435761u;
+	return (hash >> 16) % workers.size();
+}
+
+vector<unsigned> Pipeline::countNetworks() {
+	vector<unsigned> networks(workers.size(), 0);
+	unordered_set<uint32_t> counted;
+	const vector<PoolDescriptor>& pools = config.getPoolsDescriptors();
+	for(vector<PoolDescriptor>::const_iterator it = pools.begin(); it != pools.end(); it++) {
+		uint32_t networkAddress = it->startAddress & it->networkMask;
+		if(counted.insert(networkAddress).second) {
+			++networks[selectWorker(networkAddress)];
+		}
+	}
+
+	return networks;
+}
+
+/* Sharding by network keeps the allocator lock free, its cost is that a worker without networks never runs */
+void Pipeline::warnAboutNetworksSpread() {
+	vector<unsigned> networks = countNetworks();
+	unsigned idleWorkers = 0;
+	for(vector<unsigned>::iterator it = networks.begin(); it != networks.end(); it++) {
+		idleWorkers += *it == 0 ? 1 : 0;
+	}
+
+	if(idleWorkers > 0) {
+		fprintf(stderr, "Requests are spread between pipeline workers by network, %u of %zu workers have no network to serve\n", idleWorkers, workers.size());
+	}
+}
+
+bool Pipeline::submit(const IncomingMessage& message) {
+	Worker* worker = workers[selectWorker(message.client.networkAddress)];
+
+	IncomingMessage* slot = worker->incoming.acquire();
+	if(slot == NULL) {
+		worker->dropped.fetch_add(1, memory_order_relaxed);
+		return false;
+	}
+
+	*slot = message;
+	worker->incoming.publish();
+
+	return true;
+}
+
+void Pipeline::work(Worker* worker) {
+	unsigned idleSpins = 0;
+	for(;;) {
+		schedule(worker);
+
+		unsigned processedCount = 0;
+		{
+			lock_guard<mutex> lock(worker->processing);
+			lock_guard<mutex> schedulerLock(worker->schedulerMutex);
+
+			clock.refresh();
+			uint64_t now = clock.monotonicMs();
+			IncomingMessage* message;
+			for(; processedCount < PIPELINE_WORKER_BATCH_SIZE && (message = worker->scheduler.front(now)) != NULL; ++processedCount) {
+				worker->sender.setRequest(*message);
+				processor.process(*message, worker->transactionsStorage, worker->replyCache, *worker->metrics, worker->sender);
+				worker->scheduler.pop();
+			}
+		}
+
+		if(processedCount > 0) {
+			worker->processed.fetch_add(processedCount, memory_order_relaxed);
+			idleSpins = 0;
+			continue;
+		}
+		if(!running && worker->incoming.size() == 0) {
+			break;
+		}
+		worker->transactionsStorage.removeExpired();
+		idle(idleSpins);
+	}
+	--activeWorkers;
+}
+
+/* Moving requests out of the ring is cheap compared to handling them, so the ring rarely fills up */
+void Pipeline::schedule(Worker* worker) {
+	IncomingMessage* message = worker->incoming.front();
+	if(message == NULL) {
+		return;
+	}
+
+	uint64_t now = clock.monotonicMs();
+	lock_guard<mutex> lock(worker->schedulerMutex);
+	for(; message != NULL; message = worker->incoming.front()) {
+		if(!worker->scheduler.enqueue(*message, now)) {
+			worker->dropped.fetch_add(1, memory_order_relaxed);
+			worker->metrics->countDropped(DROP_QUEUE_FULL);
+		}
+		worker->incoming.pop();
+	}
+}
+
+void Pipeline::transmit() {
+	unsigned idleSpins = 0;
+	for(;;) {
+		bool anyTransmitted = false;
+		for(vector<Worker*>::iterator it = workers.begin(); it != workers.end(); it++) {
+			OutgoingMessage* message;
+			for(unsigned i = 0; i < PIPELINE_WORKER_BATCH_SIZE && (message = (*it)->outgoing.front()) != NULL; ++i) {
+				transmitters[message->interfaceIndex]->sendTagged(message->message, message->messageType, message->vlanTags);
+				transmitMetrics->recordLatency(Metrics::wallClockUs() - message->capturedAt);
+				(*it)->outgoing.pop();
+				transmitted.fetch_add(1, memory_order_relaxed);
+				anyTransmitted = true;
+			}
+		}
+
+		if(anyTransmitted) {
+			idleSpins = 0;
+			continue;
+		}
+
+		bool workersFinished = activeWorkers == 0;
+		for(vector<Worker*>::iterator it = workers.begin(); it != workers.end() && workersFinished; it++) {
+			workersFinished = (*it)->outgoing.size() == 0;
+		}
+		if(workersFinished) {
+			break;
+		}
+		idle(idleSpins);
+	}
+}
+
+void Pipeline::idle(unsigned& idleSpins) {
+	if(busyPoll || ++idleSpins < PIPELINE_SPINS_BEFORE_SLEEP) {
+		this_thread::yield();
+	}
+	else {
+		usleep(PIPELINE_IDLE_SLEEP_US);
+	}
+}
+
+void Pipeline::pause() {
+	for(vector<Worker*>::iterator it = workers.begin(); it != workers.end(); it++) {
+		(*it)->processing.lock();
+	}
+}
+
+void Pipeline::resume() {
+	for(vector<Worker*>::reverse_iterator it = workers.rbegin(); it != workers.rend(); it++) {
+		(*it)->processing.unlock();
+	}
+}
+
+void Pipeline::pause(uint32_t networkAddress) {
+	workers[selectWorker(networkAddress)]->processing.lock();
+}
+
+void Pipeline::resume(uint32_t networkAddress) {
+	workers[selectWorker(networkAddress)]->processing.unlock();
+}
+
+PipelinePause::PipelinePause(Pipeline* pipelineToPause): pipeline(pipelineToPause), wholePipeline(true), networkAddress(0) {
+	if(pipeline != NULL) {
+		pipeline->pause();
+	}
+}
+
+PipelinePause::PipelinePause(Pipeline* pipelineToPause, uint32_t pausedNetwork): pipeline(pipelineToPause), wholePipeline(false), networkAddress(pausedNetwork) {
+	if(pipeline != NULL) {
+		pipeline->pause(networkAddress);
+	}
+}
+
+PipelinePause::~PipelinePause() {
+	if(pipeline == NULL) {
+		return;
+	}
+	if(wholePipeline) {
+		pipeline->resume();
+	}
+	else {
+		pipeline->resume(networkAddress);
+	}
+}
+
+string Pipeline::describe() {
+	ostringstream description;
+	vector<unsigned> workerNetworks = countNetworks();
+	for(size_t i = 0; i < workers.size(); ++i) {
+		Worker* worker = workers[i];
+		description << "worker " << i
+			<< " networks " << workerNetworks[i]
+			<< " incoming_depth " << worker->incoming.size() << "/" << worker->incoming.capacity()
+			<< " outgoing_depth " << worker->outgoing.size() << "/" << worker->outgoing.capacity()
+			<< " processed " << worker->processed.load(memory_order_relaxed)
+			<< " dropped " << worker->dropped.load(memory_order_relaxed);
+		{
+			lock_guard<mutex> lock(worker->schedulerMutex);
+			description << " " << worker->scheduler.describe();
+		}
+		description << " replayed " << worker->replyCache.getReplayed() << "\n";
+	}
+	description << "transmitted " << transmitted.load(memory_order_relaxed) << "\n";
+
+	return description.str();
+}
+
+string Pipeline::render() {
+	ostringstream depth, processed, dropped, networks;
+	depth << "# TYPE dhcp_pipeline_queue_depth gauge\n";
+	processed << "# TYPE dhcp_pipeline_processed_total counter\n";
+	dropped << "# TYPE dhcp_pipeline_dropped_total counter\n";
+	networks << "# TYPE dhcp_pipeline_networks gauge\n";
+
+	vector<unsigned> workerNetworks = countNetworks();
+	for(size_t i = 0; i < workers.size(); ++i) {
+		Worker* worker = workers[i];
+		depth << "dhcp_pipeline_queue_depth{worker=\"" << i << "\",queue=\"incoming\"} " << worker->incoming.size() << "\n"
+			<< "dhcp_pipeline_queue_depth{worker=\"" << i << "\",queue=\"outgoing\"} " << worker->outgoing.size() << "\n";
+		processed << "dhcp_pipeline_processed_total{worker=\"" << i << "\"} " << worker->processed.load(memory_order_relaxed) << "\n";
+		dropped << "dhcp_pipeline_dropped_total{worker=\"" << i << "\"} " << worker->dropped.load(memory_order_relaxed) << "\n";
+		networks << "dhcp_pipeline_networks{worker=\"" << i << "\"} " << workerNetworks[i] << "\n";
+	}
+
+	return depth.str() + processed.str() + dropped.str() + networks.str();
+}
@@ -0,0 +1,145 @@
+#include "../inc/pools_monitor.h"
+#include <arpa/inet.h>
+#include <math.h>
+#include <sstream>
+
+using namespace std;
+
+PoolsMonitor::PoolsMonitor(AddressesAllocator& addressesAllocator): allocator(addressesAllocator) {}
+
+/* First sample of a pool only sets the baseline, rates start from zero */
+void PoolsMonitor::tick(uint32_t elapsedSeconds) {
+	if(elapsedSeconds == 0) {
+		return;
+	}
+	double weight = 1.0 - exp(-(double)elapsedSeconds / POOL_RATES_WINDOW);
+
+	const unordered_map<uint32_t, AddressesPool*>& pools = allocator.getPools();
+	for(unordered_map<uint32_t, AddressesPool*>::const_iterator it = pools.begin(); it != pools.end(); it++) {
+		PoolUsage usage = it->second->getUsage();
+
+		unordered_map<uint32_t, PoolTrend>::iterator trendIt = trends.find(it->first);
+		if(trendIt == trends.end()) {
+			PoolTrend trend = { usage, 0.0, 0.0, 0.0 };
+			trends[it->first] = trend;
+			continue;
+		}
+
+		PoolTrend& trend = trendIt->second;
+		double allocated = (double)(usage.allocations - trend.lastUsage.allocations) / elapsedSeconds;
+		double reclaimed = (double)(usage.reclaims - trend.lastUsage.reclaims) / elapsedSeconds;
+		double consumed = ((double)countFree(trend.lastUsage) - countFree(usage)) / elapsedSeconds;
+
+		trend.allocationRate += weight * (allocated - trend.allocationRate);
+		trend.reclaimRate += weight * (reclaimed - trend.reclaimRate);
+		trend.consumptionRate += weight * (consumed - trend.consumptionRate);
+		trend.lastUsage = usage;
+	}
+}
+
+uint32_t PoolsMonitor::countFree(const PoolUsage& usage) {
+	return usage.unassigned + usage.abandoned;
+}
+
+/* Negative when pool is not being drained */
+double PoolsMonitor::secondsToExhaustion(const PoolUsage& usage, const PoolTrend& trend) {
+	if(trend.consumptionRate <= 0.0) {
+		return -1.0;
+	}
+	return countFree(usage) / trend.consumptionRate;
+}
+
+string PoolsMonitor::formatNetwork(uint32_t networkAddress) {
+	struct in_addr address;
+	address.s_addr = htonl(networkAddress);
+
+	char networkString[INET_ADDRSTRLEN] = {0};
+	inet_ntop(AF_INET, &address, networkString, sizeof(networkString));
+
+	return networkString;
+}
+
+/* Gauges are read live from pools, rates come from the last housekeeping tick */
+string PoolsMonitor::render() {
+	ostringstream size, addresses, allocations, reclaims, rates, exhaustion;
+	size << "# TYPE dhcp_pool_size gauge\n";
+	addresses << "# TYPE dhcp_pool_addresses gauge\n";
+	allocations << "# TYPE dhcp_pool_allocations_total counter\n";
+	reclaims << "# TYPE dhcp_pool_reclaims_total counter\n";
+	rates << "# TYPE dhcp_pool_rate_per_second gauge\n";
+	exhaustion << "# TYPE dhcp_pool_exhaustion_seconds gauge\n";
+
+	const unordered_map<uint32_t, AddressesPool*>& pools = allocator.getPools();
+	for(unordered_map<uint32_t, AddressesPool*>::const_iterator it = pools.begin(); it != pools.end(); it++) {
+		PoolUsage usage = it->second->getUsage();
+		string network = "network=\"" + formatNetwork(it->first) + "\"";
+
+		size << "dhcp_pool_size{" << network << "} " << usage.size << "\n";
+		addresses << "dhcp_pool_addresses{" << network << ",state=\"unassigned\"} " << usage.unassigned << "\n"
+			<< "dhcp_pool_addresses{" << network << ",state=\"abandoned\"} " << usage.abandoned << "\n"
+			<< "dhcp_pool_addresses{" << network << ",state=\"quarantined\"} " << usage.quarantined << "\n"
+			<< "dhcp_pool_addresses{" << network << ",state=\"leased\"} " << usage.leased << "\n";
+		allocations << "dhcp_pool_allocations_total{" << network << "} " << usage.allocations << "\n";
+		reclaims << "dhcp_pool_reclaims_total{" << network << "} " << usage.reclaims << "\n";
+
+		unordered_map<uint32_t, PoolTrend>::const_iterator trendIt = trends.find(it->first);
+		if(trendIt == trends.end()) {
+			continue;
+		}
+		const PoolTrend& trend = trendIt->second;
+		rates << "dhcp_pool_rate_per_second{" << network << ",kind=\"allocation\"} " << trend.allocationRate << "\n"
+			<< "dhcp_pool_rate_per_second{" << network << ",kind=\"reclaim\"} " << trend.reclaimRate << "\n"
+			<< "dhcp_pool_rate_per_second{" << network << ",kind=\"consumption\"} " << trend.consumptionRate << "\n";
+
+		double seconds = secondsToExhaustion(usage, trend);
+		exhaustion << "dhcp_pool_exhaustion_seconds{" << network << "} ";
+		if(seconds < 0.0) {
+			exhaustion << "+Inf\n";
+		}
+		else {
+			exhaustion << seconds << "\n";
+		}
+	}
+
+	return size.str() + addresses.str() + allocations.str() + reclaims.str() + rates.str() + exhaustion.str();
+}
+
+uint64_t PoolsMonitor::countLeases() {
+	uint64_t leases = 0;
+	const unordered_map<uint32_t, AddressesPool*>& pools = allocator.getPools();
+	for(unordered_map<uint32_t, AddressesPool*>::const_iterator it = pools.begin(); it != pools.end(); it++) {
+		leases += it->second->getUsage().leased;
+	}
+
+	return leases;
+}
+
+string PoolsMonitor::describe() {
+	ostringstream description;
+	const unordered_map<uint32_t, AddressesPool*>& pools = allocator.getPools();
+	for(unordered_map<uint32_t, AddressesPool*>::const_iterator it = pools.begin(); it != pools.end(); it++) {
+		PoolUsage usage = it->second->getUsage();
+		description << formatNetwork(it->first)
+			<< " size " << usage.size
+			<< " free " << countFree(usage)
+			<< " leased " << usage.leased
+			<< " quarantined " << usage.quarantined;
+
+		unordered_map<uint32_t, PoolTrend>::const_iterator trendIt = trends.find(it->first);
+		if(trendIt != trends.end()) {
+			double seconds = secondsToExhaustion(usage, trendIt->second);
+			description << " allocations/s " << trendIt->second.allocationRate
+				<< " reclaims/s " << trendIt->second.reclaimRate
+				<< " exhaustion_in ";
+			if(seconds < 0.0) {
+				description << "never";
+			}
+			else {
+				description << (uint64_t)seconds << "s";
+			}
+		}
+		description << "\n";
+	}
+
+	return description.str();
+}
@@ -0,0 +1,308 @@
+#include "../inc/pools_parser.h"
+#include "../inc/lease_times.h"
+#include <string.h>
+#include <stdexcept>
+
+using namespace std;
+
+#define POOL_START_ADDRESS 1
+#define POOL_END_ADDRESS 2
+#define POOL_NETWORK_MASK 4
+#define POOL_LEASE_TIME 8
+#define POOL_DNS_SERVERS 16
+#define POOL_ROUTERS 32
+#define POOL_REQUIRED_KEYS 63
+
+PoolsParser::PoolsParser(const char* text, size_t textLength): document(text), length(textLength), position(0) {}
+
+bool PoolsParser::parse(vector<PoolDescriptor>& target, size_t& begin, size_t& end) {
+	position = 0;
+	skipWhitespace();
+	expect('{');
+	skipWhitespace();
+	if(consume('}')) {
+		return false;
+	}
+
+	for(;;) {
+		skipWhitespace();
+		string key = readString();
+		skipWhitespace();
+		expect(':');
+		skipWhitespace();
+
+		if(key == "addressesPools") {
+			begin = position;
+			parsePools(target);
+			end = position;
+			return true;
+		}
+		skipValue();
+
+		skipWhitespace();
+		if(!consume(',')) {
+			expect('}');
+			return false;
+		}
+	}
+}
+
+void PoolsParser::parsePools(vector<PoolDescriptor>& target) {
+	expect('[');
+	skipWhitespace();
+	if(consume(']')) {
+		return;
+	}
+
+	for(;;) {
+		skipWhitespace();
+		target.push_back(PoolDescriptor());
+		parsePool(target.back());
+
+		skipWhitespace();
+		if(!consume(',')) {
+			expect(']');
+			return;
+		}
+	}
+}
+
+void PoolsParser::parsePool(PoolDescriptor& descriptor) {
+	PoolOptions options;
+	descriptor.leaseJitter = 0;
+	descriptor.allocation = ALLOCATE_SEQUENTIAL;
+	unsigned foundKeys = 0;
+
+	expect('{');
+	skipWhitespace();
+	while(!consume('}')) {
+		string key = readString();
+		skipWhitespace();
+		expect(':');
+		skipWhitespace();
+
+		if(key == "startAddress") {
+			descriptor.startAddress = readAddress();
+			foundKeys |= POOL_START_ADDRESS;
+		}
+		else if(key == "endAddress") {
+			descriptor.endAddress = readAddress();
+			foundKeys |= POOL_END_ADDRESS;
+		}
+		else if(key == "networkMask") {
+			descriptor.networkMask = readAddress();
+			foundKeys |= POOL_NETWORK_MASK;
+		}
+		else if(key == "leaseTime") {
+			descriptor.leaseTime = readNumber();
+			foundKeys |= POOL_LEASE_TIME;
+		}
+		else if(key == "leaseJitter") {
+			descriptor.leaseJitter = readNumber();
+			if(descriptor.leaseJitter > MAX_LEASE_JITTER) {
+				throw runtime_error("Lease jitter can not exceed " + to_string(MAX_LEASE_JITTER) + " percent");
+			}
+		}
+		else if(key == "allocation") {
+			string allocation = readString();
+			if(allocation == "hash") {
+				descriptor.allocation = ALLOCATE_HASHED;
+			}
+			else if(allocation != "sequential") {
+				fail("allocation must be sequential or hash");
+			}
+		}
+		else if(key == "dnsServers") {
+			readAddresses(options.dnsServers);
+			foundKeys |= POOL_DNS_SERVERS;
+		}
+		else if(key == "routers") {
+			readAddresses(options.routers);
+			foundKeys |= POOL_ROUTERS;
+		}
+		else {
+			skipValue();
+		}
+
+		skipWhitespace();
+		if(consume(',')) {
+			skipWhitespace();
+		}
+	}
+
+	if(foundKeys != POOL_REQUIRED_KEYS) {
+		fail("pool needs startAddress, endAddress, networkMask, leaseTime, dnsServers and routers");
+	}
+	/* Pool size is endAddress - startAddress, a reversed range would wrap around to billions of addresses */
+	if(descriptor.endAddress < descriptor.startAddress) {
+		fail("pool endAddress is lower than startAddress");
+	}
+	descriptor.options = deduplicate(options);
+}
+
+/* Generated configurations repeat few router and DNS sets over thousands of subnets */
+shared_ptr<const PoolOptions> PoolsParser::deduplicate(const PoolOptions& options) {
+	uint32_t dnsServersCount = options.dnsServers.size();
+	string key((const char*)&dnsServersCount, sizeof(dnsServersCount));
+	key.append((const char*)options.dnsServers.data(), options.dnsServers.size() * sizeof(uint32_t));
+	key.append((const char*)options.routers.data(), options.routers.size() * sizeof(uint32_t));
+
+	shared_ptr<const PoolOptions>& shared = optionSets[key];
+	if(!shared) {
+		shared = make_shared<const PoolOptions>(options);
+	}
+
+	return shared;
+}
+
+void PoolsParser::skipWhitespace() {
+	while(position < length && (document[position] == ' ' || document[position] == '\t' || document[position] == '\n' || document[position] == '\r')) {
+		++position;
+	}
+}
+
+bool PoolsParser::consume(char expected) {
+	if(position < length && document[position] == expected) {
+		++position;
+		return true;
+	}
+
+	return false;
+}
+
+void PoolsParser::expect(char expected) {
+	if(!consume(expected)) {
+		fail(string("expected '") + expected + "'");
+	}
+}
+
+/* Escaped characters are taken literally, keys and values of pools are plain ASCII */
+string PoolsParser::readString() {
+	expect('"');
+	size_t begin = position;
+	while(position < length && document[position] != '"' && document[position] != '\\') {
+		++position;
+	}
+	string value(document + begin, position - begin);
+
+	while(position < length && document[position] != '"') {
+		if(document[position] == '\\') {
+			++position;
+		}
+		if(position < length) {
+			value += document[position++];
+		}
+	}
+	expect('"');
+
+	return value;
+}
+
+void PoolsParser::skipString() {
+	expect('"');
+	while(position < length && document[position] != '"') {
+		position += document[position] == '\\' ? 2 : 1;
+	}
+	expect('"');
+}
+
+void PoolsParser::skipValue() {
+	if(position >= length) {
+		fail("unexpected end of document");
+	}
+	if(document[position] == '"') {
+		skipString();
+		return;
+	}
+	if(document[position] != '{' && document[position] != '[') {
+		while(position < length && !strchr(",}] \t\r\n", document[position])) {
+			++position;
+		}
+		return;
+	}
+
+	unsigned depth = 0;
+	do {
+		if(document[position] == '"') {
+			skipString();
+			continue;
+		}
+		if(document[position] == '{' || document[position] == '[') {
+			++depth;
+		}
+		else if(document[position] == '}' || document[position] == ']') {
+			--depth;
+		}
+		++position;
+	} while(depth > 0 && position < length);
+
+	if(depth > 0) {
+		fail("unexpected end of document");
+	}
+}
+
+/* Numbers may also be quoted, like the generic parser accepts them */
+uint32_t PoolsParser::readNumber() {
+	bool quoted = consume('"');
+	if(position >= length || document[position] < '0' || document[position] > '9') {
+		fail("expected number");
+	}
+
+	uint64_t value = 0;
+	while(position < length && document[position] >= '0' && document[position] <= '9') {
+		value = value * 10 + (document[position++] - '0');
+		if(value > UINT32_MAX) {
+			fail("number out of range");
+		}
+	}
+	if(quoted) {
+		expect('"');
+	}
+
+	return value;
+}
+
+uint32_t PoolsParser::readAddress() {
+	expect('"');
+	uint32_t address = 0;
+	for(unsigned octet = 0; octet < 4; ++octet) {
+		if(octet > 0) {
+			expect('.');
+		}
+
+		unsigned value = 0, digits = 0;
+		while(position < length && document[position] >= '0' && document[position] <= '9' && digits < 3) {
+			value = value * 10 + (document[position++] - '0');
+			++digits;
+		}
+		if(digits == 0 || value > 255) {
+			fail("invalid address");
+		}
+		address = (address << 8) | value;
+	}
+	expect('"');
+
+	return address;
+}
+
+void PoolsParser::readAddresses(vector<uint32_t>& target) {
+	expect('[');
+	skipWhitespace();
+	if(consume(']')) {
+		return;
+	}
+
+	for(;;) {
+		skipWhitespace();
+		target.push_back(readAddress());
+		skipWhitespace();
+		if(!consume(',')) {
+			expect(']');
+			return;
+		}
+	}
+}
+
+void PoolsParser::fail(const string& reason) {
+	throw runtime_error("Invalid addressesPools at offset " + to_string(position) + ": " + reason);
+}
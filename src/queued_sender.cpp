@@ -0,0 +1,32 @@
+#include "../inc/queued_sender.h"
+#include <string.h>
+#include <thread>
+
+QueuedSender::QueuedSender(SpscRing<OutgoingMessage>& outgoingQueue): queue(outgoingQueue), capturedAt(0), interfaceIndex(0) {
+	vlanTags.count = 0;
+}
+
+void QueuedSender::send(DHCPMessage& response, unsigned messageType) {
+	sendTagged(response, messageType, vlanTags);
+}
+
+void QueuedSender::sendTagged(DHCPMessage& response, unsigned messageType, const VlanTags& tags) {
+	OutgoingMessage* outgoing;
+	/* Transmit stage is the bottleneck when this spins, handled requests are never dropped */
+	while((outgoing = queue.acquire()) == NULL) {
+		std::this_thread::yield();
+	}
+
+	memcpy(&outgoing->message, &response, sizeof(response));
+	outgoing->messageType = messageType;
+	outgoing->capturedAt = capturedAt;
+	outgoing->interfaceIndex = interfaceIndex;
+	outgoing->vlanTags = tags;
+	queue.publish();
+}
+
+void QueuedSender::setRequest(const IncomingMessage& request) {
+	capturedAt = request.capturedAt;
+	interfaceIndex = request.client.interfaceIndex;
+	vlanTags = request.vlanTags;
+}
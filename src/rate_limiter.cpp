@@ -0,0 +1,58 @@
+#include "../inc/rate_limiter.h"
+
+#define MILLI_TOKENS_PER_TOKEN 1000
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+using namespace std;
+
+RateLimiter::RateLimiter(uint32_t tokensRate, uint32_t tokensBurst, size_t tableSize)
+	: rate(tokensRate), burst(tokensBurst < 1 ? 1 : tokensBurst), allowed(0), dropped(0) {
+
+	size_t capacity = 1;
+	while(capacity < tableSize) {
+		capacity <<= 1;
+	}
+	mask = capacity - 1;
+
+	if(rate) {
+		TokenBucket fullBucket = { burst * MILLI_TOKENS_PER_TOKEN, 0 };
+		buckets.assign(capacity, fullBucket);
+	}
+}
+
+bool RateLimiter::allow(const uint8_t* key, size_t keyLength, uint64_t nowMs) {
+	if(!rate) {
+		return true;
+	}
+
+	uint32_t hash = FNV_OFFSET_BASIS;
+	for(size_t i = 0; i < keyLength; ++i) {
+		hash = (hash ^ key[i]) * FNV_PRIME;
+	}
+	TokenBucket& bucket = buckets[hash & mask];
+
+	/* rate tokens per second is rate milli tokens per millisecond */
+	uint32_t elapsedMs = (uint32_t)nowMs - bucket.lastRefillMs;
+	uint64_t milliTokens = bucket.milliTokens + (uint64_t)elapsedMs * rate;
+	uint64_t maxMilliTokens = (uint64_t)burst * MILLI_TOKENS_PER_TOKEN;
+	bucket.milliTokens = milliTokens > maxMilliTokens ? maxMilliTokens : milliTokens;
+	bucket.lastRefillMs = nowMs;
+
+	if(bucket.milliTokens < MILLI_TOKENS_PER_TOKEN) {
+		++dropped;
+		return false;
+	}
+
+	bucket.milliTokens -= MILLI_TOKENS_PER_TOKEN;
+	++allowed;
+	return true;
+}
+
+uint64_t RateLimiter::getDropped() {
+	return dropped;
+}
+
+uint64_t RateLimiter::getAllowed() {
+	return allowed;
+}
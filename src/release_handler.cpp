@@ -1,9 +1,12 @@
 #include "../inc/release_handler.h"
+#include "../inc/tracepoints.h"
 
-ReleaseHandler::ReleaseHandler(TransactionsStorage& storage, Client& clientToHandle, AddressesAllocator& addrAllocator, Server& serv)
-	: transactionsStorage(storage), client(clientToHandle), allocator(addrAllocator), server(serv) {}
+ReleaseHandler::ReleaseHandler(TransactionsStorage& storage, Client& clientToHandle, AddressesAllocator& addrAllocator, Server& serv, Sender& responseSender)
+	: transactionsStorage(storage), client(clientToHandle), allocator(addrAllocator), server(serv), sender(responseSender) {}
 
 
-void ReleaseHandler::handle(struct DHCPMessage&, Options&, uint32_t dstAddr) {
+void ReleaseHandler::handle(struct DHCPMessage& message, Options&, uint32_t dstAddr) {
+	TRACE4(handler__entry, DHCPRELEASE, message.xid, tracedClientKey(client), client.networkAddress);
 	allocator.softDelete(client);
+	TRACE5(handler__exit, DHCPRELEASE, message.xid, tracedClientKey(client), client.networkAddress, 0);
 }
@@ -0,0 +1,110 @@
+#include "../inc/replication_buffer.h"
+#include "../inc/client.h"
+#include <string.h>
+#include <endian.h>
+#include <sys/time.h>
+
+using namespace std;
+
+ReplicationBuffer::ReplicationBuffer(): openFrameOffset(0), frameOpen(false), eventsCount(0) {}
+
+int64_t ReplicationBuffer::now() {
+	struct timeval time;
+	gettimeofday(&time, NULL);
+
+	return (int64_t)time.tv_sec * 1000000 + time.tv_usec;
+}
+
+void ReplicationBuffer::appendControlFrame(uint32_t type) {
+	closeFrame();
+	openFrame(type);
+	closeFrame();
+}
+
+void ReplicationBuffer::appendLease(uint8_t event, uint32_t networkAddress, const HardwareAddress& hardwareAddress, const AllocatedAddress& address) {
+	appendRecord(event, networkAddress, address, BASED_ON_HARDWARE, hardwareAddress.addressType, hardwareAddress.hardwareAddress, MAX_HADDR_SIZE);
+}
+
+void ReplicationBuffer::appendLease(uint8_t event, uint32_t networkAddress, const ClientSpecialId& specialId, const AllocatedAddress& address) {
+	appendRecord(event, networkAddress, address, BASED_ON_SPECIAL_ID, specialId.type, specialId.value, CLIENT_SPECIAL_ID_MAX_LEN);
+}
+
+/* Identifiers are zero padded in memory, so trailing zeros are not sent */
+void ReplicationBuffer::appendRecord(uint8_t event, uint32_t networkAddress, const AllocatedAddress& address, uint8_t identificationMethod, uint8_t idType, const uint8_t* id, size_t maxIdLength) {
+	size_t idLength = maxIdLength;
+	while(idLength > 0 && id[idLength - 1] == 0) {
+		--idLength;
+	}
+
+	if(frameOpen && bytes.size() - openFrameOffset + sizeof(ReplicatedLeaseHeader) + idLength > REPLICATION_MAX_FRAME_SIZE) {
+		closeFrame();
+	}
+	if(!frameOpen) {
+		openFrame(REPLICATION_LEASES_FRAME);
+	}
+
+	ReplicatedLeaseHeader record;
+	record.lease.networkAddress = htole32(networkAddress);
+	record.lease.ipAddress = htole32(address.ipAddress);
+	record.lease.leaseTime = htole32(address.leaseTime);
+	record.lease.reserved = 0;
+	record.lease.allocationTime = htole64(address.allocationTime);
+	record.event = event;
+	record.identificationMethod = identificationMethod;
+	record.idType = idType;
+	record.idLength = idLength;
+
+	append(&record, sizeof(record));
+	append(id, idLength);
+
+	ReplicationFrameHeader* header = (ReplicationFrameHeader*)&bytes[openFrameOffset];
+	header->recordsCount = htole32(le32toh(header->recordsCount) + 1);
+	++eventsCount;
+}
+
+void ReplicationBuffer::openFrame(uint32_t type) {
+	ReplicationFrameHeader header;
+	header.magic = htole32(REPLICATION_MAGIC);
+	header.type = htole32(type);
+	header.length = 0;
+	header.recordsCount = 0;
+	header.createdAt = htole64(now());
+
+	openFrameOffset = bytes.size();
+	frameOpen = true;
+	append(&header, sizeof(header));
+}
+
+void ReplicationBuffer::closeFrame() {
+	if(!frameOpen) {
+		return;
+	}
+
+	ReplicationFrameHeader* header = (ReplicationFrameHeader*)&bytes[openFrameOffset];
+	header->length = htole32(bytes.size() - openFrameOffset - sizeof(ReplicationFrameHeader));
+	frameOpen = false;
+}
+
+void ReplicationBuffer::append(const void* data, size_t size) {
+	const uint8_t* dataBytes = (const uint8_t*)data;
+	bytes.insert(bytes.end(), dataBytes, dataBytes + size);
+}
+
+bool ReplicationBuffer::empty() {
+	return bytes.empty();
+}
+
+size_t ReplicationBuffer::size() {
+	return bytes.size();
+}
+
+uint64_t ReplicationBuffer::getEventsCount() {
+	return eventsCount;
+}
+
+void ReplicationBuffer::moveTo(ReplicationBytes& target) {
+	closeFrame();
+	target.insert(target.end(), bytes.begin(), bytes.end());
+	bytes.clear();
+	eventsCount = 0;
+}
@@ -0,0 +1,269 @@
+#include "../inc/replication_primary.h"
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+ReplicationPrimary::ReplicationPrimary(EventLoop& loop, AddressesAllocator& addressesAllocator, Pipeline* handlersPipeline, Config& config)
+	: eventLoop(loop), allocator(addressesAllocator), pipeline(handlersPipeline), resyncInterval(config.getReplicationResyncInterval()),
+	maxBacklog(config.getReplicationMaxBacklog()), standbyFd(-1), replaying(NULL), streaming(false), outputOffset(0), snapshotBytes(0), secondsSinceResync(0),
+	eventsSent(0), bytesSent(0), resynchronizations(0), disconnects(0) {
+
+	wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(wakeupFd < 0) {
+		throw runtime_error("Could not create replication notifier");
+	}
+	eventLoop.watch(wakeupFd, EPOLLIN, [this](uint32_t) {
+		uint64_t notifications;
+		if(read(wakeupFd, &notifications, sizeof(notifications)) == sizeof(notifications)) {
+			flushPending();
+		}
+	});
+
+	/* Destructor does not run when constructor throws */
+	try {
+		listen(config);
+	}
+	catch(runtime_error&) {
+		eventLoop.unwatch(wakeupFd);
+		close(wakeupFd);
+		throw;
+	}
+	allocator.setLeaseListener(this);
+}
+
+ReplicationPrimary::~ReplicationPrimary() {
+	allocator.setLeaseListener(NULL);
+	closeStandby();
+	eventLoop.unwatch(listeningFd);
+	eventLoop.unwatch(wakeupFd);
+	close(listeningFd);
+	close(wakeupFd);
+}
+
+void ReplicationPrimary::listen(Config& config) {
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(config.getReplicationPort());
+	if(inet_pton(AF_INET, config.getReplicationAddress(), &address.sin_addr) != 1) {
+		throw runtime_error("Invalid replication address");
+	}
+
+	listeningFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(listeningFd < 0) {
+		throw runtime_error("Could not create replication socket");
+	}
+
+	int reuse = 1;
+	setsockopt(listeningFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	if(bind(listeningFd, (struct sockaddr*)&address, sizeof(address)) < 0 || ::listen(listeningFd, 1) < 0) {
+		close(listeningFd);
+		throw runtime_error("Could not listen for standby server");
+	}
+
+	eventLoop.watch(listeningFd, EPOLLIN, [this](uint32_t) { acceptStandby(); });
+}
+
+/* Newer standby replaces the connected one */
+void ReplicationPrimary::acceptStandby() {
+	int fd = accept4(listeningFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if(fd < 0) {
+		return;
+	}
+
+	closeStandby();
+	int noDelay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+	standbyFd = fd;
+	eventLoop.watch(standbyFd, EPOLLIN | EPOLLRDHUP, [this](uint32_t events) { onStandbyEvents(events); });
+	resynchronize();
+}
+
+void ReplicationPrimary::closeStandby() {
+	streaming = false;
+	if(standbyFd < 0) {
+		return;
+	}
+
+	eventLoop.unwatch(standbyFd);
+	close(standbyFd);
+	standbyFd = -1;
+	output.clear();
+	outputOffset = 0;
+	snapshotBytes = 0;
+	++disconnects;
+}
+
+void ReplicationPrimary::onStandbyEvents(uint32_t events) {
+	if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+		closeStandby();
+		return;
+	}
+	if(events & EPOLLIN) {
+		/* Standby never sends anything, reading only detects closed connection */
+		char discarded[256];
+		if(read(standbyFd, discarded, sizeof(discarded)) <= 0 && errno != EAGAIN) {
+			closeStandby();
+			return;
+		}
+	}
+	if(events & EPOLLOUT) {
+		writeOutput();
+	}
+}
+
+/*
+ * Workers are paused while the snapshot is taken, events queued before it are dropped
+ * because snapshot already contains them, events queued after it follow in order.
+ */
+void ReplicationPrimary::resynchronize() {
+	if(standbyFd < 0) {
+		return;
+	}
+
+	ReplicationBuffer snapshot;
+	snapshot.appendControlFrame(REPLICATION_RESYNC_START_FRAME);
+	{
+		PipelinePause pause(pipeline);
+		lock_guard<mutex> lock(pendingMutex);
+
+		pending = ReplicationBuffer();
+		replaying = &snapshot;
+		allocator.replayLeases(*this);
+		replaying = NULL;
+		streaming = true;
+	}
+	snapshot.appendControlFrame(REPLICATION_RESYNC_END_FRAME);
+
+	eventsSent += snapshot.getEventsCount();
+	snapshot.moveTo(output);
+	snapshotBytes = output.size() - outputOffset;
+	++resynchronizations;
+	secondsSinceResync = 0;
+	flushPending();
+}
+
+void ReplicationPrimary::onLeaseUpdated(uint32_t networkAddress, const HardwareAddress& hardwareAddress, const AllocatedAddress& address) {
+	queueEvent(LEASE_UPDATED_EVENT, networkAddress, hardwareAddress, address);
+}
+
+void ReplicationPrimary::onLeaseUpdated(uint32_t networkAddress, const ClientSpecialId& specialId, const AllocatedAddress& address) {
+	queueEvent(LEASE_UPDATED_EVENT, networkAddress, specialId, address);
+}
+
+void ReplicationPrimary::onLeaseRemoved(uint32_t networkAddress, const HardwareAddress& hardwareAddress, uint32_t ipAddress, bool reusable) {
+	AllocatedAddress address;
+	address.ipAddress = ipAddress;
+	address.leaseTime = 0;
+	address.allocationTime = 0;
+	queueEvent(reusable ? LEASE_REMOVED_EVENT : LEASE_DECLINED_EVENT, networkAddress, hardwareAddress, address);
+}
+
+void ReplicationPrimary::onLeaseRemoved(uint32_t networkAddress, const ClientSpecialId& specialId, uint32_t ipAddress, bool reusable) {
+	AllocatedAddress address;
+	address.ipAddress = ipAddress;
+	address.leaseTime = 0;
+	address.allocationTime = 0;
+	queueEvent(reusable ? LEASE_REMOVED_EVENT : LEASE_DECLINED_EVENT, networkAddress, specialId, address);
+}
+
+/*
+ * Replayed leases go straight to the snapshot, workers are paused at that time.
+ * Otherwise the first event of a batch wakes the event loop up.
+ */
+template <class T> void ReplicationPrimary::queueEvent(uint8_t event, uint32_t networkAddress, const T& clientId, const AllocatedAddress& address) {
+	if(replaying) {
+		replaying->appendLease(event, networkAddress, clientId, address);
+		return;
+	}
+	if(!streaming) {
+		return;
+	}
+
+	bool wasEmpty;
+	{
+		lock_guard<mutex> lock(pendingMutex);
+		wasEmpty = pending.empty();
+		pending.appendLease(event, networkAddress, clientId, address);
+	}
+
+	if(wasEmpty) {
+		uint64_t notification = 1;
+		if(write(wakeupFd, &notification, sizeof(notification)) != sizeof(notification)) {
+			return;
+		}
+	}
+}
+
+void ReplicationPrimary::flushPending() {
+	if(standbyFd < 0) {
+		return;
+	}
+
+	{
+		lock_guard<mutex> lock(pendingMutex);
+		eventsSent += pending.getEventsCount();
+		pending.moveTo(output);
+	}
+
+	/* Snapshot itself does not count into the backlog */
+	if(output.size() - outputOffset > maxBacklog + snapshotBytes) {
+		closeStandby();
+		return;
+	}
+	writeOutput();
+}
+
+void ReplicationPrimary::writeOutput() {
+	while(outputOffset < output.size()) {
+		ssize_t writtenBytes = write(standbyFd, &output[outputOffset], output.size() - outputOffset);
+		if(writtenBytes < 0) {
+			if(errno == EAGAIN) {
+				eventLoop.modify(standbyFd, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+			}
+			else {
+				closeStandby();
+			}
+			return;
+		}
+
+		outputOffset += writtenBytes;
+		bytesSent += writtenBytes;
+	}
+
+	output.clear();
+	outputOffset = 0;
+	snapshotBytes = 0;
+	eventLoop.modify(standbyFd, EPOLLIN | EPOLLRDHUP);
+}
+
+void ReplicationPrimary::tick(uint32_t elapsedSeconds) {
+	secondsSinceResync += elapsedSeconds;
+	if(resyncInterval && secondsSinceResync >= resyncInterval) {
+		resynchronize();
+	}
+}
+
+string ReplicationPrimary::describe() {
+	ostringstream description;
+	description << "role primary\n"
+		<< "standby_connected " << (standbyFd >= 0) << "\n"
+		<< "events_sent " << eventsSent << "\n"
+		<< "bytes_sent " << bytesSent << "\n"
+		<< "backlog_bytes " << (output.size() - outputOffset) << "\n"
+		<< "resynchronizations " << resynchronizations << "\n"
+		<< "disconnects " << disconnects << "\n";
+
+	return description.str();
+}
@@ -0,0 +1,221 @@
+#include "../inc/replication_standby.h"
+#include "../inc/replication_buffer.h"
+#include "../inc/state_deserializer.h"
+#include "../inc/client.h"
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <endian.h>
+#include <sstream>
+#include <stdexcept>
+
+#define RECEIVE_CHUNK_SIZE (64 * 1024)
+
+using namespace std;
+
+ReplicationStandby::ReplicationStandby(EventLoop& loop, AddressesAllocator& addressesAllocator, Config& config)
+	: eventLoop(loop), allocator(addressesAllocator), primaryFd(-1), connected(false), synchronized(false),
+	eventsReceived(0), bytesReceived(0), resynchronizations(0), disconnects(0), lastLag(0), maxLag(0) {
+
+	memset(&primaryAddress, 0, sizeof(primaryAddress));
+	primaryAddress.sin_family = AF_INET;
+	primaryAddress.sin_port = htons(config.getReplicationPort());
+	if(inet_pton(AF_INET, config.getReplicationAddress(), &primaryAddress.sin_addr) != 1) {
+		throw runtime_error("Invalid replication address");
+	}
+
+	connectPrimary();
+}
+
+ReplicationStandby::~ReplicationStandby() {
+	closePrimary();
+}
+
+void ReplicationStandby::connectPrimary() {
+	primaryFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(primaryFd < 0) {
+		return;
+	}
+
+	if(connect(primaryFd, (struct sockaddr*)&primaryAddress, sizeof(primaryAddress)) < 0 && errno != EINPROGRESS) {
+		close(primaryFd);
+		primaryFd = -1;
+		return;
+	}
+
+	eventLoop.watch(primaryFd, EPOLLIN | EPOLLOUT | EPOLLRDHUP, [this](uint32_t events) { onPrimaryEvents(events); });
+}
+
+void ReplicationStandby::closePrimary() {
+	if(primaryFd < 0) {
+		return;
+	}
+
+	eventLoop.unwatch(primaryFd);
+	close(primaryFd);
+	primaryFd = -1;
+	input.clear();
+	if(connected) {
+		++disconnects;
+	}
+	connected = false;
+	synchronized = false;
+}
+
+void ReplicationStandby::tick() {
+	if(primaryFd < 0) {
+		connectPrimary();
+	}
+}
+
+void ReplicationStandby::onPrimaryEvents(uint32_t events) {
+	if(events & (EPOLLERR | EPOLLHUP)) {
+		closePrimary();
+		return;
+	}
+	if(!connected && (events & EPOLLOUT)) {
+		connected = true;
+		eventLoop.modify(primaryFd, EPOLLIN | EPOLLRDHUP);
+	}
+	if(!(events & (EPOLLIN | EPOLLRDHUP))) {
+		return;
+	}
+
+	while(true) {
+		size_t receivedBytes = input.size();
+		input.resize(receivedBytes + RECEIVE_CHUNK_SIZE);
+		ssize_t readBytes = read(primaryFd, &input[receivedBytes], RECEIVE_CHUNK_SIZE);
+		input.resize(receivedBytes + (readBytes > 0 ? readBytes : 0));
+
+		if(readBytes == 0 || (readBytes < 0 && errno != EAGAIN)) {
+			closePrimary();
+			return;
+		}
+		if(readBytes < 0) {
+			break;
+		}
+		bytesReceived += readBytes;
+	}
+
+	size_t processedBytes;
+	try {
+		processedBytes = processFrames();
+	}
+	catch(runtime_error& e) {
+		closePrimary();
+		return;
+	}
+	input.erase(input.begin(), input.begin() + processedBytes);
+}
+
+size_t ReplicationStandby::processFrames() {
+	size_t offset = 0;
+	while(input.size() - offset >= sizeof(ReplicationFrameHeader)) {
+		ReplicationFrameHeader header;
+		memcpy(&header, &input[offset], sizeof(header));
+		header.magic = le32toh(header.magic);
+		header.type = le32toh(header.type);
+		header.length = le32toh(header.length);
+		header.recordsCount = le32toh(header.recordsCount);
+		header.createdAt = le64toh(header.createdAt);
+
+		if(header.magic != REPLICATION_MAGIC || header.length > REPLICATION_MAX_FRAME_SIZE) {
+			throw runtime_error("Malformed replication stream");
+		}
+		if(input.size() - offset - sizeof(header) < header.length) {
+			break;
+		}
+
+		applyFrame(header, &input[offset + sizeof(header)]);
+		offset += sizeof(header) + header.length;
+	}
+
+	return offset;
+}
+
+void ReplicationStandby::applyFrame(const ReplicationFrameHeader& header, const uint8_t* payload) {
+	if(header.type == REPLICATION_RESYNC_START_FRAME) {
+		allocator.clearLeases();
+		synchronized = false;
+		return;
+	}
+	if(header.type == REPLICATION_RESYNC_END_FRAME) {
+		synchronized = true;
+		++resynchronizations;
+		return;
+	}
+	if(header.type != REPLICATION_LEASES_FRAME) {
+		return;
+	}
+
+	size_t offset = 0;
+	for(uint32_t i = 0; i < header.recordsCount; ++i) {
+		ReplicatedLeaseHeader record;
+		if(header.length - offset < sizeof(record)) {
+			throw runtime_error("Malformed replication frame");
+		}
+		memcpy(&record, payload + offset, sizeof(record));
+		offset += sizeof(record);
+
+		if(header.length - offset < record.idLength) {
+			throw runtime_error("Malformed replication frame");
+		}
+		applyLease(record, payload + offset);
+		offset += record.idLength;
+	}
+
+	eventsReceived += header.recordsCount;
+	lastLag = ReplicationBuffer::now() - header.createdAt;
+	if(lastLag > maxLag) {
+		maxLag = lastLag;
+	}
+}
+
+void ReplicationStandby::applyLease(const ReplicatedLeaseHeader& record, const uint8_t* id) {
+	AllocatedAddress address;
+	uint32_t networkAddress = StateDeserializer::deserialize(record.lease, &address);
+
+	if(record.identificationMethod == BASED_ON_HARDWARE) {
+		uint8_t rawAddress[MAX_HADDR_SIZE] = {0};
+		memcpy(rawAddress, id, min((size_t)record.idLength, (size_t)MAX_HADDR_SIZE));
+		HardwareAddress hardwareAddress(record.idType, rawAddress);
+
+		if(record.event == LEASE_UPDATED_EVENT) {
+			allocator.restoreLease(networkAddress, hardwareAddress, address);
+		}
+		else {
+			allocator.removeLease(networkAddress, hardwareAddress, record.event == LEASE_REMOVED_EVENT);
+		}
+	}
+	else {
+		ClientSpecialId specialId;
+		memset(&specialId, 0, sizeof(specialId));
+		specialId.type = record.idType;
+		memcpy(specialId.value, id, min((size_t)record.idLength, (size_t)CLIENT_SPECIAL_ID_MAX_LEN));
+
+		if(record.event == LEASE_UPDATED_EVENT) {
+			allocator.restoreLease(networkAddress, specialId, address);
+		}
+		else {
+			allocator.removeLease(networkAddress, specialId, record.event == LEASE_REMOVED_EVENT);
+		}
+	}
+}
+
+string ReplicationStandby::describe() {
+	ostringstream description;
+	description << "role standby\n"
+		<< "primary_connected " << connected << "\n"
+		<< "synchronized " << synchronized << "\n"
+		<< "events_received " << eventsReceived << "\n"
+		<< "bytes_received " << bytesReceived << "\n"
+		<< "resynchronizations " << resynchronizations << "\n"
+		<< "disconnects " << disconnects << "\n"
+		<< "last_lag_us " << lastLag << "\n"
+		<< "max_lag_us " << maxLag << "\n";
+
+	return description.str();
+}
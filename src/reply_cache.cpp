@@ -0,0 +1,97 @@
+#include "../inc/reply_cache.h"
+#include "../inc/option.h"
+#include <string.h>
+
+using namespace std;
+
+ReplyCache::ReplyCache(Config& config): mask(0), timeToLive(config.getReplyCacheTimeToLive()), replayed(0) {
+	size_t requestedSize = config.getReplyCacheSize();
+	if(requestedSize == 0) {
+		return;
+	}
+
+	size_t capacity = 1;
+	while(capacity < requestedSize) {
+		capacity <<= 1;
+	}
+	mask = capacity - 1;
+
+	CachedReply emptyReply;
+	memset(&emptyReply, 0, sizeof(emptyReply));
+	replies.assign(capacity, emptyReply);
+}
+
+bool ReplyCache::isCacheable(const IncomingMessage& request) {
+	return !replies.empty() && (request.messageType == DHCPDISCOVER || request.messageType == DHCPREQUEST);
+}
+
+ReplyCache::CachedReply* ReplyCache::find(const IncomingMessage& request) {
+	uint32_t hash = request.message.xid * 2654435761u;
+	for(unsigned i = 0; i < MAX_HADDR_SIZE; ++i) {
+		hash = (hash ^ request.message.chaddr[i]) * 16777619u;
+	}
+
+	return &replies[hash & mask];
+}
+
+bool ReplyCache::replay(const IncomingMessage& request, Sender& sender, uint64_t nowMs) {
+	if(!isCacheable(request)) {
+		return false;
+	}
+
+	CachedReply* cached = find(request);
+	if(!cached->valid || nowMs - cached->storedAt > timeToLive || cached->xid != request.message.xid
+		|| cached->requestType != request.messageType || cached->htype != request.message.htype
+		|| memcmp(cached->chaddr, request.message.chaddr, MAX_HADDR_SIZE) != 0) {
+		return false;
+	}
+
+	/* Sender converts message to network order in place, cached copy has to stay intact */
+	DHCPMessage reply;
+	memcpy(&reply, &cached->reply.message, sizeof(reply));
+	sender.send(reply, cached->reply.messageType);
+	replayed.fetch_add(1, memory_order_relaxed);
+
+	return true;
+}
+
+void ReplyCache::store(const IncomingMessage& request, const DHCPMessage& reply, unsigned replyType, uint64_t nowMs) {
+	if(!isCacheable(request)) {
+		return;
+	}
+
+	CachedReply* cached = find(request);
+	cached->valid = true;
+	cached->storedAt = nowMs;
+	cached->xid = request.message.xid;
+	cached->requestType = request.messageType;
+	cached->htype = request.message.htype;
+	memcpy(cached->chaddr, request.message.chaddr, MAX_HADDR_SIZE);
+	memcpy(&cached->reply.message, &reply, sizeof(reply));
+	cached->reply.messageType = replyType;
+}
+
+uint64_t ReplyCache::getReplayed() {
+	return replayed.load(memory_order_relaxed);
+}
+
+CachingSender::CachingSender(Sender& targetSender, ReplyCache& replyCache, MetricsShard& metricsShard, const IncomingMessage& incoming, uint64_t nowMs)
+	: target(targetSender), cache(replyCache), metrics(metricsShard), request(incoming), now(nowMs), sentCount(0) {}
+
+void CachingSender::send(DHCPMessage& reply, unsigned messageType) {
+	cache.store(request, reply, messageType, now);
+	target.send(reply, messageType);
+	metrics.countReplied(messageType);
+	++sentCount;
+}
+
+void CachingSender::sendTagged(DHCPMessage& reply, unsigned messageType, const VlanTags& vlanTags) {
+	cache.store(request, reply, messageType, now);
+	target.sendTagged(reply, messageType, vlanTags);
+	metrics.countReplied(messageType);
+	++sentCount;
+}
+
+unsigned CachingSender::getSentCount() {
+	return sentCount;
+}
@@ -1,12 +1,16 @@
 #include "../inc/request_handler.h"
 #include "../inc/packer.h"
+#include "../inc/stage_profiler.h"
+#include "../inc/tracepoints.h"
+#include "../inc/lease_times.h"
 
-RequestHandler::RequestHandler(TransactionsStorage& storage, Client& clientToHandle, AddressesAllocator& addrAllocator, Server& serv)
-	: transactionsStorage(storage), client(clientToHandle), allocator(addrAllocator), server(serv) {}
+RequestHandler::RequestHandler(TransactionsStorage& storage, Client& clientToHandle, AddressesAllocator& addrAllocator, Server& serv, Sender& responseSender)
+	: transactionsStorage(storage), client(clientToHandle), allocator(addrAllocator), server(serv), sender(responseSender), clientState(UNKNOWN), respondedAddress(0) {}
 
 
 void RequestHandler::handle(struct DHCPMessage& request, Options& options, uint32_t dstAddr) {
-	ClientState clientState = determineClientState(request, options, dstAddr);
+	TRACE4(handler__entry, DHCPREQUEST, request.xid, tracedClientKey(client), client.networkAddress);
+	clientState = determineClientState(request, options, dstAddr);
 	switch(clientState) {
 		case SELECTING:
 			handleSelectingState(request, options);
@@ -24,6 +28,11 @@ void RequestHandler::handle(struct DHCPMessage& request, Options& options, uint3
 			break;
 	}
 	transactionsStorage.removeTransaction(request.xid);
+	TRACE5(handler__exit, DHCPREQUEST, request.xid, tracedClientKey(client), client.networkAddress, respondedAddress);
+}
+
+ClientState RequestHandler::getClientState() {
+	return clientState;
 }
 
 ClientState RequestHandler::determineClientState(struct DHCPMessage& request, Options& options, uint32_t dstAddr) {
@@ -56,7 +65,7 @@ ClientState RequestHandler::determineClientState(struct DHCPMessage& request, Op
 
 void RequestHandler::handleSelectingState(struct DHCPMessage& request, Options& options) {
 	Option& serverIdentifier = options.get(SERVER_IDENTIFIER);
-	if(serverIdentifier.length != sizeof(uint32_t) || *((uint32_t*)serverIdentifier.value) != server.serverIp) {
+	if(serverIdentifier.length != sizeof(uint32_t) || !server.isServerIp(*((uint32_t*)serverIdentifier.value))) {
 		allocator.freeClientAddress(client);
 	}
 	else if(transactionsStorage.transactionExists(request.xid)) {
@@ -118,14 +127,19 @@ void RequestHandler::respond(DHCPMessage& request, const AllocatedAddress& alloc
 	response.magicCookie = request.magicCookie;
 
 
+	PROFILE_BEGIN(packStart);
 	Packer packer(response.options);
 	packer.pack(IP_ADDRESS_LEASE_TIME, allocatedAddress.leaseTime)
+		.pack(RENEWAL_TIME, LeaseTimes::renewalTime(*allocatedAddress.descriptor, allocatedAddress.ipAddress, allocatedAddress.leaseTime))
+		.pack(REBINDING_TIME, LeaseTimes::rebindingTime(allocatedAddress.leaseTime))
 		.pack(DHCP_MESSAGE_TYPE, messageType)
-		.pack(SERVER_IDENTIFIER, server.serverIp)
-		.pack(SUBNET_MASK, allocatedAddress.mask)
-		.pack(ROUTERS, allocatedAddress.routers)
-		.pack(DNS_OPTION, allocatedAddress.dnsServers)
+		.pack(SERVER_IDENTIFIER, server.getServerIp(client))
+		.pack(SUBNET_MASK, allocatedAddress.descriptor->networkMask)
+		.pack(ROUTERS, allocatedAddress.descriptor->options->routers)
+		.pack(DNS_OPTION, allocatedAddress.descriptor->options->dnsServers)
 		.pack(END_OPTION);
+	PROFILE_END(packStart, STAGE_PACK);
 	
-	server.sender->send(response, DHCPACK);
+	sender.send(response, DHCPACK);
+	respondedAddress = messageType == DHCPACK ? allocatedAddress.ipAddress : 0;
 }
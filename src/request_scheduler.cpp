@@ -0,0 +1,126 @@
+#include "../inc/request_scheduler.h"
+#include "../inc/option.h"
+#include <string.h>
+#include <sstream>
+
+using namespace std;
+
+RequestScheduler::RequestScheduler(Config& config)
+	: selectedQueue(NULL), selectedClass(NULL), queueSize(config.getSchedulerQueueSize()), quantum(config.getSchedulerQuantum()),
+	maxDiscoverDelay(config.getMaxDiscoverDelay()), maxDiscoverSecs(config.getMaxDiscoverSecs()), shed(0) {
+
+	if(quantum < 1) {
+		quantum = 1;
+	}
+}
+
+bool RequestScheduler::enqueue(const IncomingMessage& incoming, uint64_t nowMs) {
+	PriorityClass& priorityClass = classes[incoming.messageType == DHCPDISCOVER ? SCHEDULER_LOW_PRIORITY : SCHEDULER_HIGH_PRIORITY];
+	if(priorityClass.queued >= queueSize) {
+		++priorityClass.dropped;
+		return false;
+	}
+
+	RelayQueue& relayQueue = priorityClass.relays[incoming.message.giaddr];
+	relayQueue.messages.emplace_back();
+	QueuedMessage& queued = relayQueue.messages.back();
+	queued.incoming = incoming;
+	queued.enqueuedAt = nowMs;
+	++priorityClass.queued;
+
+	if(relayQueue.messages.size() == 1) {
+		priorityClass.activeRelays.push_back(incoming.message.giaddr);
+	}
+
+	return true;
+}
+
+IncomingMessage* RequestScheduler::front(uint64_t nowMs) {
+	for(unsigned i = 0; i < SCHEDULER_CLASSES_COUNT; ++i) {
+		RelayQueue* relayQueue = selectRelay(classes[i], i == SCHEDULER_LOW_PRIORITY, nowMs);
+		if(relayQueue != NULL) {
+			selectedQueue = relayQueue;
+			selectedClass = &classes[i];
+			return &relayQueue->messages.front().incoming;
+		}
+	}
+
+	return NULL;
+}
+
+/* Selected relay is always at the head of its class active list */
+void RequestScheduler::pop() {
+	selectedQueue->messages.pop_front();
+	--selectedQueue->deficit;
+	--selectedClass->queued;
+
+	if(selectedQueue->messages.empty()) {
+		selectedClass->relays.erase(selectedClass->activeRelays.front());
+		selectedClass->activeRelays.pop_front();
+		selectedClass->quantumGranted = false;
+	}
+	selectedQueue = NULL;
+	selectedClass = NULL;
+}
+
+/*
+ * Relay at the head of active list gets quantum once per round and is served until its deficit runs out,
+ * then it goes to the back. Relay is active exactly while it has queued messages, an emptied one
+ * is forgotten together with its deficit, so memory is bounded by the number of queued messages.
+ */
+RequestScheduler::RelayQueue* RequestScheduler::selectRelay(PriorityClass& priorityClass, bool shedStale, uint64_t nowMs) {
+	while(!priorityClass.activeRelays.empty()) {
+		RelayQueue& relayQueue = priorityClass.relays[priorityClass.activeRelays.front()];
+		if(!priorityClass.quantumGranted) {
+			relayQueue.deficit += quantum;
+			priorityClass.quantumGranted = true;
+		}
+
+		while(shedStale && !relayQueue.messages.empty() && isStale(relayQueue.messages.front(), nowMs)) {
+			relayQueue.messages.pop_front();
+			--priorityClass.queued;
+			++shed;
+		}
+
+		if(relayQueue.messages.empty()) {
+			priorityClass.relays.erase(priorityClass.activeRelays.front());
+			priorityClass.activeRelays.pop_front();
+			priorityClass.quantumGranted = false;
+			continue;
+		}
+		if(relayQueue.deficit == 0) {
+			priorityClass.activeRelays.push_back(priorityClass.activeRelays.front());
+			priorityClass.activeRelays.pop_front();
+			priorityClass.quantumGranted = false;
+			continue;
+		}
+
+		return &relayQueue;
+	}
+
+	return NULL;
+}
+
+bool RequestScheduler::isStale(const QueuedMessage& queued, uint64_t nowMs) {
+	if(maxDiscoverDelay && nowMs - queued.enqueuedAt > maxDiscoverDelay) {
+		return true;
+	}
+
+	return maxDiscoverSecs && queued.incoming.message.secs > maxDiscoverSecs;
+}
+
+bool RequestScheduler::empty() {
+	return classes[SCHEDULER_HIGH_PRIORITY].queued == 0 && classes[SCHEDULER_LOW_PRIORITY].queued == 0;
+}
+
+string RequestScheduler::describe() {
+	PriorityClass& high = classes[SCHEDULER_HIGH_PRIORITY];
+	PriorityClass& low = classes[SCHEDULER_LOW_PRIORITY];
+
+	ostringstream description;
+	description << "high_queued " << high.queued << " high_relays " << high.activeRelays.size() << " high_dropped " << high.dropped
+		<< " low_queued " << low.queued << " low_relays " << low.activeRelays.size() << " low_dropped " << low.dropped
+		<< " shed " << shed;
+
+	return description.str();
+}
@@ -8,95 +8,532 @@
 #include "../inc/release_handler.h"
 #include "../inc/inform_handler.h"
 #include "../inc/packet_converter.h"
+#include "../inc/stage_profiler.h"
+#include "../inc/tracepoints.h"
+#include "../inc/cpu_affinity.h"
 
-#include <sys/ioctl.h>
 #include <stdio.h>
 #include <linux/if_ether.h>
 #include <linux/ip.h>
 #include <linux/udp.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/ioctl.h>
-#include <net/if.h>
 #include <stdexcept>
+#include <errno.h>
+#include <sstream>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 
-#define MAX_FILTER_SIZE 64
+#define MIN_OPTIONS_SIZE 3
 
 using namespace std;
 
-Server::Server(Config &configuration, AddressesAllocator& allocator, TransactionsStorage& storage)
- 	  : config(configuration), addressesAllocator(allocator), transactionsStorage(storage) {
+Server::Server(Config &configuration, AddressesAllocator& allocator, TransactionsStorage& storage, Clock& serverClock)
+ 	  : clock(serverClock), config(configuration), addressesAllocator(allocator), transactionsStorage(storage), clientsLimiter(NULL), relaysLimiter(NULL), receivingInterface(NULL), busyPolling(false), controlSocket(NULL), secondsSinceSnapshot(0), pipeline(NULL), scheduler(NULL), replyCache(configuration), receiveMetrics(metrics.createShard()), metricsEndpoint(NULL), poolsMonitor(allocator), scheduledFd(-1), replicationPrimary(NULL), replicationStandby(NULL), bulkLeasequery(NULL), reloading(false), reloadedConfig(NULL) {
 
 	networkResolver = new NetworkResolver(config);
-	const char* interfaceName = config.getInterface();
+	createInterfaces();
+	loadBalancer = new LoadBalancer(config, getServerIps());
+	createRateLimiters(config);
 
-	serverIp = determineDeviceIp(interfaceName);
+	if(config.getPipelineWorkers() > 0) {
+		vector<Sender*> transmitters;
+		for(vector<NetworkInterface*>::iterator it = interfaces.begin(); it != interfaces.end(); it++) {
+			transmitters.push_back(&(*it)->getSender());
+		}
+		pipeline = new Pipeline(config, *this, clock, transmitters, metrics);
+	}
+	else {
+		scheduler = new RequestScheduler(config);
+		scheduledFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if(scheduledFd < 0) {
+			throw runtime_error("Could not create scheduler notifier");
+		}
+	}
+
+	createSignalsDescriptor();
+	createTimer();
+	createReloadNotifier();
+	createReplication();
+	createBulkLeasequery();
+	createControlSocket();
+	createMetricsEndpoint();
+}
+
+void Server::createInterfaces() {
+	const vector<InterfaceDescriptor>& descriptors = config.getInterfaces();
+	for(size_t i = 0; i < descriptors.size(); ++i) {
+		interfaces.push_back(new NetworkInterface(descriptors[i], i));
+	}
+}
+
+vector<uint32_t> Server::getServerIps() {
+	vector<uint32_t> serverIps;
+	for(vector<NetworkInterface*>::iterator it = interfaces.begin(); it != interfaces.end(); it++) {
+		serverIps.push_back((*it)->getServerIp());
+	}
+
+	return serverIps;
+}
 
-	pcapHandle = pcap_create(interfaceName, pcapErrbuf);
-	if(pcapHandle == NULL) {
-		throw runtime_error(pcapErrbuf);
+uint32_t Server::getServerIp(const Client& client) {
+	return interfaces[client.interfaceIndex]->getServerIp();
+}
+
+bool Server::isServerIp(uint32_t address) {
+	for(vector<NetworkInterface*>::iterator it = interfaces.begin(); it != interfaces.end(); it++) {
+		if((*it)->getServerIp() == address) {
+			return true;
+		}
 	}
-	pcap_set_snaplen(pcapHandle, 65535);
-	if(pcap_activate(pcapHandle) != 0) {
-		throw runtime_error(pcapErrbuf);
+
+	return false;
+}
+
+void Server::createMetricsEndpoint() {
+	if(config.getMetricsPort() == 0) {
+		return;
 	}
 
-	lnetHandle = libnet_init(LIBNET_LINK, interfaceName, lnetErrbuf);
-	sender = new Sender(lnetHandle);
+	metricsEndpoint = new MetricsEndpoint(eventLoop, config.getMetricsAddress(), config.getMetricsPort(), [this]() {
+		return renderMetrics();
+	});
+}
 
-	setPacketsFilter();
+string Server::renderMetrics() {
+	string captureMode = string("# TYPE dhcp_capture_busy_poll gauge\ndhcp_capture_busy_poll ") + (busyPolling ? "1" : "0") + "\n";
+	string pipelineMetrics = pipeline != NULL ? pipeline->render() : "";
+	return metrics.render() + captureMode + pipelineMetrics + poolsMonitor.render() + MemoryAccounting::render(poolsMonitor.countLeases());
 }
 
-uint32_t Server::determineDeviceIp(const char* interfaceName) {
-	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+/* Limiters are rebuilt on reload, buckets start full again */
+void Server::createRateLimiters(Config& source) {
+	delete clientsLimiter;
+	delete relaysLimiter;
+	clientsLimiter = new RateLimiter(source.getClientRateLimit(), source.getClientRateBurst(), source.getRateLimitTableSize());
+	relaysLimiter = new RateLimiter(source.getRelayRateLimit(), source.getRelayRateBurst(), source.getRateLimitTableSize());
+}
 
-	struct ifreq ifr;
-	ifr.ifr_addr.sa_family = AF_INET;
-	strncpy(ifr.ifr_name, interfaceName, IFNAMSIZ-1);
-	ioctl(fd, SIOCGIFADDR, &ifr);
-	close(fd);
+string Server::describeRateLimiters() {
+	ostringstream description;
+	description << "clients_allowed " << clientsLimiter->getAllowed() << "\n"
+		<< "clients_dropped " << clientsLimiter->getDropped() << "\n"
+		<< "relays_allowed " << relaysLimiter->getAllowed() << "\n"
+		<< "relays_dropped " << relaysLimiter->getDropped() << "\n";
 
-	return ntohl(((struct sockaddr_in *)&ifr.ifr_addr)->sin_addr.s_addr);
+	return description.str();
 }
 
-void Server::setPacketsFilter() {
-	struct bpf_program fp;
+/* Replication role is read once, "promote" command is the only way to change it at runtime */
+void Server::createReplication() {
+	string role = config.getReplicationRole();
+	if(role == "primary") {
+		replicationPrimary = new ReplicationPrimary(eventLoop, addressesAllocator, pipeline, config);
+	}
+	else if(role == "standby") {
+		replicationStandby = new ReplicationStandby(eventLoop, addressesAllocator, config);
+	}
+	else if(role != "none") {
+		throw runtime_error("Unknown replication role: " + role);
+	}
+}
+
+void Server::createBulkLeasequery() {
+	if(config.getLeasequeryPort() == 0) {
+		return;
+	}
+
+	/* Leasequery is not tied to a link, the first interface identifies the server */
+	bulkLeasequery = new BulkLeasequery(eventLoop, addressesAllocator, pipeline, config, clock, interfaces.front()->getServerIp());
+}
+
+/* Standby stops following the primary and starts answering clients with replicated leases */
+void Server::promote() {
+	delete replicationStandby;
+	replicationStandby = NULL;
+}
+
+void Server::createReloadNotifier() {
+	reloadFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(reloadFd < 0) {
+		throw runtime_error("Could not create reload notifier");
+	}
+}
+
+/*
+ * Signals are blocked for the whole process and consumed from the event loop,
+ * so shutdown happens between packets instead of inside an asynchronous handler.
+ * Server has to be created before any long living thread, which inherits the mask.
+ */
+void Server::createSignalsDescriptor() {
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGHUP);
+
+	if(pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0) {
+		throw runtime_error("Could not block signals");
+	}
+
+	signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+	if(signalFd < 0) {
+		throw runtime_error("Could not create signals descriptor");
+	}
+}
+
+void Server::createTimer() {
+	timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(timerFd < 0) {
+		throw runtime_error("Could not create housekeeping timer");
+	}
+
+	struct itimerspec interval;
+	memset(&interval, 0, sizeof(interval));
+	interval.it_value.tv_sec = HOUSEKEEPING_INTERVAL;
+	interval.it_interval.tv_sec = HOUSEKEEPING_INTERVAL;
+
+	if(timerfd_settime(timerFd, 0, &interval, NULL) < 0) {
+		throw runtime_error("Could not set housekeeping timer");
+	}
+}
 
-	uint16_t bootpServerPort = Protocol::getServicePortByName("bootps", "udp");
-	uint16_t bootpClientPort = Protocol::getServicePortByName("bootpc", "udp");
+void Server::createControlSocket() {
+	if(*config.getControlSocket() == '\0') {
+		return;
+	}
 
-	char filter[MAX_FILTER_SIZE] = {0};
-	snprintf(filter, MAX_FILTER_SIZE - 1, "ether proto 0x%04x and udp dst port %u and udp src port %u", ETH_P_IP, bootpServerPort, bootpClientPort);
-	if(pcap_compile(pcapHandle, &fp, filter, 0, config.getNetworkMask()) != 0) {
-		throw pcapErrbuf;
+	controlSocket = new ControlSocket(eventLoop, config.getControlSocket());
+	controlSocket->registerCommand("save", [this](const string&) {
+		save();
+		return string("saved\n");
+	});
+	controlSocket->registerCommand("reload", [this](const string&) {
+		reload();
+		return string("reloading\n");
+	});
+	controlSocket->registerCommand("stop", [this](const string&) {
+		stop();
+		return string("stopping\n");
+	});
+	if(pipeline != NULL) {
+		controlSocket->registerCommand("pipeline", [this](const string&) {
+			return pipeline->describe();
+		});
 	}
-	if(pcap_setfilter(pcapHandle, &fp) < 0) {
-		throw pcapErrbuf;
+	else {
+		controlSocket->registerCommand("scheduler", [this](const string&) {
+			ostringstream description;
+			description << scheduler->describe() << " replayed " << replyCache.getReplayed() << "\n";
+			return description.str();
+		});
+	}
+	controlSocket->registerCommand("profile", [](const string&) {
+		return StageProfiler::dump();
+	});
+	controlSocket->registerCommand("metrics", [this](const string&) {
+		return renderMetrics();
+	});
+	controlSocket->registerCommand("pools", [this](const string&) {
+		return poolsMonitor.describe();
+	});
+	controlSocket->registerCommand("buckets", [this](const string&) {
+		return loadBalancer->describe();
+	});
+	controlSocket->registerCommand("limits", [this](const string&) {
+		return describeRateLimiters();
+	});
+	if(replicationPrimary != NULL || replicationStandby != NULL) {
+		controlSocket->registerCommand("replication", [this](const string&) {
+			if(replicationPrimary != NULL) {
+				return replicationPrimary->describe();
+			}
+			if(replicationStandby != NULL) {
+				return replicationStandby->describe();
+			}
+			return string("role promoted\n");
+		});
+	}
+	if(bulkLeasequery != NULL) {
+		controlSocket->registerCommand("leasequery", [this](const string&) {
+			return bulkLeasequery->describe();
+		});
+	}
+	if(replicationStandby != NULL) {
+		controlSocket->registerCommand("promote", [this](const string&) {
+			if(replicationStandby == NULL) {
+				return string("already serving\n");
+			}
+			promote();
+			return string("promoted\n");
+		});
 	}
 }
 
 Server::~Server() {
-	pcap_close(pcapHandle); 
-	libnet_destroy(lnetHandle);
+	delete metricsEndpoint;
+	delete replicationPrimary;
+	delete replicationStandby;
+	delete bulkLeasequery;
+	delete pipeline;
+	delete scheduler;
+	if(scheduledFd >= 0) {
+		close(scheduledFd);
+	}
+	if(reloadThread.joinable()) {
+		reloadThread.join();
+	}
+	delete reloadedConfig;
+	delete controlSocket;
+	close(reloadFd);
+	close(timerFd);
+	close(signalFd);
+	for(vector<NetworkInterface*>::iterator it = interfaces.begin(); it != interfaces.end(); it++) {
+		delete *it;
+	}
 	delete networkResolver;
-	delete sender;
+	delete loadBalancer;
+	delete clientsLimiter;
+	delete relaysLimiter;
 }
 
 void Server::listen() {
-	pcap_loop(pcapHandle, 0, &Server::dispatch, (u_char*)this);
+	busyPolling = config.isBusyPollEnabled();
+	for(vector<NetworkInterface*>::iterator it = interfaces.begin(); it != interfaces.end(); it++) {
+		NetworkInterface* networkInterface = *it;
+		if(busyPolling) {
+			networkInterface->enableBusyPoll(config.getBusyPollMicroseconds());
+		}
+		else {
+			eventLoop.watch(networkInterface->getCaptureFd(), EPOLLIN, [this, networkInterface](uint32_t) { capture(networkInterface); });
+		}
+	}
+	eventLoop.watch(timerFd, EPOLLIN, [this](uint32_t) { onTimer(); });
+	eventLoop.watch(signalFd, EPOLLIN, [this](uint32_t) { onSignal(); });
+	eventLoop.watch(reloadFd, EPOLLIN, [this](uint32_t) { onConfigReloaded(); });
+	if(scheduler != NULL) {
+		eventLoop.watch(scheduledFd, EPOLLIN, [this](uint32_t) { processScheduled(); });
+	}
+
+	if(pipeline != NULL) {
+		pipeline->start();
+	}
+	CpuAffinity::pin(pthread_self(), config.getCaptureCore());
+	if(busyPolling) {
+		eventLoop.spin([this]() { pollCapture(); }, BUSY_POLL_ROUNDS);
+	}
+	else {
+		eventLoop.run();
+	}
+	if(pipeline != NULL) {
+		pipeline->stop();
+	}
+
+	for(vector<NetworkInterface*>::iterator it = interfaces.begin(); it != interfaces.end() && !busyPolling; it++) {
+		eventLoop.unwatch((*it)->getCaptureFd());
+	}
+	eventLoop.unwatch(timerFd);
+	eventLoop.unwatch(signalFd);
+	eventLoop.unwatch(reloadFd);
+	if(scheduler != NULL) {
+		eventLoop.unwatch(scheduledFd);
+	}
+}
+
+void Server::stop() {
+	eventLoop.stop();
+}
+
+/*
+ * Whole capture buffer is moved to the scheduler, but only one batch is handled per loop iteration.
+ * Backlog waits in the scheduler, where it is prioritized, instead of in the kernel buffer.
+ */
+void Server::capture(NetworkInterface* networkInterface) {
+	clock.refresh();
+	receivingInterface = networkInterface;
+	networkInterface->capture(&Server::dispatch, (u_char*)this);
+	if(scheduler != NULL) {
+		processScheduled();
+	}
+}
+
+/*
+ * Busy poll counterpart of capture(): called in a loop, so the ring is checked without sleeping
+ * in epoll and scheduled requests are handled right after they arrive. Every interface is polled in turn.
+ */
+void Server::pollCapture() {
+	clock.refresh();
+	int received = 0;
+	for(vector<NetworkInterface*>::iterator it = interfaces.begin(); it != interfaces.end(); it++) {
+		receivingInterface = *it;
+		received += receivingInterface->capture(&Server::dispatch, (u_char*)this);
+	}
+	if(scheduler != NULL && (received > 0 || !scheduler->empty())) {
+		processScheduled();
+	}
+}
+
+void Server::processScheduled() {
+	uint64_t notifications;
+	if(read(scheduledFd, &notifications, sizeof(notifications)) < 0 && errno != EAGAIN) {
+		return;
+	}
+
+	uint64_t now = clock.monotonicMs();
+	IncomingMessage* message;
+	for(unsigned i = 0; i < SCHEDULED_BATCH_SIZE && (message = scheduler->front(now)) != NULL; ++i) {
+		TaggedSender interfaceSender(interfaces[message->client.interfaceIndex]->getSender(), message->vlanTags);
+		process(*message, transactionsStorage, replyCache, *receiveMetrics, interfaceSender);
+		scheduler->pop();
+	}
+
+	/* Remaining requests are handled after other descriptors got their turn */
+	if(!scheduler->empty()) {
+		uint64_t notification = 1;
+		if(write(scheduledFd, &notification, sizeof(notification)) != sizeof(notification)) {
+			fprintf(stderr, "Could not schedule remaining requests\n");
+		}
+	}
+}
+
+void Server::onTimer() {
+	uint64_t expirations = 0;
+	if(read(timerFd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+		return;
+	}
+
+	clock.refresh();
+	transactionsStorage.removeExpired();
+	poolsMonitor.tick(expirations * HOUSEKEEPING_INTERVAL);
+	MemoryAccounting::sample();
+
+	secondsSinceSnapshot += expirations * HOUSEKEEPING_INTERVAL;
+	if(config.getSnapshotInterval() && secondsSinceSnapshot >= config.getSnapshotInterval()) {
+		secondsSinceSnapshot = 0;
+		trySave();
+	}
+
+	if(replicationPrimary != NULL) {
+		replicationPrimary->tick(expirations * HOUSEKEEPING_INTERVAL);
+	}
+	if(replicationStandby != NULL) {
+		replicationStandby->tick();
+	}
+}
+
+void Server::onSignal() {
+	struct signalfd_siginfo signalInfo;
+	while(read(signalFd, &signalInfo, sizeof(signalInfo)) == sizeof(signalInfo)) {
+		switch(signalInfo.ssi_signo) {
+			case SIGINT:
+			case SIGTERM:
+				stop();
+				break;
+			case SIGHUP:
+				reload();
+				break;
+		}
+	}
+}
+
+/* Periodic snapshot failure must not take the server down, next one will retry */
+void Server::trySave() {
+	try {
+		save();
+	}
+	catch(runtime_error& e) {
+		fprintf(stderr, "Could not save state: %s\n", e.what());
+	}
 }
 
 void Server::dispatch(u_char *srv, const struct pcap_pkthdr *header, const u_char *rawMessage) {
-	unsigned int dhcpMsgStartPos = sizeof(struct ethhdr) + sizeof(struct iphdr) + sizeof(struct udphdr);
-	DHCPMessage& dhcpMsg = *(DHCPMessage*)(rawMessage + dhcpMsgStartPos);
+	Server& server = *((Server*)srv);
+	server.receiveMetrics->recordCaptureDelay(Metrics::wallClockUs() - ((int64_t)header->ts.tv_sec * 1000000 + header->ts.tv_usec));
+	if(server.replicationStandby != NULL) {
+		server.receiveMetrics->countDropped(DROP_STANDBY);
+		return;
+	}
+
+	IncomingMessage incoming;
+	if(!server.parse(header, rawMessage, incoming)) {
+		return;
+	}
+
+	bool queued = server.pipeline != NULL ? server.pipeline->submit(incoming) : server.scheduler->enqueue(incoming, server.clock.monotonicMs());
+	if(!queued) {
+		server.receiveMetrics->countDropped(DROP_QUEUE_FULL);
+	}
+}
+
+bool Server::parse(const struct pcap_pkthdr *header, const u_char *rawMessage, IncomingMessage& incoming) {
+	unsigned ipHeaderPos = locateIpHeader(rawMessage, header->caplen, incoming.vlanTags);
+	if(ipHeaderPos == 0) {
+		receiveMetrics->countDropped(DROP_MALFORMED);
+		return false;
+	}
+
+	/* IP header length is variable, options are rare but allowed */
+	const struct iphdr* ipHeader = (const struct iphdr*)(rawMessage + ipHeaderPos);
+	unsigned int dhcpMsgStartPos = ipHeaderPos + ipHeader->ihl * 4 + sizeof(struct udphdr);
+	if(header->caplen < dhcpMsgStartPos + offsetof(DHCPMessage, options) + MIN_OPTIONS_SIZE) {
+		receiveMetrics->countDropped(DROP_MALFORMED);
+		return false;
+	}
+
+	/*
+	 * Limits are checked on raw packet before anything is copied or parsed. Client bucket goes first,
+	 * so a single flooding client does not use up tokens of its relay.
+	 */
+	const DHCPMessage* rawDhcpMsg = (const DHCPMessage*)(rawMessage + dhcpMsgStartPos);
+	uint64_t now = clock.monotonicMs();
+	if(!clientsLimiter->allow(rawDhcpMsg->chaddr, rawDhcpMsg->hlen < MAX_HADDR_SIZE ? rawDhcpMsg->hlen : MAX_HADDR_SIZE, now)
+		|| (rawDhcpMsg->giaddr && !relaysLimiter->allow((const uint8_t*)&rawDhcpMsg->giaddr, sizeof(rawDhcpMsg->giaddr), now))) {
+		receiveMetrics->countDropped(DROP_RATE_LIMITED);
+		return false;
+	}
+
+	size_t dhcpMsgLength = header->caplen - dhcpMsgStartPos;
+	if(dhcpMsgLength > sizeof(DHCPMessage)) {
+		dhcpMsgLength = sizeof(DHCPMessage);
+	}
+
+	PROFILE_BEGIN(parseStart);
+	DHCPMessage& dhcpMsg = incoming.message;
+	memcpy(&dhcpMsg, rawMessage + dhcpMsgStartPos, dhcpMsgLength);
+	memset((uint8_t*)&dhcpMsg + dhcpMsgLength, 0, sizeof(DHCPMessage) - dhcpMsgLength);
 	PacketConverter::toHostReprezentation(dhcpMsg);
+	PROFILE_END(parseStart, STAGE_PARSE);
+	TRACE4(packet__receive, dhcpMsg.xid, dhcpMsg.chaddr, dhcpMsg.giaddr, header->caplen);
 
-	Options options(dhcpMsg.options, header->caplen - dhcpMsgStartPos);
+	PROFILE_BEGIN(optionsStart);
+	incoming.optionsLength = dhcpMsgLength - offsetof(DHCPMessage, options);
+	Options options(dhcpMsg.options, incoming.optionsLength);
 	options.toHostReprezentation();
+	PROFILE_END(optionsStart, STAGE_OPTIONS);
 
-	Client client;
+	if(!options.exists(DHCP_MESSAGE_TYPE)) {
+		receiveMetrics->countDropped(DROP_MALFORMED);
+		return false;
+	}
+	incoming.messageType = *options.get(DHCP_MESSAGE_TYPE).value;
+	incoming.capturedAt = (int64_t)header->ts.tv_sec * 1000000 + header->ts.tv_usec;
+	receiveMetrics->countReceived(incoming.messageType);
+
+	incoming.dstAddr = ntohl(ipHeader->daddr);
+
+	/* Clients hashed to peers' buckets are dropped before any further work */
+	if(!loadBalancer->accepts(dhcpMsg, options, incoming.dstAddr)) {
+		receiveMetrics->countDropped(DROP_NOT_OWNED);
+		return false;
+	}
+
+	Client& client = incoming.client;
 	memset(&client, 0, sizeof(client));
 
+	client.interfaceIndex = receivingInterface->getIndex();
 	client.hardwareAddress.addressType = dhcpMsg.htype;
 	memcpy(client.hardwareAddress.hardwareAddress, dhcpMsg.chaddr, MAX_HADDR_SIZE);
 
@@ -113,37 +550,193 @@ void Server::dispatch(u_char *srv, const struct pcap_pkthdr *header, const u_cha
 		client.identificationMethod = BASED_ON_HARDWARE;
 	}
 
-	Server& server = *((Server*)srv);
-	client.networkAddress = server.networkResolver->determineNetworkAddress(dhcpMsg.giaddr);
+	PROFILE_SCOPE(STAGE_RESOLVE);
+	if(!networkResolver->determineNetworkAddress(dhcpMsg.giaddr, client.interfaceIndex, incoming.vlanTags, client.networkAddress)) {
+		receiveMetrics->countDropped(DROP_UNKNOWN_NETWORK);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Skips Ethernet header with up to two VLAN tags, which are stored for replies.
+ * Returns position of IPv4 header, 0 when the frame is too short or carries something else.
+ */
+unsigned Server::locateIpHeader(const u_char* frame, unsigned length, VlanTags& vlanTags) {
+	unsigned position = offsetof(struct ethhdr, h_proto);
+	vlanTags.count = 0;
+	for(;;) {
+		if(length < position + sizeof(uint16_t)) {
+			return 0;
+		}
+		uint16_t protocol = ntohs(*(const uint16_t*)(frame + position));
+		position += sizeof(uint16_t);
+		if(protocol == ETH_P_IP) {
+			break;
+		}
+
+		bool vlanProtocol = protocol == ETH_P_8021Q || protocol == ETH_P_8021AD || protocol == ETH_P_QINQ1;
+		if(!vlanProtocol || vlanTags.count == MAX_VLAN_TAGS || length < position + sizeof(uint16_t)) {
+			return 0;
+		}
+		vlanTags.protocols[vlanTags.count] = protocol;
+		vlanTags.controls[vlanTags.count] = ntohs(*(const uint16_t*)(frame + position));
+		++vlanTags.count;
+		position += sizeof(uint16_t);
+	}
+
+	if(length < position + sizeof(struct iphdr) || ((const struct iphdr*)(frame + position))->ihl < sizeof(struct iphdr) / 4) {
+		return 0;
+	}
+
+	return position;
+}
+
+/*
+ * Replayed reply goes through the caching sender too, so it is counted like a handled one.
+ * Without pipeline replies are written to the wire before handler returns, so latency is recorded here,
+ * pipeline records it in the transmit stage.
+ */
+void Server::process(IncomingMessage& incoming, TransactionsStorage& storage, ReplyCache& cache, MetricsShard& metricsShard, Sender& sender) {
+	uint64_t now = clock.monotonicMs();
+	CachingSender responseSender(sender, cache, metricsShard, incoming, now);
+	if(!cache.replay(incoming, responseSender, now)) {
+		handle(incoming, storage, metricsShard, responseSender);
+	}
+
+	if(pipeline == NULL && responseSender.getSentCount() > 0) {
+		metricsShard.recordLatency(Metrics::wallClockUs() - incoming.capturedAt);
+	}
+}
+
+void Server::handle(IncomingMessage& incoming, TransactionsStorage& storage, MetricsShard& metricsShard, Sender& responseSender) {
 
-	struct iphdr* ipHeader = (struct iphdr*)(rawMessage + sizeof(struct ethhdr));
-	uint32_t dstAddr = ntohl(ipHeader->daddr);
+	DHCPMessage& dhcpMsg = incoming.message;
+	Client& client = incoming.client;
+	uint32_t dstAddr = incoming.dstAddr;
 
-	uint8_t operationType = *options.get(DHCP_MESSAGE_TYPE).value;
-	switch(operationType) {
+	/* Options were converted to host order while parsing */
+	PROFILE_BEGIN(optionsStart);
+	Options options(dhcpMsg.options, incoming.optionsLength);
+	PROFILE_END(optionsStart, STAGE_OPTIONS);
+
+	switch(incoming.messageType) {
 		case(DHCPDISCOVER): {
-			DiscoverHandler(server.transactionsStorage, client, server.addressesAllocator, server).handle(dhcpMsg, options, dstAddr);
+			DiscoverHandler discoverHandler(storage, client, addressesAllocator, *this, responseSender);
+			discoverHandler.handle(dhcpMsg, options, dstAddr);
+			if(discoverHandler.isPoolExhausted()) {
+				metricsShard.countDropped(DROP_POOL_EXHAUSTED);
+			}
 			break;	
 		}
 		case(DHCPREQUEST): {
-			RequestHandler(server.transactionsStorage, client, server.addressesAllocator, server).handle(dhcpMsg, options, dstAddr);
+			RequestHandler requestHandler(storage, client, addressesAllocator, *this, responseSender);
+			requestHandler.handle(dhcpMsg, options, dstAddr);
+			metricsShard.countRequestState(requestHandler.getClientState());
 			break;	
 		}
 		case(DHCPDECLINE): {
-			DeclineHandler(server.transactionsStorage, client, server.addressesAllocator, server).handle(dhcpMsg, options, dstAddr);
+			DeclineHandler(storage, client, addressesAllocator, *this, responseSender).handle(dhcpMsg, options, dstAddr);
 			break;	
 		}
 		case(DHCPRELEASE): {
-			ReleaseHandler(server.transactionsStorage, client, server.addressesAllocator, server).handle(dhcpMsg, options, dstAddr);
+			ReleaseHandler(storage, client, addressesAllocator, *this, responseSender).handle(dhcpMsg, options, dstAddr);
 			break;	
 		}
 		case(DHCPINFORM): {
-			InformHandler(server.transactionsStorage, client, server.addressesAllocator, server).handle(dhcpMsg, options, dstAddr);
+			InformHandler(storage, client, addressesAllocator, *this, responseSender).handle(dhcpMsg, options, dstAddr);
 			break;	
 		};
 	}
 }
 
+/* With pipeline running, workers are held between batches while the snapshot is taken */
 void Server::save() {
+	PipelinePause pause(pipeline);
 	addressesAllocator.saveState();
 }
+
+void Server::reload() {
+	if(reloading) {
+		return;
+	}
+	reloading = true;
+
+	string filePath = config.getFilePath();
+	reloadThread = thread([this, filePath]() {
+		CpuAffinity::unpin(pthread_self());
+		try {
+			reloadedConfig = new Config(filePath.c_str());
+		}
+		catch(exception& e) {
+			reloadError = e.what();
+		}
+
+		uint64_t finished = 1;
+		if(write(reloadFd, &finished, sizeof(finished)) != sizeof(finished)) {
+			fprintf(stderr, "Could not notify about reloaded configuration\n");
+		}
+	});
+}
+
+void Server::onConfigReloaded() {
+	uint64_t finished = 0;
+	if(read(reloadFd, &finished, sizeof(finished)) != sizeof(finished)) {
+		return;
+	}
+
+	reloadThread.join();
+	reloading = false;
+
+	if(reloadedConfig == NULL) {
+		fprintf(stderr, "Could not reload configuration: %s\n", reloadError.c_str());
+		return;
+	}
+
+	applyConfig(*reloadedConfig);
+	delete reloadedConfig;
+	reloadedConfig = NULL;
+}
+
+/*
+ * New resolver is built before workers are paused, the pause only covers swapping
+ * configuration values and resizing pools in place. Leases and transactions are left untouched.
+ */
+void Server::applyConfig(Config& reloaded) {
+	warnAboutInterfacesChange(reloaded);
+
+	NetworkResolver* reloadedResolver = new NetworkResolver(reloaded);
+	LoadBalancer* reloadedBalancer = new LoadBalancer(reloaded, getServerIps());
+	{
+		PipelinePause pause(pipeline);
+		config = reloaded;
+		addressesAllocator.reconfigure();
+	}
+
+	delete networkResolver;
+	networkResolver = reloadedResolver;
+	delete loadBalancer;
+	loadBalancer = reloadedBalancer;
+	createRateLimiters(config);
+	if(pipeline != NULL) {
+		pipeline->warnAboutNetworksSpread();
+	}
+}
+
+/* Captures stay open on the interfaces from startup, reloaded networks are matched to them by position */
+void Server::warnAboutInterfacesChange(Config& reloaded) {
+	const vector<InterfaceDescriptor>& reloadedInterfaces = reloaded.getInterfaces();
+	bool changed = reloadedInterfaces.size() != interfaces.size();
+	for(size_t i = 0; i < reloadedInterfaces.size() && !changed; ++i) {
+		changed = reloadedInterfaces[i].name != interfaces[i]->getName();
+	}
+
+	if(changed) {
+		fprintf(stderr, "Interfaces change requires restart, keeping captures on:");
+		for(vector<NetworkInterface*>::iterator it = interfaces.begin(); it != interfaces.end(); it++) {
+			fprintf(stderr, " %s", (*it)->getName());
+		}
+		fprintf(stderr, "\n");
+	}
+}
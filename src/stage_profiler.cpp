@@ -0,0 +1,114 @@
+#include "../inc/stage_profiler.h"
+#include "../inc/metrics.h"
+#include <time.h>
+#include <algorithm>
+#include <mutex>
+#include <sstream>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILER_UNIT "cycles"
+#else
+#define PROFILER_UNIT "ns"
+#endif
+
+using namespace std;
+
+#ifdef DHCP_PROFILING
+static const char* stageNames[STAGES_COUNT] = {
+	"parse", "options", "resolve", "lookup", "allocate", "pack", "send"
+};
+#endif
+
+/* Written only by its owning thread, histogram buckets are shared with reply latency metrics */
+struct ThreadProfile {
+	ThreadProfile(): id(0) {
+		for(unsigned stage = 0; stage < STAGES_COUNT; ++stage) {
+			count[stage] = 0;
+			sum[stage] = 0;
+			max[stage] = 0;
+			for(unsigned bucket = 0; bucket < LATENCY_BUCKETS; ++bucket) {
+				histogram[stage][bucket] = 0;
+			}
+		}
+	}
+
+	unsigned id;
+	atomic<uint64_t> count[STAGES_COUNT];
+	atomic<uint64_t> sum[STAGES_COUNT];
+	atomic<uint64_t> max[STAGES_COUNT];
+	atomic<uint64_t> histogram[STAGES_COUNT][LATENCY_BUCKETS];
+};
+
+static mutex profilesMutex;
+static vector<ThreadProfile*> profiles;
+static thread_local ThreadProfile* threadProfile = NULL;
+
+static void increment(atomic<uint64_t>& counter, uint64_t value) {
+	counter.store(counter.load(memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+uint64_t StageProfiler::now() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+#endif
+}
+
+/* Profiles are registered on first use and kept for the process lifetime */
+void StageProfiler::record(ProfiledStage stage, uint64_t elapsed) {
+	if(threadProfile == NULL) {
+		lock_guard<mutex> lock(profilesMutex);
+		threadProfile = new ThreadProfile();
+		threadProfile->id = profiles.size();
+		profiles.push_back(threadProfile);
+	}
+
+	increment(threadProfile->count[stage], 1);
+	increment(threadProfile->sum[stage], elapsed);
+	increment(threadProfile->histogram[stage][Metrics::latencyBucket(elapsed)], 1);
+	if(elapsed > threadProfile->max[stage].load(memory_order_relaxed)) {
+		threadProfile->max[stage].store(elapsed, memory_order_relaxed);
+	}
+}
+
+string StageProfiler::dump() {
+#ifndef DHCP_PROFILING
+	return "profiling is not compiled in, build with ./configure --profile\n";
+#else
+	ostringstream output;
+	lock_guard<mutex> lock(profilesMutex);
+	for(vector<ThreadProfile*>::iterator it = profiles.begin(); it != profiles.end(); it++) {
+		ThreadProfile& profile = **it;
+		for(unsigned stage = 0; stage < STAGES_COUNT; ++stage) {
+			uint64_t count = profile.count[stage].load(memory_order_relaxed);
+			if(count == 0) {
+				continue;
+			}
+
+			uint64_t maxElapsed = profile.max[stage].load(memory_order_relaxed);
+			uint64_t p50 = 0, p99 = 0, seen = 0;
+			for(unsigned bucket = 0; bucket < LATENCY_BUCKETS; ++bucket) {
+				seen += profile.histogram[stage][bucket].load(memory_order_relaxed);
+				if(!p50 && seen * 2 >= count) {
+					p50 = Metrics::latencyBucketUpperBound(bucket);
+				}
+				if(!p99 && seen * 100 >= count * 99) {
+					p99 = Metrics::latencyBucketUpperBound(bucket);
+				}
+			}
+
+			output << "thread " << profile.id << " " << stageNames[stage]
+				<< " count " << count
+				<< " mean " << profile.sum[stage].load(memory_order_relaxed) / count
+				<< " p50 " << min(p50, maxElapsed) << " p99 " << min(p99, maxElapsed)
+				<< " max " << maxElapsed << " " PROFILER_UNIT "\n";
+		}
+	}
+
+	return output.str();
+#endif
+}
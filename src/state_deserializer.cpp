@@ -1,5 +1,12 @@
 #include "../inc/state_deserializer.h"
+#include "../inc/crc32c.h"
 #include <stdio.h>
+#include <string.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 using namespace std;
 
@@ -12,73 +19,153 @@ bool StateDeserializer::cacheExists(const char* filePath) {
     return 0;
 }
 
-StateDeserializer::StateDeserializer(const char* filePath) {
-	file = fopen(filePath, "rb");
+StateDeserializer::StateDeserializer(const char* filePath): mapping(NULL), mappingSize(0), valid(false) {
+	memset(sections, 0, sizeof(sections));
+	map(filePath);
+	valid = (mapping != NULL) && validate();
 }
 
 StateDeserializer::~StateDeserializer() {
-	fclose(file);
+	if(mapping != NULL) {
+		munmap(mapping, mappingSize);
+	}
 }
 
-size_t StateDeserializer::deserialize(AllocatedAddress* address) {
-	return deserialize(&address->ipAddress)
-		+ deserialize(&address->mask)
-		+ deserialize(&address->leaseTime)
-		+ deserialize(&address->allocationTime)
-		+ deserialize(&address->dnsServers)
-		+ deserialize(&address->routers);
+void StateDeserializer::map(const char* filePath) {
+	int fd = open(filePath, O_RDONLY);
+	if(fd < 0) {
+		return;
+	}
+
+	struct stat fileStat;
+	if(fstat(fd, &fileStat) == 0 && fileStat.st_size > 0) {
+		void* mapped = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+		if(mapped != MAP_FAILED) {
+			mapping = (uint8_t*)mapped;
+			mappingSize = fileStat.st_size;
+			madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+		}
+	}
+	close(fd);
 }
 
-size_t StateDeserializer::deserialize(list<uint32_t>* uint32List) {
-	uint32_t listSize = 0;
-	deserialize(&listSize);
+bool StateDeserializer::isValid() {
+	return valid;
+}
+
+bool StateDeserializer::validate() {
+	if(mappingSize < sizeof(LeaseFileHeader)) {
+		return false;
+	}
 
-	size_t bytesReaded = 0;
-	for(unsigned i = 0; i < listSize; ++i) {
-		uint32_t element;
-		bytesReaded += fread(&element, sizeof(uint32_t), 1, file);
-		uint32List->push_back(element);
+	const LeaseFileHeader* header = (const LeaseFileHeader*)mapping;
+	if(memcmp(header->magic, LEASE_FILE_MAGIC, LEASE_FILE_MAGIC_SIZE) != 0
+		|| le32toh(header->version) != LEASE_FILE_VERSION
+		|| le32toh(header->headerCrc) != Crc32c::compute(header, offsetof(LeaseFileHeader, headerCrc))) {
+		return false;
 	}
 
-	return bytesReaded;
+	size_t offset = sizeof(LeaseFileHeader);
+	uint32_t sectionsCount = le32toh(header->sectionsCount);
+	for(uint32_t i = 0; i < sectionsCount; ++i) {
+		const LeaseSectionHeader* section = (const LeaseSectionHeader*)(mapping + offset);
+		size_t sectionSize = 0;
+		if(!validateSection(section, mappingSize - offset, &sectionSize)) {
+			return false;
+		}
+
+		uint32_t type = le32toh(section->type);
+		if(type >= 1 && type <= LEASE_SECTIONS_COUNT) {
+			sections[type] = section;
+		}
+		offset += sectionSize;
+	}
+
+	return true;
 }
 
-size_t StateDeserializer::deserialize(uint32_t* target) {
-	return fread(target, sizeof(uint32_t), 1, file);
+bool StateDeserializer::validateSection(const LeaseSectionHeader* section, size_t availableSize, size_t* sectionSize) {
+	if(availableSize < sizeof(LeaseSectionHeader)
+		|| le32toh(section->headerCrc) != Crc32c::compute(section, offsetof(LeaseSectionHeader, headerCrc))) {
+		return false;
+	}
+
+	uint32_t type = le32toh(section->type);
+	uint32_t recordSize = le32toh(section->recordSize);
+	uint64_t recordsCount = le64toh(section->recordsCount);
+
+	size_t expectedSize = expectedRecordSize(type);
+	if((expectedSize != 0 && recordSize != expectedSize) || recordSize == 0
+		|| recordsCount > (availableSize - sizeof(LeaseSectionHeader)) / recordSize) {
+		return false;
+	}
+
+	size_t recordsSize = recordsCount * recordSize;
+	if(le32toh(section->recordsCrc) != Crc32c::compute(section + 1, recordsSize)) {
+		return false;
+	}
+
+	*sectionSize = sizeof(LeaseSectionHeader) + recordsSize;
+	return true;
+}
+
+size_t StateDeserializer::expectedRecordSize(uint32_t sectionType) {
+	switch(sectionType) {
+		case HARDWARE_LEASES_SECTION:
+			return sizeof(HardwareLeaseRecord);
+		case SPECIAL_ID_LEASES_SECTION:
+			return sizeof(SpecialIdLeaseRecord);
+		case POOLS_SECTION:
+			return sizeof(PoolRecord);
+		case ABANDONED_ADDRESSES_SECTION:
+			return sizeof(AbandonedAddressRecord);
+		default:
+			/* Unknown sections written by newer versions are skipped */
+			return 0;
+	}
 }
 
-size_t StateDeserializer::deserialize(time_t* target) {
-	return fread(target, sizeof(time_t), 1, file);
+template <class T> size_t StateDeserializer::getSection(uint32_t type, const T** records) {
+	const LeaseSectionHeader* section = valid ? sections[type] : NULL;
+	if(section == NULL) {
+		*records = NULL;
+		return 0;
+	}
+
+	*records = (const T*)(section + 1);
+	return le64toh(section->recordsCount);
 }
 
+size_t StateDeserializer::getRecords(const HardwareLeaseRecord** records) {
+	return getSection(HARDWARE_LEASES_SECTION, records);
+}
 
-size_t StateDeserializer::deserialize(HardwareAddress* hardwareAddress) {
-	return fread(&hardwareAddress->addressType, sizeof(uint8_t), 1, file) 
-		+ fread(hardwareAddress->hardwareAddress, sizeof(uint8_t), MAX_HADDR_SIZE, file);
+size_t StateDeserializer::getRecords(const SpecialIdLeaseRecord** records) {
+	return getSection(SPECIAL_ID_LEASES_SECTION, records);
 }
 
-size_t StateDeserializer::deserialize(ClientSpecialId* clientId) {
-	return fread(&clientId->type, sizeof(uint8_t), 1, file)
-		+ fread(clientId->value, sizeof(uint8_t), CLIENT_SPECIAL_ID_MAX_LEN, file);
+size_t StateDeserializer::getRecords(const PoolRecord** records) {
+	return getSection(POOLS_SECTION, records);
 }
 
-size_t StateDeserializer::deserialize(AddressesPool* pool) {
-	return fread(&pool->networkAddress, sizeof(pool->networkAddress), 1, file)
-		+ fread(&pool->nextToAssign, sizeof(pool->nextToAssign), 1, file)
-		+ deserialize(&pool->abandonedAddresses);
+size_t StateDeserializer::getRecords(const AbandonedAddressRecord** records) {
+	return getSection(ABANDONED_ADDRESSES_SECTION, records);
 }
 
-size_t StateDeserializer::deserialize(unordered_set<uint32_t>* uint32Set) {
-	uint32_t setSize = 0;
-	deserialize(&setSize);
+uint32_t StateDeserializer::deserialize(const LeaseRecord& record, AllocatedAddress* address) {
+	address->ipAddress = le32toh(record.ipAddress);
+	address->leaseTime = le32toh(record.leaseTime);
+	address->allocationTime = (time_t)(int64_t)le64toh(record.allocationTime);
 
-	size_t elementsSizeInBytes = 0;
+	return le32toh(record.networkAddress);
+}
 
-	for(unsigned i = 0; i < setSize; ++i) {
-		uint32_t element = 0;
-		elementsSizeInBytes += fread(&element, sizeof(element), 1, file);
-		uint32Set->insert(element);
-	}
+void StateDeserializer::deserialize(const HardwareLeaseRecord& record, HardwareAddress* hardwareAddress) {
+	hardwareAddress->addressType = record.addressType;
+	memcpy(hardwareAddress->hardwareAddress, record.hardwareAddress, MAX_HADDR_SIZE);
+}
 
-	return elementsSizeInBytes;
+void StateDeserializer::deserialize(const SpecialIdLeaseRecord& record, ClientSpecialId* specialId) {
+	specialId->type = record.type;
+	memcpy(specialId->value, record.value, CLIENT_SPECIAL_ID_MAX_LEN);
 }
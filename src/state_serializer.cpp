@@ -1,63 +1,128 @@
 #include "../inc/state_serializer.h"
+#include "../inc/crc32c.h"
 #include <stdio.h>
+#include <string.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdexcept>
 
 using namespace std;
 
-StateSerializer::StateSerializer(const char* filePath) {
-	remove(filePath);
-	file = fopen(filePath, "wb");
+StateSerializer::StateSerializer(const char* path): filePath(path) {}
+
+void StateSerializer::serialize(uint32_t networkAddress, const HardwareAddress& hardwareAddress, const AllocatedAddress& address) {
+	hardwareLeases.push_back(HardwareLeaseRecord());
+	HardwareLeaseRecord& record = hardwareLeases.back();
+	memset(&record, 0, sizeof(record));
+
+	fillLeaseRecord(record.lease, networkAddress, address);
+	record.addressType = hardwareAddress.addressType;
+	memcpy(record.hardwareAddress, hardwareAddress.hardwareAddress, MAX_HADDR_SIZE);
 }
 
-StateSerializer::~StateSerializer() {
-	fclose(file);
+void StateSerializer::serialize(uint32_t networkAddress, const ClientSpecialId& specialId, const AllocatedAddress& address) {
+	specialIdLeases.push_back(SpecialIdLeaseRecord());
+	SpecialIdLeaseRecord& record = specialIdLeases.back();
+
+	fillLeaseRecord(record.lease, networkAddress, address);
+	record.type = specialId.type;
+	memcpy(record.value, specialId.value, CLIENT_SPECIAL_ID_MAX_LEN);
 }
 
-void StateSerializer::serialize(const AllocatedAddress& address) {
-	serialize(address.ipAddress);
-	serialize(address.mask);
-	serialize(address.leaseTime);
-	serializeTime(address.allocationTime);
-	
-	serialize(address.dnsServers);
-	serialize(address.routers);
+void StateSerializer::fillLeaseRecord(LeaseRecord& record, uint32_t networkAddress, const AllocatedAddress& address) {
+	record.networkAddress = htole32(networkAddress);
+	record.ipAddress = htole32(address.ipAddress);
+	record.leaseTime = htole32(address.leaseTime);
+	record.reserved = 0;
+	record.allocationTime = htole64(address.allocationTime);
 }
 
-void StateSerializer::serialize(const list<uint32_t>& uint32List) {
-	serialize(uint32List.size());
+void StateSerializer::serialize(const AddressesPool& pool) {
+	PoolRecord poolRecord;
+	poolRecord.networkAddress = htole32(pool.networkAddress);
+	poolRecord.nextToAssign = htole32(pool.nextToAssign);
+	pools.push_back(poolRecord);
 
-	for(list<uint32_t>::const_iterator it = uint32List.begin(); it != uint32List.end(); it++) {
-		fwrite(&*it, sizeof(uint32_t), 1, file);
+	for(unordered_set<uint32_t>::const_iterator it = pool.abandonedAddresses.begin(); it != pool.abandonedAddresses.end(); it++) {
+		AbandonedAddressRecord abandonedRecord;
+		abandonedRecord.networkAddress = htole32(pool.networkAddress);
+		abandonedRecord.address = htole32(*it);
+		abandonedAddresses.push_back(abandonedRecord);
 	}
 }
 
-void StateSerializer::serialize(const HardwareAddress& hardwareAddress) {
-	fwrite(&hardwareAddress.addressType, sizeof(uint8_t), 1, file);
-	fwrite(&hardwareAddress.hardwareAddress, sizeof(uint8_t), MAX_HADDR_SIZE, file);
-}
+void StateSerializer::commit() {
+	string temporaryPath = filePath + ".tmp";
+	FILE* file = fopen(temporaryPath.c_str(), "wb");
+	if(file == NULL) {
+		throw runtime_error("Could not open cache file for writing");
+	}
+
+	try {
+		writeHeader(file, 4);
+		writeSection(file, POOLS_SECTION, pools);
+		writeSection(file, ABANDONED_ADDRESSES_SECTION, abandonedAddresses);
+		writeSection(file, HARDWARE_LEASES_SECTION, hardwareLeases);
+		writeSection(file, SPECIAL_ID_LEASES_SECTION, specialIdLeases);
+	}
+	catch(runtime_error& e) {
+		fclose(file);
+		remove(temporaryPath.c_str());
+		throw;
+	}
 
-void StateSerializer::serialize(const ClientSpecialId& specialId) {
-	fwrite(&specialId.type, sizeof(uint8_t), 1, file);
-	fwrite(&specialId.value, sizeof(uint8_t), CLIENT_SPECIAL_ID_MAX_LEN, file);
+	bool synced = fflush(file) == 0 && fsync(fileno(file)) == 0;
+	if(fclose(file) != 0 || !synced || rename(temporaryPath.c_str(), filePath.c_str()) != 0) {
+		remove(temporaryPath.c_str());
+		throw runtime_error("Could not replace cache file");
+	}
+	syncDirectory();
 }
 
-void StateSerializer::serialize(const uint32_t value) {
-	fwrite(&value, sizeof(value), 1, file);
+/* Rename is only durable once the directory entry is written, otherwise a crash may bring back the old file or none */
+void StateSerializer::syncDirectory() {
+	size_t separator = filePath.rfind('/');
+	string directory = separator == string::npos ? "." : filePath.substr(0, separator + 1);
+
+	int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+	if(fd < 0) {
+		throw runtime_error("Could not open cache directory " + directory);
+	}
+	int synced = fsync(fd);
+	close(fd);
+	if(synced != 0) {
+		throw runtime_error("Could not sync cache directory " + directory);
+	}
 }
 
-void StateSerializer::serializeTime(const time_t value) {
-	fwrite(&value, sizeof(value), 1, file);
+void StateSerializer::writeHeader(FILE* file, uint32_t sectionsCount) {
+	LeaseFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, LEASE_FILE_MAGIC, LEASE_FILE_MAGIC_SIZE);
+	header.version = htole32(LEASE_FILE_VERSION);
+	header.sectionsCount = htole32(sectionsCount);
+	header.headerCrc = htole32(Crc32c::compute(&header, offsetof(LeaseFileHeader, headerCrc)));
+
+	write(file, &header, sizeof(header));
 }
 
-void StateSerializer::serialize(const AddressesPool& pool) {
-	fwrite(&pool.networkAddress, sizeof(pool.networkAddress), 1, file);
-	fwrite(&pool.nextToAssign, sizeof(pool.nextToAssign), 1, file);
+template <class T> void StateSerializer::writeSection(FILE* file, uint32_t type, const vector<T>& records) {
+	size_t recordsSize = records.size() * sizeof(T);
+
+	LeaseSectionHeader header;
+	header.type = htole32(type);
+	header.recordSize = htole32(sizeof(T));
+	header.recordsCount = htole64(records.size());
+	header.recordsCrc = htole32(Crc32c::compute(records.data(), recordsSize));
+	header.headerCrc = htole32(Crc32c::compute(&header, offsetof(LeaseSectionHeader, headerCrc)));
 
-	serialize(pool.abandonedAddresses);
+	write(file, &header, sizeof(header));
+	write(file, records.data(), recordsSize);
 }
 
-void StateSerializer::serialize(const std::unordered_set<uint32_t>& uint32Set) {
-	serialize(uint32Set.size());
-	for(unordered_set<uint32_t>::const_iterator it = uint32Set.begin(); it != uint32Set.end(); it++) {
-		fwrite(&*it, sizeof(uint32_t), 1, file);
+void StateSerializer::write(FILE* file, const void* data, size_t size) {
+	if(size > 0 && fwrite(data, size, 1, file) != 1) {
+		throw runtime_error("Could not write cache file");
 	}
 }
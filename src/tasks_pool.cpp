@@ -0,0 +1,52 @@
+#include "../inc/tasks_pool.h"
+#include "../inc/cpu_affinity.h"
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+TasksPool::TasksPool(unsigned threads) {
+	threadsCount = threads ? threads : thread::hardware_concurrency();
+	if(threadsCount == 0) {
+		threadsCount = 1;
+	}
+}
+
+void TasksPool::run(const vector<function<void()> >& tasks) {
+	atomic<size_t> nextTask(0);
+	exception_ptr firstError;
+	mutex errorMutex;
+
+	function<void()> worker = [&]() {
+		for(size_t taskIdx = nextTask++; taskIdx < tasks.size(); taskIdx = nextTask++) {
+			try {
+				tasks[taskIdx]();
+			}
+			catch(...) {
+				lock_guard<mutex> lock(errorMutex);
+				if(!firstError) {
+					firstError = current_exception();
+				}
+			}
+		}
+	};
+
+	size_t workersCount = (tasks.size() < threadsCount) ? tasks.size() : threadsCount;
+	vector<thread> workers;
+	for(size_t i = 1; i < workersCount; ++i) {
+		workers.push_back(thread(worker));
+		CpuAffinity::unpin(workers.back().native_handle());
+	}
+	/* Calling thread takes part in processing instead of idling on join */
+	worker();
+
+	for(vector<thread>::iterator it = workers.begin(); it != workers.end(); it++) {
+		it->join();
+	}
+
+	if(firstError) {
+		rethrow_exception(firstError);
+	}
+}
@@ -1,51 +1,42 @@
 #include "../inc/transactions_storage.h"
+#include "../inc/tracepoints.h"
 #include <string.h>
 #include <stdexcept>
 
 using namespace std;
 
-TransactionsStorage::TransactionsStorage(Config& configuration): config(configuration) {}
-
-void deleteOldTransaction(union sigval data) {
-	CleanTaskData* taskData = (CleanTaskData*)data.sival_ptr;
-	taskData->storage->removeTransaction(taskData->transactionId);
-}
+TransactionsStorage::TransactionsStorage(Config& configuration, Clock& clockToUse): config(configuration), clock(clockToUse) {}
 
 Transaction& TransactionsStorage::createTransaction(uint32_t xid, AllocatedAddress* allocatedAddress) {
 	Transaction& transaction = transactions[xid];
 	transaction.id = xid;
 	transaction.allocatedAddress = allocatedAddress;
-	scheduleCleanTask(transaction.id);
+
+	time_t expirationTime = now() + config.getTransactionStorageTime();
+	expirationTimes[xid] = expirationTime;
+	expirationQueue.push_back(make_pair(expirationTime, xid));
+	TRACE2(transaction__create, xid, allocatedAddress != NULL ? allocatedAddress->ipAddress : 0);
 
 	return transaction;
 }
 
-void TransactionsStorage::scheduleCleanTask(uint32_t transactionId) {
-	CleanTaskData& taskData = cleanTasksData[transactionId];
-	taskData.transactionId = transactionId;
-	taskData.storage = this;
-
-	struct sigevent onTick;
-	memset(&onTick, 0, sizeof(onTick));
-	onTick.sigev_notify = SIGEV_THREAD;
-	onTick.sigev_signo = 0;
-	onTick.sigev_value.sival_ptr = &taskData;
-	onTick.sigev_notify_function = deleteOldTransaction;
-
-	if(timer_create(CLOCK_MONOTONIC, &onTick, &taskData.timer) < 0) {
-		throw runtime_error("Could not create clock for transaction delete task");
+void TransactionsStorage::removeExpired() {
+	time_t currentTime = now();
+	while(!expirationQueue.empty() && expirationQueue.front().first <= currentTime) {
+		uint32_t xid = expirationQueue.front().second;
+
+		/* Entry is stale when transaction was removed or created again in the meantime */
+		TrackedUnorderedMap<uint32_t, time_t, MEMORY_TRANSACTIONS>::iterator expirationIt = expirationTimes.find(xid);
+		if(expirationIt != expirationTimes.end() && expirationIt->second == expirationQueue.front().first) {
+			TRACE1(transaction__expire, xid);
+			removeTransaction(xid);
+		}
+		expirationQueue.pop_front();
 	}
+}
 
-	struct itimerspec newValue;
-	memset(&newValue, 0, sizeof(newValue));
-	newValue.it_value.tv_sec = config.getTransactionStorageTime();
-
-	struct itimerspec oldValue;
-	memset(&oldValue, 0, sizeof(oldValue));
-
-	if(timer_settime(taskData.timer, 0, &newValue, &oldValue) < 0) {
-		throw runtime_error("Could not set timer for transaction delete task");
-	}
+time_t TransactionsStorage::now() {
+	return clock.monotonicMs() / 1000;
 }
 
 const Transaction& TransactionsStorage::getTransaction(uint32_t id) {
@@ -55,8 +46,7 @@ const Transaction& TransactionsStorage::getTransaction(uint32_t id) {
 void TransactionsStorage::removeTransaction(uint32_t id) {
 	if(transactionExists(id)) {
 		transactions.erase(id);
-		timer_delete(cleanTasksData[id].timer);
-		cleanTasksData.erase(id);
+		expirationTimes.erase(id);
 	}
 }
 
@@ -0,0 +1,39 @@
+#include "tests.h"
+#include "../inc/network_resolver.h"
+#include <stdio.h>
+
+using namespace std;
+
+static unsigned failures = 0;
+
+static void checkRelay(NetworkResolver& resolver, uint32_t giaddr, bool expectedFound, uint32_t expectedNetwork) {
+	VlanTags untagged = VlanTags();
+	uint32_t networkAddress = 0;
+	bool found = resolver.determineNetworkAddress(giaddr, 0, untagged, networkAddress);
+	if(found != expectedFound || (found && networkAddress != expectedNetwork)) {
+		printf("FAIL resolver: relay %08x resolved: %d network: %08x, expected resolved: %d network: %08x\n", giaddr, found, networkAddress, expectedFound, expectedNetwork);
+		++failures;
+	}
+}
+
+/*
+ * Pools 10.0.0.0/16 and 10.1.0.0/24 do not overlap, 10.2.0.0/16 contains 10.2.1.0/24.
+ * Relay has to fall into the network of a pool under that pool's own mask.
+ */
+unsigned testNetworkResolver(Config& config) {
+	NetworkResolver resolver(config);
+
+	checkRelay(resolver, 0x0a000301, true, 0x0a000000);
+	checkRelay(resolver, 0x0a010001, true, 0x0a010000);
+	/* Masked with /16 it gives 10.1.0.0, which is only a /24 network */
+	checkRelay(resolver, 0x0a010501, false, 0);
+	checkRelay(resolver, 0x0a010501, false, 0);
+	checkRelay(resolver, 0x0a020001, true, 0x0a020000);
+	checkRelay(resolver, 0x0a020105, true, 0x0a020100);
+	checkRelay(resolver, 0x0b000001, false, 0);
+
+	if(failures == 0) {
+		printf("network resolver: ok\n");
+	}
+	return failures;
+}
@@ -0,0 +1,16 @@
+#include "tests.h"
+#include <stdio.h>
+
+int main(int argc, char** argv) {
+	if(argc < 2) {
+		fprintf(stderr, "Usage: %s config.json\n", argv[0]);
+		return 1;
+	}
+
+	Config config(argv[1]);
+	unsigned failures = 0;
+	failures += testVlanReplies(config);
+	failures += testNetworkResolver(config);
+
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,10 @@
+#ifndef TESTS_H
+#define TESTS_H
+
+#include "../inc/config.h"
+
+/* Each test prints failed checks and returns their count, test/config.json describes what they expect */
+unsigned testVlanReplies(Config&);
+unsigned testNetworkResolver(Config&);
+
+#endif
@@ -0,0 +1,174 @@
+#include "tests.h"
+#include "../inc/clock.h"
+#include "../inc/metrics.h"
+#include "../inc/pipeline.h"
+#include "../inc/request_processor.h"
+#include "../inc/request_scheduler.h"
+#include "../inc/reply_cache.h"
+#include "../inc/sender.h"
+#include "../inc/protocol.h"
+#include <linux/if_ether.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+#define REPLY_WAIT_ROUNDS 1000
+#define REPLY_WAIT_US 1000
+
+/* Stands in for the wire sender, remembers tags every reply frame would be built with */
+class RecordingSender: public Sender {
+	public:
+		void send(DHCPMessage& reply, unsigned messageType) {
+			VlanTags untagged = VlanTags();
+			sendTagged(reply, messageType, untagged);
+		}
+
+		void sendTagged(DHCPMessage& reply, unsigned, const VlanTags& vlanTags) {
+			uint32_t xid = reply.xid;
+			lock_guard<mutex> lock(repliesMutex);
+			replies.push_back(make_pair(xid, vlanTags));
+		}
+
+		bool find(uint32_t xid, VlanTags& vlanTags) {
+			lock_guard<mutex> lock(repliesMutex);
+			for(vector<pair<uint32_t, VlanTags> >::iterator it = replies.begin(); it != replies.end(); it++) {
+				if(it->first == xid) {
+					vlanTags = it->second;
+					return true;
+				}
+			}
+			return false;
+		}
+
+	private:
+		mutex repliesMutex;
+		vector<pair<uint32_t, VlanTags> > replies;
+};
+
+/* Answers every request with an offer, through the reply cache like the server does */
+class EchoProcessor: public RequestProcessor {
+	public:
+		EchoProcessor(Clock& clock): clock(clock) {}
+
+		void process(IncomingMessage& incoming, TransactionsStorage&, ReplyCache& cache, MetricsShard& metrics, Sender& sender) {
+			CachingSender responseSender(sender, cache, metrics, incoming, clock.monotonicMs());
+			DHCPMessage reply;
+			memcpy(&reply, &incoming.message, sizeof(reply));
+			responseSender.send(reply, DHCPOFFER);
+		}
+
+	private:
+		Clock& clock;
+};
+
+static unsigned failures = 0;
+
+static IncomingMessage makeRequest(uint32_t xid, uint8_t tagsCount, uint16_t outerVlan, uint16_t innerVlan) {
+	IncomingMessage incoming = IncomingMessage();
+	incoming.message.xid = xid;
+	incoming.messageType = DHCPREQUEST;
+	incoming.client.networkAddress = 0x0a000000;
+	incoming.vlanTags.count = tagsCount;
+	incoming.vlanTags.protocols[0] = tagsCount > 1 ? ETH_P_8021AD : ETH_P_8021Q;
+	incoming.vlanTags.controls[0] = (3 << 13) | outerVlan;
+	incoming.vlanTags.protocols[1] = ETH_P_8021Q;
+	incoming.vlanTags.controls[1] = innerVlan;
+
+	return incoming;
+}
+
+static void checkReply(const char* mode, RecordingSender& sender, const IncomingMessage& request) {
+	VlanTags sent;
+	if(!sender.find(request.message.xid, sent)) {
+		printf("FAIL %s: no reply to xid %u\n", mode, request.message.xid);
+		++failures;
+		return;
+	}
+
+	const VlanTags& expected = request.vlanTags;
+	bool same = sent.count == expected.count;
+	for(unsigned i = 0; i < expected.count && same; ++i) {
+		same = sent.protocols[i] == expected.protocols[i] && sent.controls[i] == expected.controls[i];
+	}
+	if(!same) {
+		printf("FAIL %s: reply to xid %u sent with %u tags, expected %u\n", mode, request.message.xid, sent.count, expected.count);
+		++failures;
+	}
+}
+
+/* Untagged request follows tagged ones, so tags left in a reused slot would show up on its reply */
+static vector<IncomingMessage> makeRequests() {
+	vector<IncomingMessage> requests;
+	requests.push_back(makeRequest(1, 2, 200, 7));
+	requests.push_back(makeRequest(2, 0, 0, 0));
+	requests.push_back(makeRequest(3, 1, 100, 0));
+	requests.push_back(makeRequest(4, 0, 0, 0));
+
+	return requests;
+}
+
+/* Same path as Server::processScheduled */
+static void testScheduler(Config& config, Clock& clock, Metrics& metrics) {
+	RequestScheduler scheduler(config);
+	ReplyCache cache(config);
+	TransactionsStorage storage(config, clock);
+	RecordingSender wire;
+	EchoProcessor processor(clock);
+	MetricsShard* shard = metrics.createShard();
+
+	vector<IncomingMessage> requests = makeRequests();
+	for(vector<IncomingMessage>::iterator it = requests.begin(); it != requests.end(); it++) {
+		scheduler.enqueue(*it, clock.monotonicMs());
+	}
+
+	IncomingMessage* message;
+	while((message = scheduler.front(clock.monotonicMs())) != NULL) {
+		TaggedSender interfaceSender(wire, message->vlanTags);
+		processor.process(*message, storage, cache, *shard, interfaceSender);
+		scheduler.pop();
+	}
+
+	for(vector<IncomingMessage>::iterator it = requests.begin(); it != requests.end(); it++) {
+		checkReply("scheduler", wire, *it);
+	}
+}
+
+static void testPipeline(Config& config, Clock& clock, Metrics& metrics) {
+	RecordingSender wire;
+	EchoProcessor processor(clock);
+	vector<Sender*> transmitters(1, &wire);
+	Pipeline pipeline(config, processor, clock, transmitters, metrics);
+	pipeline.start();
+
+	vector<IncomingMessage> requests = makeRequests();
+	for(vector<IncomingMessage>::iterator it = requests.begin(); it != requests.end(); it++) {
+		pipeline.submit(*it);
+	}
+
+	VlanTags sent;
+	for(unsigned i = 0; i < REPLY_WAIT_ROUNDS && !wire.find(requests.back().message.xid, sent); ++i) {
+		usleep(REPLY_WAIT_US);
+	}
+	pipeline.stop();
+
+	for(vector<IncomingMessage>::iterator it = requests.begin(); it != requests.end(); it++) {
+		checkReply("pipeline", wire, *it);
+	}
+}
+
+unsigned testVlanReplies(Config& config) {
+	CoarseClock clock;
+	Metrics metrics;
+
+	testScheduler(config, clock, metrics);
+	testPipeline(config, clock, metrics);
+
+	if(failures == 0) {
+		printf("vlan replies: ok\n");
+	}
+	return failures;
+}